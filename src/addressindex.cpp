@@ -0,0 +1,171 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <addressindex.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <txdb.h>
+#include <txmempool.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/thread.hpp>
+
+std::unique_ptr<CAddressIndexBuilder> g_addressindex;
+
+bool InitAddressIndex(const CChainParams& chainparams, bool fEnable)
+{
+    LOCK(cs_main);
+    const CBlockIndex* pindexBest = nullptr;
+    uint256 hashBest;
+    if (pblocktree->ReadAddressBestBlock(hashBest)) {
+        pindexBest = LookupBlockIndex(hashBest);
+        if (!pindexBest && hashBest != chainparams.GetConsensus().hashGenesisBlock)
+            LogPrintf("Address index best block %s not found, building it from the genesis block\n", hashBest.ToString());
+    } else {
+        // Older versions kept the index at the chainstate tip without recording it.
+        pindexBest = chainActive.Tip();
+        if (!pblocktree->FlushAddress(pindexBest ? pindexBest->GetBlockHash() : chainparams.GetConsensus().hashGenesisBlock))
+            return error("%s: failed to write address index best block", __func__);
+    }
+    if (fEnable) {
+        g_addressindex.reset(new CAddressIndexBuilder(pindexBest));
+        RegisterValidationInterface(g_addressindex.get());
+    }
+    return true;
+}
+
+void CAddressIndexBuilder::UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload)
+{
+    if (!m_synced) m_cond.notify_all();
+}
+
+void CAddressIndexBuilder::ThreadSync(const CChainParams& chainparams)
+{
+    const CBlockIndex* pindex = m_best_block;
+    int64_t nLastFlush = GetTime();
+    int64_t nLastLog = 0;
+    try {
+        while (true) {
+            boost::this_thread::interruption_point();
+            const CBlockIndex* pindexNext = nullptr;
+            bool fConnect = true;
+            {
+                LOCK(cs_main);
+                if (!pindex) pindex = chainActive.Genesis();
+                if (pindex && pindex == chainActive.Tip()) {
+                    // Caught up: from now on ConnectTip and DisconnectTip keep the index, flushed with the coins.
+                    if (!pblocktree->FlushAddress(pindex->GetBlockHash())) {
+                        LogPrintf("%s: failed to write address index, sync stopped\n", __func__);
+                        return;
+                    }
+                    m_best_block = pindex;
+                    m_synced = true;
+                    LogPrintf("Address index is synced at height %d\n", pindex->nHeight);
+                    return;
+                }
+                if (pindex) {
+                    // Off the active chain the block is rolled back, on it the next one is added.
+                    fConnect = chainActive.Contains(pindex);
+                    pindexNext = fConnect ? chainActive.Next(pindex) : pindex;
+                }
+            }
+            if (!pindexNext) {
+                // No block chain yet (reindexing): wait for a tip.
+                boost::unique_lock<boost::mutex> lock(m_mutex);
+                m_cond.wait_for(lock, boost::chrono::seconds(1));
+                continue;
+            }
+
+            if (!CacheAddressDeltas(pindexNext, fConnect, chainparams)) {
+                LogPrintf("%s: failed to index block %s, sync stopped\n", __func__, pindexNext->GetBlockHash().ToString());
+                pblocktree->FlushAddress(pindex->GetBlockHash());
+                return;
+            }
+            pindex = fConnect ? pindexNext : pindexNext->pprev;
+            m_best_block = pindex;
+
+            int64_t nNow = GetTime();
+            if (pblocktree->AddressCacheUsage() > nCoinCacheUsage / 2 || nNow > nLastFlush + ADDRESS_INDEX_FLUSH_INTERVAL) {
+                if (!pblocktree->FlushAddress(pindex->GetBlockHash())) {
+                    LogPrintf("%s: failed to write address index, sync stopped\n", __func__);
+                    return;
+                }
+                nLastFlush = nNow;
+            }
+            if (nNow > nLastLog + 30) {
+                LogPrintf("Syncing address index with block chain from height %d\n", pindex->nHeight);
+                nLastLog = nNow;
+            }
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Keep what was done: the next start continues from here.
+        if (pindex) pblocktree->FlushAddress(pindex->GetBlockHash());
+        throw;
+    }
+}
+
+void ThreadAddressIndex()
+{
+    RenameThread("taler-addrindex");
+    g_addressindex->ThreadSync(Params());
+}
+
+/** Confirmed unspent outputs of each script, read from the index without cs_main */
+static bool ReadAddressUnspent(const std::vector<CScript>& scripts, std::vector<std::vector<std::pair<CAddressKey, CAddressValue>>>& vRows)
+{
+    vRows.assign(scripts.size(), {});
+    for (size_t i = 0; i < scripts.size(); i++) {
+        if (!pblocktree->ReadAddressUnspent(scripts[i], vRows[i])) return false;
+    }
+    return true;
+}
+
+static void AddAddressUnspent(const std::vector<CScript>& scripts, const std::vector<std::vector<std::pair<CAddressKey, CAddressValue>>>& vRows,
+                              bool fMempool, std::vector<CAddressUnspent>& vUnspent) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    for (size_t i = 0; i < scripts.size(); i++) {
+        const CScript& script = scripts[i];
+        for (const auto& it : vRows[i]) {
+            if (fMempool && mempool.isSpent(it.first.out)) continue;
+            vUnspent.push_back(CAddressUnspent{script, it.first.out, it.second.value, it.second.height});
+        }
+        if (!fMempool) continue;
+        std::vector<std::pair<CMempoolAddressKey, CMempoolAddressDelta>> vDeltas;
+        mempool.getAddressIndex(GetAddressScriptHash(script), vDeltas);
+        for (const auto& it : vDeltas) {
+            const COutPoint out(it.first.txid, it.first.index);
+            if (it.first.fSpend || mempool.isSpent(out)) continue;
+            vUnspent.push_back(CAddressUnspent{script, out, it.second.amount, 0});
+        }
+    }
+}
+
+bool GetAddressUnspent(const std::vector<CScript>& scripts, bool fMempool, std::vector<CAddressUnspent>& vUnspent)
+{
+    // Blocks are indexed, and their transactions leave the mempool, under cs_main together
+    // with the tip moving. So the index is scanned without cs_main, and if the tip is still
+    // the one seen before the scan, the rows match the chain the mempool is laid over.
+    std::vector<std::vector<std::pair<CAddressKey, CAddressValue>>> vRows;
+    for (int nTry = 0; nTry < ADDRESS_UNSPENT_TRIES; nTry++) {
+        const CBlockIndex* pindexTip;
+        {
+            LOCK(cs_main);
+            pindexTip = chainActive.Tip();
+        }
+        if (!ReadAddressUnspent(scripts, vRows)) return false;
+        LOCK(cs_main);
+        if (chainActive.Tip() == pindexTip) {
+            AddAddressUnspent(scripts, vRows, fMempool, vUnspent);
+            return true;
+        }
+    }
+    // The tip kept moving: hold it still for one more scan.
+    LOCK(cs_main);
+    if (!ReadAddressUnspent(scripts, vRows)) return false;
+    AddAddressUnspent(scripts, vRows, fMempool, vUnspent);
+    return true;
+}
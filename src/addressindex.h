@@ -0,0 +1,82 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include <amount.h>
+#include <primitives/transaction.h>
+#include <script/script.h>
+#include <validationinterface.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CBlockIndex;
+class CChainParams;
+
+//! -addressindex default
+static const bool DEFAULT_ADDRESSINDEX = true;
+//! Seconds between flushes of the address index while it catches up
+static const int64_t ADDRESS_INDEX_FLUSH_INTERVAL = 60;
+//! Scans of the index for unspent outputs before one is done holding cs_main
+static const int ADDRESS_UNSPENT_TRIES = 3;
+
+/**
+ * Catches the address index up with the block chain from the block and undo files, starting at the
+ * block its last flush recorded, while the node keeps running. Once it reaches the tip (under cs_main)
+ * it hands over: from then on ConnectTip and DisconnectTip keep the index, flushed with the coins.
+ */
+class CAddressIndexBuilder final : public CValidationInterface
+{
+public:
+    explicit CAddressIndexBuilder(const CBlockIndex* pindexBest) : m_best_block(pindexBest) {}
+
+    /** Whether connected blocks are indexed as they come. */
+    bool IsSynced() const { return m_synced; }
+    /** The last block indexed, null when nothing is. Follows the tip once synced. */
+    const CBlockIndex* BestBlock() const { return m_best_block; }
+    /** Record the block ConnectTip or DisconnectTip left the index at, after the handover. */
+    void SetBestBlock(const CBlockIndex* pindex) { m_best_block = pindex; }
+
+    void ThreadSync(const CChainParams& chainparams);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override;
+
+private:
+    std::atomic<bool> m_synced{false};
+    std::atomic<const CBlockIndex*> m_best_block;
+    boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+};
+
+/** The address index, null with -addressindex=0. */
+extern std::unique_ptr<CAddressIndexBuilder> g_addressindex;
+
+/** Find the block the address index was left at, and create g_addressindex there if enabled. */
+bool InitAddressIndex(const CChainParams& chainparams, bool fEnable);
+void ThreadAddressIndex();
+
+/** An unspent output found through the address index. */
+struct CAddressUnspent {
+    CScript script;
+    COutPoint out;
+    CAmount value;
+    uint32_t nHeight; //!< 0 for an output of a mempool transaction
+};
+
+/**
+ * The unspent outputs of scripts, each read with a single range of the index
+ * instead of a scan of the UTXO set. The index is read without cs_main. With fMempool the outputs spent by
+ * mempool transactions are left out and the unspent outputs of mempool
+ * transactions are added. Outputs are grouped by script, oldest first.
+ */
+bool GetAddressUnspent(const std::vector<CScript>& scripts, bool fMempool, std::vector<CAddressUnspent>& vUnspent);
+
+#endif // BITCOIN_ADDRESSINDEX_H
@@ -40,9 +40,13 @@ static CTxIn MineBlock(const CScript& coinbase_scriptPubKey)
 {
     auto block = PrepareBlock(coinbase_scriptPubKey);
 
-    while (!CheckProofOfWork(block->GetHash(), block->nBits, Params().GetConsensus())) {
+    // Grind on the raw hash: the cached check would keep the hash of every nonce tried.
+    const int nHeight = ::chainActive.Height() + 1;
+    const Consensus::Params& params = Params().GetConsensus();
+    while (!CheckProofOfWorkHash(block->GetPoWHash(nHeight, params), block->nBits, nHeight, params)) {
         assert(++block->nNonce);
     }
+    assert(CheckProofOfWork(*block, nHeight, params));
 
     bool processed{ProcessNewBlock(Params(), block, true, nullptr)};
     assert(processed);
@@ -51,40 +55,75 @@ static CTxIn MineBlock(const CScript& coinbase_scriptPubKey)
 }
 
 
-static void AssembleBlock(benchmark::State& state)
-{
-    const std::vector<unsigned char> op_true{OP_TRUE};
-    CScriptWitness witness;
-    witness.stack.push_back(op_true);
+static const std::vector<unsigned char> OP_TRUE_SCRIPT{OP_TRUE};
 
+/** Witness v0 script hash of OP_TRUE, spendable by anyone with a one element witness */
+static CScript OpTrueScript()
+{
     uint256 witness_program;
-    CSHA256().Write(&op_true[0], op_true.size()).Finalize(witness_program.begin());
+    CSHA256().Write(&OP_TRUE_SCRIPT[0], OP_TRUE_SCRIPT.size()).Finalize(witness_program.begin());
+    return CScript(OP_0) << std::vector<unsigned char>{witness_program.begin(), witness_program.end()};
+}
 
-    const CScript SCRIPT_PUB{CScript(OP_0) << std::vector<unsigned char>{witness_program.begin(), witness_program.end()}};
+static CScriptWitness OpTrueWitness()
+{
+    CScriptWitness witness;
+    witness.stack.push_back(OP_TRUE_SCRIPT);
+    return witness;
+}
 
+/** Start a fresh regtest chain holding just the genesis block */
+static void StartChain(boost::thread_group& thread_group, CScheduler& scheduler)
+{
     // Switch to regtest so we can mine faster
     // Also segwit is active, so we can include witness transactions
     SelectParams(CBaseChainParams::REGTEST);
 
     InitScriptExecutionCache();
 
+    ::pblocktree.reset(new CBlockTreeDB(1 << 20, true));
+    ::pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
+    ::pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
+
+    const CChainParams& chainparams = Params();
+    thread_group.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+    LoadGenesisBlock(chainparams);
+    CValidationState state;
+    ActivateBestChain(state, chainparams);
+    assert(::chainActive.Tip() != nullptr);
+    const bool witness_enabled{IsWitnessEnabled(::chainActive.Tip(), chainparams.GetConsensus())};
+    assert(witness_enabled);
+}
+
+static void StopChain(boost::thread_group& thread_group)
+{
+    thread_group.interrupt_all();
+    thread_group.join_all();
+    GetMainSignals().FlushBackgroundCallbacks();
+    GetMainSignals().UnregisterBackgroundSignalScheduler();
+    UnloadBlockIndex();
+    ::pcoinsTip.reset();
+    ::pcoinsdbview.reset();
+    ::pblocktree.reset();
+}
+
+static void AddToMempool(const CTransactionRef& tx)
+{
+    LOCK(::cs_main); // Required for ::AcceptToMemoryPool.
+    CValidationState state;
+    bool ret{::AcceptToMemoryPool(::mempool, state, tx, nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */, false /* bypass_limits */, /* nAbsurdFee */ 0)};
+    assert(ret);
+}
+
+static void AssembleBlock(benchmark::State& state)
+{
+    const CScriptWitness witness{OpTrueWitness()};
+    const CScript SCRIPT_PUB{OpTrueScript()};
+
     boost::thread_group thread_group;
     CScheduler scheduler;
-    {
-        ::pblocktree.reset(new CBlockTreeDB(1 << 20, true));
-        ::pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
-        ::pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
-
-        const CChainParams& chainparams = Params();
-        thread_group.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
-        GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
-        LoadGenesisBlock(chainparams);
-        CValidationState state;
-        ActivateBestChain(state, chainparams);
-        assert(::chainActive.Tip() != nullptr);
-        const bool witness_enabled{IsWitnessEnabled(::chainActive.Tip(), chainparams.GetConsensus())};
-        assert(witness_enabled);
-    }
+    StartChain(thread_group, scheduler);
 
     // Collect some loose transactions that spend the coinbases of our mined blocks
     constexpr size_t NUM_BLOCKS{200};
@@ -97,24 +136,97 @@ static void AssembleBlock(benchmark::State& state)
         if (NUM_BLOCKS - b >= COINBASE_MATURITY)
             txs.at(b) = MakeTransactionRef(tx);
     }
-    {
-        LOCK(::cs_main); // Required for ::AcceptToMemoryPool.
+    for (const auto& txr : txs) {
+        AddToMempool(txr);
+    }
 
-        for (const auto& txr : txs) {
-            CValidationState state;
-            bool ret{::AcceptToMemoryPool(::mempool, state, txr, nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */, false /* bypass_limits */, /* nAbsurdFee */ 0)};
-            assert(ret);
+    while (state.KeepRunning()) {
+        PrepareBlock(SCRIPT_PUB);
+    }
+
+    StopChain(thread_group);
+}
+
+/**
+ * Fill the mempool with 50k independent transactions at assorted feerates,
+ * more than fit in one block, and measure how long a template takes.
+ * With fReselect every template redoes the package selection; otherwise
+ * all but the first one are refilled from the cached selection.
+ */
+static void AssembleLargeMempool(benchmark::State& state, bool fReselect)
+{
+    const CScriptWitness witness{OpTrueWitness()};
+    const CScript SCRIPT_PUB{OpTrueScript()};
+
+    boost::thread_group thread_group;
+    CScheduler scheduler;
+    StartChain(thread_group, scheduler);
+
+    constexpr size_t NUM_TXS{50000};
+    constexpr size_t FANOUT_OUTPUTS{500};
+    constexpr size_t FANOUT_PER_BLOCK{40};
+    constexpr size_t NUM_FANOUTS{NUM_TXS / FANOUT_OUTPUTS};
+
+    // Mature coinbases, each split into FANOUT_OUTPUTS confirmed outputs, so
+    // the mempool transactions do not run into the ancestor/descendant limits.
+    std::vector<CTransactionRef> coinbases;
+    for (size_t b{0}; b < NUM_FANOUTS + COINBASE_MATURITY; ++b) {
+        MineBlock(SCRIPT_PUB);
+        if (b < NUM_FANOUTS) {
+            LOCK(::cs_main);
+            CBlock block;
+            bool read{ReadBlockFromDisk(block, ::chainActive.Tip(), Params().GetConsensus())};
+            assert(read);
+            coinbases.push_back(block.vtx[0]);
+        }
+    }
+
+    std::vector<std::pair<COutPoint, CAmount>> outputs;
+    for (size_t i{0}; i < NUM_FANOUTS; ++i) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(coinbases[i]->GetHash(), 0));
+        tx.vin.back().scriptWitness = witness;
+        const CAmount value{(coinbases[i]->vout[0].nValue - COIN) / (CAmount)FANOUT_OUTPUTS};
+        for (size_t n{0}; n < FANOUT_OUTPUTS; ++n) {
+            tx.vout.emplace_back(value, SCRIPT_PUB);
+        }
+        CTransactionRef txr{MakeTransactionRef(tx)};
+        AddToMempool(txr);
+        for (size_t n{0}; n < FANOUT_OUTPUTS; ++n) {
+            outputs.emplace_back(COutPoint(txr->GetHash(), n), value);
+        }
+        if ((i + 1) % FANOUT_PER_BLOCK == 0 || i + 1 == NUM_FANOUTS) {
+            MineBlock(SCRIPT_PUB);
         }
     }
+    assert(::mempool.size() == 0);
+
+    for (size_t i{0}; i < NUM_TXS; ++i) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(outputs[i].first);
+        tx.vin.back().scriptWitness = witness;
+        tx.vout.emplace_back(outputs[i].second - 1000 - (CAmount)(i % 997) * 10, SCRIPT_PUB);
+        AddToMempool(MakeTransactionRef(tx));
+    }
 
     while (state.KeepRunning()) {
+        if (fReselect) ResetBlockTemplateCache();
         PrepareBlock(SCRIPT_PUB);
     }
 
-    thread_group.interrupt_all();
-    thread_group.join_all();
-    GetMainSignals().FlushBackgroundCallbacks();
-    GetMainSignals().UnregisterBackgroundSignalScheduler();
+    StopChain(thread_group);
+}
+
+static void AssembleBlockLargeMempool(benchmark::State& state)
+{
+    AssembleLargeMempool(state, false);
+}
+
+static void AssembleBlockLargeMempoolReselect(benchmark::State& state)
+{
+    AssembleLargeMempool(state, true);
 }
 
 BENCHMARK(AssembleBlock, 700);
+BENCHMARK(AssembleBlockLargeMempool, 20);
+BENCHMARK(AssembleBlockLargeMempoolReselect, 5);
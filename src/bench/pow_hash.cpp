@@ -0,0 +1,67 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <crypto/Lyra2Z.h>
+#include <crypto/scrypt.h>
+
+#include <string.h>
+#include <vector>
+
+/* 80-byte block headers hashed back to back, with a different nonce each. */
+static std::vector<char> MakeHeaders(size_t count)
+{
+    std::vector<char> headers(80 * count, 0);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t nonce = i;
+        memcpy(&headers[80 * i + 76], &nonce, 4);
+    }
+    return headers;
+}
+
+static void Lyra2Z(benchmark::State& state)
+{
+    std::vector<char> header = MakeHeaders(1);
+    char hash[32];
+    while (state.KeepRunning()) {
+        lyra2z_hash(header.data(), hash);
+    }
+}
+
+static void Lyra2Z_8(benchmark::State& state)
+{
+    std::vector<char> headers = MakeHeaders(8);
+    char hashes[8 * 32];
+    while (state.KeepRunning()) {
+        lyra2z_hash_many(headers.data(), hashes, 8);
+    }
+}
+
+static void Scrypt_Generic(benchmark::State& state)
+{
+    std::vector<char> header = MakeHeaders(1);
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    char hash[32];
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256_sp_generic(header.data(), hash, scratchpad.data());
+    }
+}
+
+#if defined(USE_SSE2)
+static void Scrypt_SSE2(benchmark::State& state)
+{
+    std::vector<char> header = MakeHeaders(1);
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    char hash[32];
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256_sp_sse2(header.data(), hash, scratchpad.data());
+    }
+}
+
+BENCHMARK(Scrypt_SSE2, 3500);
+#endif
+
+BENCHMARK(Lyra2Z, 80000);
+BENCHMARK(Lyra2Z_8, 12000);
+BENCHMARK(Scrypt_Generic, 2000);
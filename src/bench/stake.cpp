@@ -0,0 +1,124 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <arith_uint256.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <primitives/transaction.h>
+#include <random.h>
+#include <validation.h>
+
+#include <vector>
+
+namespace {
+/** Synthetic chain of mixed PoW/PoS blocks at the PoS target spacing, covering two
+ *  stake modifier selection intervals, with one generated modifier per modifier interval.
+ */
+struct StakeChain
+{
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> vBlocks;
+
+    /** fNewModifier leaves the interval of the parent of the last block without a modifier,
+     *  so the last block has to select a new one. */
+    StakeChain(const Consensus::Params& consensus, bool fNewModifier)
+    {
+        const int64_t nBlocks = 2 * GetStakeModifierSelectionInterval() / consensus.nPosTargetSpacing;
+        const int64_t nStart = 1500000000 / consensus.nStakeModifierInterval * consensus.nStakeModifierInterval;
+        const int64_t nLastInterval = (nStart + (nBlocks - 1) * consensus.nPosTargetSpacing) / consensus.nStakeModifierInterval;
+
+        FastRandomContext rng(true);
+        vHashes.resize(nBlocks + 1);
+        vBlocks.resize(nBlocks + 1);
+        for (int64_t i = 0; i <= nBlocks; i++) {
+            CBlockIndex& block = vBlocks[i];
+            vHashes[i] = rng.rand256();
+            block.phashBlock = &vHashes[i];
+            block.pprev = i ? &vBlocks[i - 1] : nullptr;
+            block.nHeight = i;
+            block.nTime = nStart + i * consensus.nPosTargetSpacing;
+            if (rng.randbool()) {
+                block.nFlags_set(BLOCK_PROOF_OF_STAKE);
+                block.hashProofOfStake = rng.rand256();
+            }
+            int64_t nInterval = block.GetBlockTime() / consensus.nStakeModifierInterval;
+            bool fGenerated = i == 0 || (nInterval != vBlocks[i - 1].GetBlockTime() / consensus.nStakeModifierInterval &&
+                                         (!fNewModifier || nInterval < nLastInterval));
+            block.SetStakeModifier(rng.rand64(), fGenerated);
+        }
+    }
+
+    CBlockIndex* Tip() { return &vBlocks.back(); }
+};
+} // namespace
+
+// Recompute the stake modifier for a block entering a new modifier interval.
+static void ComputeStakeModifier(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    StakeChain chain(Params().GetConsensus(), true);
+
+    while (state.KeepRunning()) {
+        uint64_t nStakeModifier;
+        bool fGenerated;
+        bool fOk = GetStakeModifier(chain.Tip(), nStakeModifier, fGenerated);
+        assert(fOk && fGenerated);
+    }
+}
+
+// Check a pre-fork-3 kernel built on the tip: stake modifier lookup plus kernel hash.
+static void CheckProofOfStakeOld(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& consensus = Params().GetConsensus();
+    StakeChain chain(consensus, false);
+    CBlockIndex* pindexPrev = chain.Tip();
+
+    CBlockHeader header;
+    header.hashPrevBlock = *pindexPrev->phashBlock;
+    header.nTime = pindexPrev->nTime + consensus.nPosTargetSpacing;
+    header.nBits = consensus.posLimit.GetCompact();
+    // A coin whose modifier bound falls in the middle of the chain.
+    uint32_t nCoinTime = chain.vBlocks[chain.vBlocks.size() / 2].nTime - GetStakeModifierSelectionInterval() + consensus.nStakeMinAge;
+    FastRandomContext rng(true);
+    COutPoint prevout(rng.rand256(), 1);
+
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(pindexPrev);
+    }
+    while (state.KeepRunning()) {
+        LOCK(cs_main);
+        for (int i = 0; i < 100; i++) {
+            CheckProofOfStake(header, pindexPrev, consensus, prevout, 1000 * COIN, nCoinTime, 100 + i, nullptr);
+        }
+    }
+    UnloadBlockIndex();
+}
+
+// Kernel hash alone, with the stake modifier already known (what the staking search runs per candidate).
+static void StakeKernelHash(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& consensus = Params().GetConsensus();
+    FastRandomContext rng(true);
+    CBlockHeader header;
+    header.hashPrevBlock = rng.rand256();
+    header.nTime = 1500000000;
+    header.nBits = consensus.posLimit.GetCompact();
+    COutPoint prevout(rng.rand256(), 1);
+    uint32_t nCoinTime = header.nTime - 30 * 24 * 60 * 60;
+    uint64_t nStakeModifier = rng.rand64();
+
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            CheckStakeKernelHash(header, 1, consensus, prevout, 1000 * COIN, nCoinTime, 100 + i, nStakeModifier, nullptr);
+        }
+    }
+}
+
+BENCHMARK(ComputeStakeModifier, 150);
+BENCHMARK(CheckProofOfStakeOld, 2000);
+BENCHMARK(StakeKernelHash, 350);
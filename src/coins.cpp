@@ -7,6 +7,9 @@
 
 #include <consensus/consensus.h>
 #include <random.h>
+#include <streams.h>
+#include <utilstrencodings.h>
+#include <version.h>
 
 #include <script/standard.h>
 #include <key_io.h>
@@ -27,6 +30,32 @@ std::string CAddressKey::GetAddr (bool asmifnull) {
     return "";
 };
 
+uint160 GetAddressScriptHash(const CScript& script) {
+    return Hash160(script.begin(), script.end());
+}
+
+std::string EncodeAddressCursor(const CAddressIndexKey& cursor, uint32_t nScript) {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << VARINT(nScript);
+    ser_writedata32be(ss, cursor.height);
+    ss << cursor.out;
+    return HexStr(ss.begin(), ss.end());
+}
+
+bool DecodeAddressCursor(const std::string& str, CAddressIndexKey& cursor, uint32_t& nScript) {
+    if (!IsHex(str)) return false;
+    std::vector<unsigned char> data(ParseHex(str));
+    CDataStream ss(data, SER_NETWORK, PROTOCOL_VERSION);
+    try {
+        ss >> VARINT(nScript);
+        cursor.height = ser_readdata32be(ss);
+        ss >> cursor.out;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return ss.empty();
+}
+
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
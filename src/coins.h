@@ -17,6 +17,7 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <unordered_map>
 
@@ -420,4 +421,94 @@ struct CAddressValue {
     }
 };
 
+/** Fixed-width hash of a scriptPubKey used to key the address index. */
+uint160 GetAddressScriptHash(const CScript& script);
+
+/** Address index key: script hash, then height and outpoint of the output.
+ *  The height is big-endian so the rows of an address are ordered by height.
+ */
+struct CAddressIndexKey {
+    uint160 hashScript;
+    uint32_t height;
+    COutPoint out;
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        s << hashScript;
+        ser_writedata32be(s, height);
+        s << out;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        s >> hashScript;
+        height = ser_readdata32be(s);
+        s >> out;
+    }
+
+    CAddressIndexKey(const uint160& phashScript, uint32_t pheight, const COutPoint& pout) : hashScript(phashScript), height(pheight), out(pout) {}
+    CAddressIndexKey(const CScript& pscript, uint32_t pheight, const COutPoint& pout) : hashScript(GetAddressScriptHash(pscript)), height(pheight), out(pout) {}
+    CAddressIndexKey() : height(0) {}
+
+    /** Same order as the serialized keys in the database, so cached rows merge with database rows in place. */
+    friend bool operator<(const CAddressIndexKey& a, const CAddressIndexKey& b) {
+        if (a.hashScript != b.hashScript) return a.hashScript < b.hashScript;
+        if (a.height != b.height) return a.height < b.height;
+        if (a.out.hash != b.out.hash) return a.out.hash < b.out.hash;
+        uint32_t na = htole32(a.out.n), nb = htole32(b.out.n);
+        return memcmp(&na, &nb, sizeof(na)) < 0;
+    }
+};
+
+/** Opaque continuation token of an address index page: which of the queried scripts and the last row returned
+ *  (a null row to start at the newest row of that script). */
+std::string EncodeAddressCursor(const CAddressIndexKey& cursor, uint32_t nScript = 0);
+bool DecodeAddressCursor(const std::string& str, CAddressIndexKey& cursor, uint32_t& nScript);
+
+/** Totals of all address index rows of one script, kept up to date with every address index write. */
+struct CAddressSummary {
+    CAmount received;
+    CAmount sent;
+    uint32_t nReceived;
+    uint32_t nSent;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(received);
+        READWRITE(sent);
+        READWRITE(nReceived);
+        READWRITE(nSent);
+    }
+
+    CAddressSummary() {
+        SetNull();
+    }
+
+    /** Add (nSign = 1) or remove (nSign = -1) the contribution of one address index row. */
+    void Apply(const CAddressValue& value, int nSign) {
+        if (value.IsNull()) return;
+        received += nSign * value.value;
+        nReceived += nSign;
+        if (value.spend_height > 0) {
+            sent += nSign * value.value;
+            nSent += nSign;
+        }
+    }
+
+    CAmount GetBalance() const { return received - sent; }
+
+    void SetNull() {
+        received = 0;
+        sent = 0;
+        nReceived = 0;
+        nSent = 0;
+    }
+
+    bool IsNull() const {
+        return (nReceived == 0);
+    }
+};
+
 #endif // BITCOIN_COINS_H
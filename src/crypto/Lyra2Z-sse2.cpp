@@ -0,0 +1,314 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
+#include <crypto/Lyra2Z.h>
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+namespace lyra2z_sse2 {
+namespace {
+
+/** The sponge state in eight registers of two words: a = v[0..3], b = v[4..7], c = v[8..11], d = v[12..15].
+ *  A Lyra2 block (12 words) is a, b and c.
+ */
+struct State
+{
+    __m128i a0, a1, b0, b1, c0, c1, d0, d1;
+};
+
+__m128i inline Load(const uint64_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+void inline Store(uint64_t* p, __m128i x) { _mm_storeu_si128((__m128i*)p, x); }
+
+__m128i inline RotR32(__m128i x) { return _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)); }
+__m128i inline RotR24(__m128i x) { return _mm_or_si128(_mm_srli_epi64(x, 24), _mm_slli_epi64(x, 40)); }
+__m128i inline RotR16(__m128i x) { return _mm_or_si128(_mm_srli_epi64(x, 16), _mm_slli_epi64(x, 48)); }
+__m128i inline RotR63(__m128i x) { return _mm_or_si128(_mm_srli_epi64(x, 63), _mm_add_epi64(x, x)); }
+
+/** [x[1], y[0]] */
+__m128i inline Mix(__m128i x, __m128i y)
+{
+    return _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(x), _mm_castsi128_pd(y), 1));
+}
+
+/** Blake2b G function applied to two columns (or diagonals) at once. */
+void inline __attribute__((always_inline)) G(__m128i& a, __m128i& b, __m128i& c, __m128i& d)
+{
+    a = _mm_add_epi64(a, b);
+    d = RotR32(_mm_xor_si128(d, a));
+    c = _mm_add_epi64(c, d);
+    b = RotR24(_mm_xor_si128(b, c));
+    a = _mm_add_epi64(a, b);
+    d = RotR16(_mm_xor_si128(d, a));
+    c = _mm_add_epi64(c, d);
+    b = RotR63(_mm_xor_si128(b, c));
+}
+
+/** One round of the Blake2b compression function, without message words. */
+void inline __attribute__((always_inline)) Round(State& s)
+{
+    __m128i t0, t1;
+    G(s.a0, s.b0, s.c0, s.d0);
+    G(s.a1, s.b1, s.c1, s.d1);
+    // Diagonalize: b <<< 1 word, c <<< 2 words, d <<< 3 words
+    t0 = Mix(s.b0, s.b1); t1 = Mix(s.b1, s.b0); s.b0 = t0; s.b1 = t1;
+    t0 = s.c0; s.c0 = s.c1; s.c1 = t0;
+    t0 = Mix(s.d1, s.d0); t1 = Mix(s.d0, s.d1); s.d0 = t0; s.d1 = t1;
+    G(s.a0, s.b0, s.c0, s.d0);
+    G(s.a1, s.b1, s.c1, s.d1);
+    // Undiagonalize
+    t0 = Mix(s.b1, s.b0); t1 = Mix(s.b0, s.b1); s.b0 = t0; s.b1 = t1;
+    t0 = s.c0; s.c0 = s.c1; s.c1 = t0;
+    t0 = Mix(s.d0, s.d1); t1 = Mix(s.d1, s.d0); s.d0 = t0; s.d1 = t1;
+}
+
+void Blake2bLyra(State& s)
+{
+    for (int i = 0; i < 12; i++) Round(s);
+}
+
+const int N_COLS = 8;
+const int N_ROWS = 8;
+const int BLOCK_LEN = 12;
+const int ROW_LEN = BLOCK_LEN * N_COLS;
+
+/** Block view of the first 12 words of the state. */
+void inline Rand(const State& s, __m128i r[6])
+{
+    r[0] = s.a0; r[1] = s.a1; r[2] = s.b0; r[3] = s.b1; r[4] = s.c0; r[5] = s.c1;
+}
+
+void inline Absorb(State& s, const __m128i m[6])
+{
+    s.a0 = _mm_xor_si128(s.a0, m[0]);
+    s.a1 = _mm_xor_si128(s.a1, m[1]);
+    s.b0 = _mm_xor_si128(s.b0, m[2]);
+    s.b1 = _mm_xor_si128(s.b1, m[3]);
+    s.c0 = _mm_xor_si128(s.c0, m[4]);
+    s.c1 = _mm_xor_si128(s.c1, m[5]);
+}
+
+void ReducedSqueezeRow0(State& s, uint64_t* rowOut)
+{
+    uint64_t* out = rowOut + (N_COLS - 1) * BLOCK_LEN;
+    __m128i r[6];
+    for (int i = 0; i < N_COLS; i++) {
+        Rand(s, r);
+        for (int k = 0; k < 6; k++) Store(out + 2 * k, r[k]);
+        out -= BLOCK_LEN;
+        Round(s);
+    }
+}
+
+void ReducedDuplexRow1(State& s, const uint64_t* rowIn, uint64_t* rowOut)
+{
+    const uint64_t* in = rowIn;
+    uint64_t* out = rowOut + (N_COLS - 1) * BLOCK_LEN;
+    __m128i m[6], r[6];
+    for (int i = 0; i < N_COLS; i++) {
+        for (int k = 0; k < 6; k++) m[k] = Load(in + 2 * k);
+        Absorb(s, m);
+        Round(s);
+        Rand(s, r);
+        for (int k = 0; k < 6; k++) Store(out + 2 * k, _mm_xor_si128(m[k], r[k]));
+        in += BLOCK_LEN;
+        out -= BLOCK_LEN;
+    }
+}
+
+void ReducedDuplexRowSetup(State& s, const uint64_t* rowIn, uint64_t* rowInOut, uint64_t* rowOut)
+{
+    const uint64_t* in = rowIn;
+    uint64_t* inout = rowInOut;
+    uint64_t* out = rowOut + (N_COLS - 1) * BLOCK_LEN;
+    __m128i p[6], m[6], r[6];
+    for (int i = 0; i < N_COLS; i++) {
+        for (int k = 0; k < 6; k++) {
+            p[k] = Load(in + 2 * k);
+            m[k] = _mm_add_epi64(p[k], Load(inout + 2 * k));
+        }
+        Absorb(s, m);
+        Round(s);
+        Rand(s, r);
+        for (int k = 0; k < 6; k++) Store(out + 2 * k, _mm_xor_si128(p[k], r[k]));
+        // rotW: shift the 12 rand words right by one
+        Store(inout, _mm_xor_si128(Load(inout), Mix(r[5], r[0])));
+        for (int k = 1; k < 6; k++) Store(inout + 2 * k, _mm_xor_si128(Load(inout + 2 * k), Mix(r[k - 1], r[k])));
+        in += BLOCK_LEN;
+        inout += BLOCK_LEN;
+        out -= BLOCK_LEN;
+    }
+}
+
+/** rowInOut may alias rowIn or rowOut, so every write goes back to memory before the next read. */
+void ReducedDuplexRow(State& s, const uint64_t* rowIn, uint64_t* rowInOut, uint64_t* rowOut)
+{
+    const uint64_t* in = rowIn;
+    uint64_t* inout = rowInOut;
+    uint64_t* out = rowOut;
+    __m128i m[6], r[6];
+    for (int i = 0; i < N_COLS; i++) {
+        for (int k = 0; k < 6; k++) m[k] = _mm_add_epi64(Load(in + 2 * k), Load(inout + 2 * k));
+        Absorb(s, m);
+        Round(s);
+        Rand(s, r);
+        for (int k = 0; k < 6; k++) Store(out + 2 * k, _mm_xor_si128(Load(out + 2 * k), r[k]));
+        Store(inout, _mm_xor_si128(Load(inout), Mix(r[5], r[0])));
+        for (int k = 1; k < 6; k++) Store(inout + 2 * k, _mm_xor_si128(Load(inout + 2 * k), Mix(r[k - 1], r[k])));
+        in += BLOCK_LEN;
+        inout += BLOCK_LEN;
+        out += BLOCK_LEN;
+    }
+}
+
+__m128i inline Set(uint64_t lo, uint64_t hi)
+{
+    return _mm_set_epi32((int)(hi >> 32), (int)hi, (int)(lo >> 32), (int)lo);
+}
+
+} // namespace
+
+/** Lyra2 with the Lyra2Z parameters (kLen = pwdlen = saltlen = 32, timeCost = 8, nRows = 8, nCols = 8). */
+void Core(uint64_t* out, const uint64_t* in, uint64_t* matrix)
+{
+    State s;
+    s.a0 = s.a1 = s.b0 = s.b1 = _mm_setzero_si128();
+    s.c0 = Set(0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL);
+    s.c1 = Set(0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL);
+    s.d0 = Set(0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL);
+    s.d1 = Set(0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL);
+
+    // Absorb pad(pwd || salt || basil): pwd and salt are both the prehash.
+    __m128i pwd0 = Load(in), pwd1 = Load(in + 2);
+    s.a0 = _mm_xor_si128(s.a0, pwd0);
+    s.a1 = _mm_xor_si128(s.a1, pwd1);
+    s.b0 = _mm_xor_si128(s.b0, pwd0);
+    s.b1 = _mm_xor_si128(s.b1, pwd1);
+    Blake2bLyra(s);
+    s.a0 = _mm_xor_si128(s.a0, Set(32, 32));
+    s.a1 = _mm_xor_si128(s.a1, Set(32, 8));
+    s.b0 = _mm_xor_si128(s.b0, Set(8, 8));
+    s.b1 = _mm_xor_si128(s.b1, Set(0x80, 0x0100000000000000ULL));
+    Blake2bLyra(s);
+
+    // Setup phase
+    ReducedSqueezeRow0(s, matrix);
+    ReducedDuplexRow1(s, matrix, matrix + ROW_LEN);
+    int64_t row = 2, prev = 1, rowa = 0, step = 1, window = 2, gap = 1;
+    do {
+        ReducedDuplexRowSetup(s, matrix + prev * ROW_LEN, matrix + rowa * ROW_LEN, matrix + row * ROW_LEN);
+        rowa = (rowa + step) & (window - 1);
+        prev = row;
+        row++;
+        if (rowa == 0) {
+            step = window + gap;
+            window *= 2;
+            gap = -gap;
+        }
+    } while (row < N_ROWS);
+
+    // Wandering phase
+    row = 0;
+    for (int tau = 1; tau <= 8; tau++) {
+        step = (tau % 2 == 0) ? -1 : N_ROWS / 2 - 1;
+        do {
+            rowa = (uint32_t)_mm_cvtsi128_si32(s.a0) & (N_ROWS - 1);
+            ReducedDuplexRow(s, matrix + prev * ROW_LEN, matrix + rowa * ROW_LEN, matrix + row * ROW_LEN);
+            prev = row;
+            row = (row + step) & (N_ROWS - 1);
+        } while (row != 0);
+    }
+
+    // Wrap-up phase
+    __m128i m[6];
+    for (int k = 0; k < 6; k++) m[k] = Load(matrix + rowa * ROW_LEN + 2 * k);
+    Absorb(s, m);
+    Blake2bLyra(s);
+    Store(out, s.a0);
+    Store(out + 2, s.a1);
+}
+
+} // namespace lyra2z_sse2
+#endif // __SSE2__
+
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace lyra2z_avx2
+{
+void Core(uint64_t* out, const uint64_t* in, uint64_t* matrix);
+void Core_2way(uint64_t* out, const uint64_t* in, uint64_t* matrix);
+}
+#endif
+
+namespace {
+
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+bool HaveAVX2()
+{
+    uint32_t eax, ebx, ecx, edx;
+    __cpuid_count(1, 0, eax, ebx, ecx, edx);
+    bool have_xsave = (ecx >> 27) & 1;
+    bool have_avx = (ecx >> 28) & 1;
+    if (!have_xsave || !have_avx) return false;
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6) return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx >> 5) & 1;
+}
+#endif
+
+/** Check the selected core against the portable implementation. */
+bool SelfTest()
+{
+    alignas(64) uint64_t matrix[LYRA2Z_MATRIX_INT64];
+    uint64_t in[4], expected[4], out[4];
+    for (int i = 0; i < 4; i++) in[i] = 0x0123456789abcdefULL * (i + 1);
+    lyra2z_core_generic(expected, in, matrix);
+    lyra2z_core_detected(out, in, matrix);
+    if (memcmp(expected, out, sizeof(out)) != 0) return false;
+    if (lyra2z_core_2way_detected) {
+        alignas(64) uint64_t matrix2[2 * LYRA2Z_MATRIX_INT64];
+        uint64_t in2[8], out2[8];
+        for (int i = 0; i < 8; i++) in2[i] = in[i % 4] ^ (i / 4);
+        lyra2z_core_2way_detected(out2, in2, matrix2);
+        for (int l = 0; l < 2; l++) {
+            lyra2z_core_generic(expected, in2 + 4 * l, matrix);
+            if (memcmp(expected, out2 + 4 * l, sizeof(expected)) != 0) return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+std::string lyra2z_detect()
+{
+    std::string ret = "generic";
+    lyra2z_core_detected = &lyra2z_core_generic;
+    lyra2z_core_2way_detected = nullptr;
+#if defined(__SSE2__)
+    lyra2z_core_detected = &lyra2z_sse2::Core;
+    ret = "sse2";
+#endif
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+    if (HaveAVX2()) {
+        lyra2z_core_detected = &lyra2z_avx2::Core;
+        lyra2z_core_2way_detected = &lyra2z_avx2::Core_2way;
+        ret = "avx2(1way,2way)";
+    }
+#endif
+    assert(SelfTest());
+    return "Lyra2Z: using " + ret + " core";
+}
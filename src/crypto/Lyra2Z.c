@@ -99,7 +99,7 @@ static inline uint64_t rotr64( const uint64_t w, const unsigned c ){
     G(r,7,v[ 3],v[ 4],v[ 9],v[14]);
 
 //---- Housekeeping
-inline void initState(uint64_t state[/*16*/]) {
+static inline void initState(uint64_t state[/*16*/]) {
     //First 512 bis are zeros
     memset(state, 0, 64);
     //Remainder BLOCK_LEN_BLAKE2_SAFE_BYTES are reserved to the IV
@@ -133,7 +133,7 @@ inline static void reducedBlake2bLyra(uint64_t *v) {
 }
 
 //---- Squeezes
-inline void squeeze(uint64_t *state, byte *out, unsigned int len) {
+static inline void squeeze(uint64_t *state, byte *out, unsigned int len) {
     int fullBlocks = len / BLOCK_LEN_BYTES;
     byte *ptr = out;
     int i;
@@ -147,7 +147,7 @@ inline void squeeze(uint64_t *state, byte *out, unsigned int len) {
     memcpy(ptr, state, (len % BLOCK_LEN_BYTES));
 }
 
-inline void reducedSqueezeRow0(uint64_t* state, uint64_t* rowOut, uint64_t nCols) {
+static inline void reducedSqueezeRow0(uint64_t* state, uint64_t* rowOut, uint64_t nCols) {
     uint64_t* ptrWord = rowOut + (nCols-1)*BLOCK_LEN_INT64; //In Lyra2: pointer to M[0][C-1]
     int i;
     //M[row][C-1-col] = H.reduced_squeeze()
@@ -172,7 +172,7 @@ inline void reducedSqueezeRow0(uint64_t* state, uint64_t* rowOut, uint64_t nCols
 }
 
 //---- Absorbs
-inline void absorbBlock(uint64_t *state, const uint64_t *in) {
+static inline void absorbBlock(uint64_t *state, const uint64_t *in) {
     //XORs the first BLOCK_LEN_INT64 words of "in" with the current state
     state[0] ^= in[0];
     state[1] ^= in[1];
@@ -190,7 +190,7 @@ inline void absorbBlock(uint64_t *state, const uint64_t *in) {
     blake2bLyra(state);
 }
 
-inline void absorbBlockBlake2Safe(uint64_t *state, const uint64_t *in) {
+static inline void absorbBlockBlake2Safe(uint64_t *state, const uint64_t *in) {
     //XORs the first BLOCK_LEN_BLAKE2_SAFE_INT64 words of "in" with the current state
     state[0] ^= in[0];
     state[1] ^= in[1];
@@ -205,7 +205,7 @@ inline void absorbBlockBlake2Safe(uint64_t *state, const uint64_t *in) {
 }
 
 //---- Duplexes
-inline void reducedDuplexRow1(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols) {
+static inline void reducedDuplexRow1(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols) {
     uint64_t* ptrWordIn = rowIn;				//In Lyra2: pointer to prev
     uint64_t* ptrWordOut = rowOut + (nCols-1)*BLOCK_LEN_INT64; //In Lyra2: pointer to row
     int i;
@@ -245,7 +245,7 @@ inline void reducedDuplexRow1(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut
     }
 }
 
-inline void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+static inline void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
     uint64_t* ptrWordIn = rowIn;				//In Lyra2: pointer to prev
     uint64_t* ptrWordInOut = rowInOut;				//In Lyra2: pointer to row*
     uint64_t* ptrWordOut = rowOut + (nCols-1)*BLOCK_LEN_INT64; //In Lyra2: pointer to row
@@ -300,7 +300,7 @@ inline void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *ro
     }
 }
 
-inline void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+static inline void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
     uint64_t* ptrWordInOut = rowInOut; //In Lyra2: pointer to row*
     uint64_t* ptrWordIn = rowIn; //In Lyra2: pointer to prev
     uint64_t* ptrWordOut = rowOut; //In Lyra2: pointer to row
@@ -372,10 +372,11 @@ inline void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOu
  * @param timeCost Parameter to determine the processing time (T)
  * @param nRows Number or rows of the memory matrix (R)
  * @param nCols Number of columns of the memory matrix (C)
+ * @param wholeMatrix Caller-owned memory matrix of at least nRows * nCols * BLOCK_LEN_INT64 words
  *
- * @return 0 if the key is generated correctly; -1 if there is an error (usually due to lack of memory for allocation)
+ * @return 0 if the key is generated correctly
  */
-int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols) {
+int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols, uint64_t *wholeMatrix) {
     //============================= Basic variables ============================//
     int64_t row = 2; //index of row to be processed
     int64_t prev = 1; //index of prev (last row ever computed/modified)
@@ -386,26 +387,10 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     int64_t gap = 1; //Modifier to the step, assuming the values 1 or -1
     int64_t i; //auxiliary iteration counter
     //========== Initializing the Memory Matrix and pointers to it =============//
-    //Tries to allocate enough space for the whole memory matrix
+    //The matrix is owned by the caller; every row is fully written during Setup before it is read
     const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * nCols;
-    const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
-    i = (int64_t) ((int64_t) nRows * (int64_t) ROW_LEN_BYTES);
-    uint64_t *wholeMatrix = malloc(i);
-    if (wholeMatrix == NULL) {
-        return -1;
-    }
-    memset(wholeMatrix, 0, i);
-    //Allocates pointers to each row of the matrix
-    uint64_t **memMatrix = malloc(nRows * sizeof (uint64_t*));
-    if (memMatrix == NULL) {
-        return -1;
-    }
-    //Places the pointers in the correct positions
-    uint64_t *ptrWord = wholeMatrix;
-    for (i = 0; i < nRows; i++) {
-        memMatrix[i] = ptrWord;
-        ptrWord += ROW_LEN_INT64;
-    }
+    #define memMatrix(r) (wholeMatrix + (r) * ROW_LEN_INT64)
+    uint64_t *ptrWord;
     //============= Getting the password + salt + basil padded with 10*1 ===============//
     //OBS.:The memory matrix will temporarily hold the password: not for saving memory,
     //but this ensures that the password copied locally will be overwritten as soon as possible
@@ -439,10 +424,7 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     *ptrByte ^= 0x01; //last byte of padding: at the end of the last incomplete block
     //======================= Initializing the Sponge State ====================//
     //Sponge state: 16 uint64_t, BLOCK_LEN_INT64 words of them for the bitrate (b) and the remainder for the capacity (c)
-    uint64_t *state = malloc(16 * sizeof (uint64_t));
-    if (state == NULL) {
-        return -1;
-    }
+    uint64_t state[16];
     initState(state);
     //================================ Setup Phase =============================//
     //Absorbing salt, password and basil: this is the only place in which the block length is hard-coded to 512 bits
@@ -452,11 +434,11 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
         ptrWord += BLOCK_LEN_BLAKE2_SAFE_INT64; //goes to next block of pad(pwd || salt || basil)
     }
     //Initializes M[0] and M[1]
-    reducedSqueezeRow0(state, memMatrix[0], nCols); //The locally copied password is most likely overwritten here
-    reducedDuplexRow1(state, memMatrix[0], memMatrix[1], nCols);
+    reducedSqueezeRow0(state, memMatrix(0), nCols); //The locally copied password is most likely overwritten here
+    reducedDuplexRow1(state, memMatrix(0), memMatrix(1), nCols);
     do {
         //M[row] = rand; //M[row*] = M[row*] XOR rotW(rand)
-        reducedDuplexRowSetup(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+        reducedDuplexRowSetup(state, memMatrix(prev), memMatrix(rowa), memMatrix(row), nCols);
         //updates the value of row* (deterministically picked during Setup))
         rowa = (rowa + step) & (window - 1);
         //update prev: it now points to the last row ever computed
@@ -482,7 +464,7 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
             rowa = ((uint64_t) (state[0])) % nRows; //(USE THIS FOR THE "GENERIC" CASE)
             //------------------------------------------------------------------------------------------
             //Performs a reduced-round duplexing operation over M[row*] XOR M[prev], updating both M[row*] and M[row]
-            reducedDuplexRow(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+            reducedDuplexRow(state, memMatrix(prev), memMatrix(rowa), memMatrix(row), nCols);
             //update prev: it now points to the last row ever computed
             prev = row;
             //updates row: goes to the next row to be computed
@@ -493,24 +475,61 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     }
     //============================ Wrap-up Phase ===============================//
     //Absorbs the last block of the memory matrix
-    absorbBlock(state, memMatrix[rowa]);
+    absorbBlock(state, memMatrix(rowa));
     //Squeezes the key
     squeeze(state, K, kLen);
-    //========================= Freeing the memory =============================//
-    free(memMatrix);
-    free(wholeMatrix);
-    //Wiping out the sponge's internal state before freeing it
-    memset(state, 0, 16 * sizeof (uint64_t));
-    free(state);
+    #undef memMatrix
     return 0;
 }
 
-void lyra2z_hash(const char* input, char* output) {
+void lyra2z_core_generic(uint64_t* out, const uint64_t* in, uint64_t* matrix) {
+    LYRA2(out, 32, in, 32, in, 32, 8, 8, 8, matrix);
+}
+
+// By default, set to the generic core. This will prevent crash in case when lyra2z_detect() wasn't called
+lyra2z_core_fn lyra2z_core_detected = &lyra2z_core_generic;
+lyra2z_core_fn lyra2z_core_2way_detected = NULL;
+
+static void lyra2z_prehash(const char* input, uint64_t* hash) {
     sph_blake256_context ctx_blake;
-    uint32_t hashA[8], hashB[8];
     sph_blake256_init(&ctx_blake);
     sph_blake256 (&ctx_blake, input, 80);
-    sph_blake256_close (&ctx_blake, hashA);	
-    LYRA2(hashB, 32, hashA, 32, hashA, 32, 8, 8, 8);
+    sph_blake256_close (&ctx_blake, hash);
+}
+
+void lyra2z_hash_sp(const char* input, char* output, char* scratchpad) {
+    uint64_t hashA[4], hashB[4];
+    uint64_t *matrix = (uint64_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+    lyra2z_prehash(input, hashA);
+    lyra2z_core_detected(hashB, hashA, matrix);
     memcpy(output, hashB, 32);
 }
+
+void lyra2z_hash(const char* input, char* output) {
+    char scratchpad[LYRA2Z_SCRATCHPAD_SIZE];
+    lyra2z_hash_sp(input, output, scratchpad);
+}
+
+void lyra2z_hash_many(const char* input, char* output, size_t count) {
+    char scratchpad[LYRA2Z_SCRATCHPAD_SIZE_2WAY];
+    uint64_t *matrix = (uint64_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+    uint64_t hashA[8], hashB[8];
+    lyra2z_core_fn core2 = lyra2z_core_2way_detected;
+    if (core2) {
+        while (count >= 2) {
+            lyra2z_prehash(input, hashA);
+            lyra2z_prehash(input + 80, hashA + 4);
+            core2(hashB, hashA, matrix);
+            memcpy(output, hashB, 64);
+            input += 160;
+            output += 64;
+            count -= 2;
+        }
+    }
+    while (count > 0) {
+        lyra2z_hash_sp(input, output, scratchpad);
+        input += 80;
+        output += 32;
+        count -= 1;
+    }
+}
@@ -1,14 +1,49 @@
 #ifndef LYRA2RE_H
 #define LYRA2RE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+/** Lyra2Z memory matrix: nRows(8) * nCols(8) * BLOCK_LEN_INT64(12) words, plus slack for 64-byte alignment. */
+#define LYRA2Z_MATRIX_INT64 (8 * 8 * 12)
+#define LYRA2Z_SCRATCHPAD_SIZE (LYRA2Z_MATRIX_INT64 * 8 + 63)
+#define LYRA2Z_SCRATCHPAD_SIZE_2WAY (2 * LYRA2Z_MATRIX_INT64 * 8 + 63)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void lyra2z_hash(const char* input, char* output);
+void lyra2z_hash_sp(const char* input, char* output, char* scratchpad);
+
+/** Lyra2 core with the Lyra2Z parameters: 32-byte blake256 prehash in, 32-byte key out.
+ *  matrix must hold LYRA2Z_MATRIX_INT64 words and be 32-byte aligned.
+ */
+typedef void (*lyra2z_core_fn)(uint64_t* out, const uint64_t* in, uint64_t* matrix);
+void lyra2z_core_generic(uint64_t* out, const uint64_t* in, uint64_t* matrix);
+extern lyra2z_core_fn lyra2z_core_detected;
+
+/** Two-lane core: in and out hold 2 * 4 words, matrix holds 2 * LYRA2Z_MATRIX_INT64 words.
+ *  NULL when no multi-lane implementation is available.
+ */
+extern lyra2z_core_fn lyra2z_core_2way_detected;
+
+/** Hash count 80-byte inputs stored back to back into count 32-byte outputs.
+ *  Uses the multi-lane core for pairs of inputs when available.
+ */
+void lyra2z_hash_many(const char* input, char* output, size_t count);
 
 #ifdef __cplusplus
 }
 #endif
 
+#ifdef __cplusplus
+#include <string>
+
+/** Autodetect the best available Lyra2Z core (generic, sse2, avx2).
+ *  Returns a description of the selected implementation.
+ */
+std::string lyra2z_detect();
+#endif
+
 #endif
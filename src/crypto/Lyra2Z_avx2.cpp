@@ -0,0 +1,270 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace lyra2z_avx2 {
+namespace {
+
+/** The sponge state lives in four registers: a = v[0..3], b = v[4..7], c = v[8..11], d = v[12..15].
+ *  A Lyra2 block (12 words) is a, b and c.
+ */
+struct State
+{
+    __m256i a, b, c, d;
+};
+
+__m256i inline Load(const uint64_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+void inline Store(uint64_t* p, __m256i x) { _mm256_storeu_si256((__m256i*)p, x); }
+
+__m256i inline RotR32(__m256i x) { return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)); }
+__m256i inline RotR24(__m256i x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                                   3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10));
+}
+__m256i inline RotR16(__m256i x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                                   2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9));
+}
+__m256i inline RotR63(__m256i x) { return _mm256_or_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x)); }
+
+/** Blake2b G function applied to all four columns (or diagonals) at once. */
+void inline __attribute__((always_inline)) G(State& s)
+{
+    s.a = _mm256_add_epi64(s.a, s.b);
+    s.d = RotR32(_mm256_xor_si256(s.d, s.a));
+    s.c = _mm256_add_epi64(s.c, s.d);
+    s.b = RotR24(_mm256_xor_si256(s.b, s.c));
+    s.a = _mm256_add_epi64(s.a, s.b);
+    s.d = RotR16(_mm256_xor_si256(s.d, s.a));
+    s.c = _mm256_add_epi64(s.c, s.d);
+    s.b = RotR63(_mm256_xor_si256(s.b, s.c));
+}
+
+/** One round of the Blake2b compression function, without message words. */
+void inline __attribute__((always_inline)) Round(State& s)
+{
+    G(s);
+    s.b = _mm256_permute4x64_epi64(s.b, _MM_SHUFFLE(0, 3, 2, 1));
+    s.c = _mm256_permute4x64_epi64(s.c, _MM_SHUFFLE(1, 0, 3, 2));
+    s.d = _mm256_permute4x64_epi64(s.d, _MM_SHUFFLE(2, 1, 0, 3));
+    G(s);
+    s.b = _mm256_permute4x64_epi64(s.b, _MM_SHUFFLE(2, 1, 0, 3));
+    s.c = _mm256_permute4x64_epi64(s.c, _MM_SHUFFLE(1, 0, 3, 2));
+    s.d = _mm256_permute4x64_epi64(s.d, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+void Blake2bLyra(State& s)
+{
+    for (int i = 0; i < 12; i++) Round(s);
+}
+
+/** Rotate a 12-word block right by one word (Lyra2's rotW). */
+void inline RotW(const State& s, __m256i& r0, __m256i& r1, __m256i& r2)
+{
+    __m256i pa = _mm256_permute4x64_epi64(s.a, _MM_SHUFFLE(2, 1, 0, 3));
+    __m256i pb = _mm256_permute4x64_epi64(s.b, _MM_SHUFFLE(2, 1, 0, 3));
+    __m256i pc = _mm256_permute4x64_epi64(s.c, _MM_SHUFFLE(2, 1, 0, 3));
+    r0 = _mm256_blend_epi32(pa, pc, 0x03);
+    r1 = _mm256_blend_epi32(pb, pa, 0x03);
+    r2 = _mm256_blend_epi32(pc, pb, 0x03);
+}
+
+const int N_COLS = 8;
+const int N_ROWS = 8;
+const int BLOCK_LEN = 12;
+const int ROW_LEN = BLOCK_LEN * N_COLS;
+const int MATRIX_LEN = ROW_LEN * N_ROWS;
+
+/** The row functions below run N independent sponges in lockstep. Every lane follows the same
+ *  column order; only the row picked for rowInOut during Wandering differs per lane.
+ */
+template<int N>
+void ReducedSqueezeRow0(State* s, uint64_t* const* rowOut)
+{
+    for (int i = 0; i < N_COLS; i++) {
+        for (int l = 0; l < N; l++) {
+            uint64_t* out = rowOut[l] + (N_COLS - 1 - i) * BLOCK_LEN;
+            Store(out, s[l].a);
+            Store(out + 4, s[l].b);
+            Store(out + 8, s[l].c);
+            Round(s[l]);
+        }
+    }
+}
+
+template<int N>
+void ReducedDuplexRow1(State* s, uint64_t* const* rowIn, uint64_t* const* rowOut)
+{
+    for (int i = 0; i < N_COLS; i++) {
+        for (int l = 0; l < N; l++) {
+            const uint64_t* in = rowIn[l] + i * BLOCK_LEN;
+            uint64_t* out = rowOut[l] + (N_COLS - 1 - i) * BLOCK_LEN;
+            __m256i i0 = Load(in), i1 = Load(in + 4), i2 = Load(in + 8);
+            s[l].a = _mm256_xor_si256(s[l].a, i0);
+            s[l].b = _mm256_xor_si256(s[l].b, i1);
+            s[l].c = _mm256_xor_si256(s[l].c, i2);
+            Round(s[l]);
+            Store(out, _mm256_xor_si256(i0, s[l].a));
+            Store(out + 4, _mm256_xor_si256(i1, s[l].b));
+            Store(out + 8, _mm256_xor_si256(i2, s[l].c));
+        }
+    }
+}
+
+template<int N>
+void ReducedDuplexRowSetup(State* s, uint64_t* const* rowIn, uint64_t* const* rowInOut, uint64_t* const* rowOut)
+{
+    for (int i = 0; i < N_COLS; i++) {
+        for (int l = 0; l < N; l++) {
+            const uint64_t* in = rowIn[l] + i * BLOCK_LEN;
+            uint64_t* inout = rowInOut[l] + i * BLOCK_LEN;
+            uint64_t* out = rowOut[l] + (N_COLS - 1 - i) * BLOCK_LEN;
+            __m256i i0 = Load(in), i1 = Load(in + 4), i2 = Load(in + 8);
+            __m256i m0 = Load(inout), m1 = Load(inout + 4), m2 = Load(inout + 8);
+            s[l].a = _mm256_xor_si256(s[l].a, _mm256_add_epi64(i0, m0));
+            s[l].b = _mm256_xor_si256(s[l].b, _mm256_add_epi64(i1, m1));
+            s[l].c = _mm256_xor_si256(s[l].c, _mm256_add_epi64(i2, m2));
+            Round(s[l]);
+            Store(out, _mm256_xor_si256(i0, s[l].a));
+            Store(out + 4, _mm256_xor_si256(i1, s[l].b));
+            Store(out + 8, _mm256_xor_si256(i2, s[l].c));
+            __m256i r0, r1, r2;
+            RotW(s[l], r0, r1, r2);
+            Store(inout, _mm256_xor_si256(m0, r0));
+            Store(inout + 4, _mm256_xor_si256(m1, r1));
+            Store(inout + 8, _mm256_xor_si256(m2, r2));
+        }
+    }
+}
+
+/** rowInOut may alias rowIn or rowOut, so every write goes back to memory before the next read. */
+template<int N>
+void ReducedDuplexRow(State* s, uint64_t* const* rowIn, uint64_t* const* rowInOut, uint64_t* const* rowOut)
+{
+    for (int i = 0; i < N_COLS; i++) {
+        for (int l = 0; l < N; l++) {
+            const uint64_t* in = rowIn[l] + i * BLOCK_LEN;
+            uint64_t* inout = rowInOut[l] + i * BLOCK_LEN;
+            uint64_t* out = rowOut[l] + i * BLOCK_LEN;
+            s[l].a = _mm256_xor_si256(s[l].a, _mm256_add_epi64(Load(in), Load(inout)));
+            s[l].b = _mm256_xor_si256(s[l].b, _mm256_add_epi64(Load(in + 4), Load(inout + 4)));
+            s[l].c = _mm256_xor_si256(s[l].c, _mm256_add_epi64(Load(in + 8), Load(inout + 8)));
+            Round(s[l]);
+            Store(out, _mm256_xor_si256(Load(out), s[l].a));
+            Store(out + 4, _mm256_xor_si256(Load(out + 4), s[l].b));
+            Store(out + 8, _mm256_xor_si256(Load(out + 8), s[l].c));
+            __m256i r0, r1, r2;
+            RotW(s[l], r0, r1, r2);
+            Store(inout, _mm256_xor_si256(Load(inout), r0));
+            Store(inout + 4, _mm256_xor_si256(Load(inout + 4), r1));
+            Store(inout + 8, _mm256_xor_si256(Load(inout + 8), r2));
+        }
+    }
+}
+
+/** Lyra2 with the Lyra2Z parameters (kLen = pwdlen = saltlen = 32, timeCost = 8, nRows = 8, nCols = 8)
+ *  over N lanes: in and out hold 4 words per lane, matrix holds MATRIX_LEN words per lane.
+ */
+template<int N>
+void CoreN(uint64_t* out, const uint64_t* in, uint64_t* matrix)
+{
+    State s[N];
+    uint64_t *pPrev[N], *pRowa[N], *pRow[N];
+    for (int l = 0; l < N; l++) {
+        s[l].a = _mm256_setzero_si256();
+        s[l].b = _mm256_setzero_si256();
+        s[l].c = _mm256_setr_epi64x(0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL);
+        s[l].d = _mm256_setr_epi64x(0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL);
+
+        // Absorb pad(pwd || salt || basil): pwd and salt are both the prehash.
+        __m256i pwd = Load(in + 4 * l);
+        s[l].a = _mm256_xor_si256(s[l].a, pwd);
+        s[l].b = _mm256_xor_si256(s[l].b, pwd);
+    }
+    for (int l = 0; l < N; l++) Blake2bLyra(s[l]);
+    for (int l = 0; l < N; l++) {
+        s[l].a = _mm256_xor_si256(s[l].a, _mm256_setr_epi64x(32, 32, 32, 8));
+        s[l].b = _mm256_xor_si256(s[l].b, _mm256_setr_epi64x(8, 8, 0x80, 0x0100000000000000ULL));
+    }
+    for (int l = 0; l < N; l++) Blake2bLyra(s[l]);
+
+    // Setup phase
+    for (int l = 0; l < N; l++) {
+        pPrev[l] = matrix + l * MATRIX_LEN;
+        pRow[l] = matrix + l * MATRIX_LEN + ROW_LEN;
+    }
+    ReducedSqueezeRow0<N>(s, pPrev);
+    ReducedDuplexRow1<N>(s, pPrev, pRow);
+    int64_t row = 2, prev = 1, rowa = 0, step = 1, window = 2, gap = 1;
+    do {
+        for (int l = 0; l < N; l++) {
+            pPrev[l] = matrix + l * MATRIX_LEN + prev * ROW_LEN;
+            pRowa[l] = matrix + l * MATRIX_LEN + rowa * ROW_LEN;
+            pRow[l] = matrix + l * MATRIX_LEN + row * ROW_LEN;
+        }
+        ReducedDuplexRowSetup<N>(s, pPrev, pRowa, pRow);
+        rowa = (rowa + step) & (window - 1);
+        prev = row;
+        row++;
+        if (rowa == 0) {
+            step = window + gap;
+            window *= 2;
+            gap = -gap;
+        }
+    } while (row < N_ROWS);
+
+    // Wandering phase
+    row = 0;
+    for (int tau = 1; tau <= 8; tau++) {
+        step = (tau % 2 == 0) ? -1 : N_ROWS / 2 - 1;
+        do {
+            for (int l = 0; l < N; l++) {
+                int64_t la = (uint32_t)_mm_cvtsi128_si32(_mm256_castsi256_si128(s[l].a)) & (N_ROWS - 1);
+                pPrev[l] = matrix + l * MATRIX_LEN + prev * ROW_LEN;
+                pRowa[l] = matrix + l * MATRIX_LEN + la * ROW_LEN;
+                pRow[l] = matrix + l * MATRIX_LEN + row * ROW_LEN;
+            }
+            ReducedDuplexRow<N>(s, pPrev, pRowa, pRow);
+            prev = row;
+            row = (row + step) & (N_ROWS - 1);
+        } while (row != 0);
+    }
+
+    // Wrap-up phase: absorb the last row* of each lane
+    for (int l = 0; l < N; l++) {
+        const uint64_t* last = pRowa[l];
+        s[l].a = _mm256_xor_si256(s[l].a, Load(last));
+        s[l].b = _mm256_xor_si256(s[l].b, Load(last + 4));
+        s[l].c = _mm256_xor_si256(s[l].c, Load(last + 8));
+    }
+    for (int l = 0; l < N; l++) {
+        Blake2bLyra(s[l]);
+        Store(out + 4 * l, s[l].a);
+    }
+}
+
+} // namespace
+
+void Core(uint64_t* out, const uint64_t* in, uint64_t* matrix)
+{
+    CoreN<1>(out, in, matrix);
+}
+
+/** Two interleaved lanes: the Blake2b round is a serial dependency chain, so a second
+ *  independent sponge fills the execution ports the first one leaves idle.
+ */
+void Core_2way(uint64_t* out, const uint64_t* in, uint64_t* matrix)
+{
+    CoreN<2>(out, in, matrix);
+}
+
+} // namespace lyra2z_avx2
+
+#endif
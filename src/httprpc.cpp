@@ -6,6 +6,7 @@
 
 #include <chainparams.h>
 #include <httpserver.h>
+#include <jsonstream.h>
 #include <key_io.h>
 #include <rpc/protocol.h>
 #include <rpc/server.h>
@@ -68,6 +69,13 @@ static std::unique_ptr<HTTPRPCTimerInterface> httpRPCTimerInterface;
 
 static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id)
 {
+    if (req->IsReplyStreaming()) {
+        // Part of a streamed result is already sent with status 200, all that is left is to cut it short
+        LogPrintf("%s: streamed reply aborted: %s\n", __func__, objError.write());
+        req->WriteReplyEnd();
+        return;
+    }
+
     // Send error reply from json-rpc error object
     int nStatus = HTTP_INTERNAL_SERVER_ERROR;
     int code = find_value(objError, "code").get_int();
@@ -188,8 +196,32 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            // Let a large result go out as it is produced. The reply starts
+            // with the first full chunk; a handler that does not use the
+            // stream leaves only this prefix in it, which is dropped.
+            CJSONStream stream([req](const std::string& chunk) {
+                if (!req->IsReplyStreaming()) {
+                    req->WriteHeader("Content-Type", "application/json");
+                    req->WriteReplyStart(HTTP_OK);
+                }
+                req->WriteReplyChunk(chunk);
+            });
+            stream.BeginObject();
+            stream.Key("result");
+            jreq.stream = &stream;
+
             UniValue result = tableRPC.execute(jreq);
 
+            if (!stream.AwaitingValue()) {
+                stream.Pair("error", NullUniValue);
+                stream.Pair("id", jreq.id);
+                stream.EndObject();
+                stream.Flush();
+                req->WriteReplyChunk("\n");
+                req->WriteReplyEnd();
+                return true;
+            }
+
             // Send reply
             strReply = JSONRPCReply(result, NullUniValue, jreq.id);
 
@@ -13,6 +13,7 @@
 #include <sync.h>
 #include <ui_interface.h>
 
+#include <atomic>
 #include <memory>
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,6 +41,8 @@
 
 /** Maximum size of http request (request line + headers) */
 static const size_t MAX_HEADERS_SIZE = 8192;
+/** Bytes of a chunked reply that may wait for a slow client before the worker is held */
+static const size_t HTTP_REPLY_QUEUE_SIZE = 8 * 1024 * 1024;
 
 /** HTTP request work item */
 class HTTPWorkItem final : public HTTPClosure
@@ -144,6 +147,10 @@ struct evhttp* eventHTTP = nullptr;
 static std::vector<CSubNet> rpc_allow_subnets;
 //! Work queue for handling longer requests off the event loop thread
 static WorkQueue<HTTPClosure>* workQueue = nullptr;
+//! Set on shutdown, so no worker keeps waiting for a slow client
+static std::atomic<bool> fHTTPInterrupted(false);
+//! Seconds a chunked reply waits for the client to read before the connection is dropped
+static int64_t nHTTPWriteTimeout = DEFAULT_HTTP_SERVER_TIMEOUT;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
@@ -388,7 +395,8 @@ bool InitHTTPServer()
         return false;
     }
 
-    evhttp_set_timeout(http, gArgs.GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+    nHTTPWriteTimeout = gArgs.GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT);
+    evhttp_set_timeout(http, nHTTPWriteTimeout);
     evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
     evhttp_set_max_body_size(http, MAX_SIZE);
     evhttp_set_gencb(http, http_request_cb, nullptr);
@@ -454,6 +462,7 @@ void InterruptHTTPServer()
     }
     if (workQueue)
         workQueue->Interrupt();
+    fHTTPInterrupted = true;
 }
 
 void StopHTTPServer()
@@ -526,12 +535,88 @@ void HTTPEvent::trigger(struct timeval* tv)
     else
         evtimer_add(ev, tv); // trigger after timeval passed
 }
+/** State of a chunked reply, owned by the http thread once the reply is started.
+ * libevent frees the request together with its connection when the client
+ * goes away, so the chunks queued after that must not touch it.
+ */
+struct HTTPChunkedReply
+{
+    struct evhttp_request* req;
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    /** Bytes queued by the worker that the client has not taken yet, guarded by cs */
+    size_t nQueued;
+    /** Whether the client went away, guarded by cs */
+    bool fClosed;
+    /** Bytes passed to evhttp since its output buffer last drained, used on the http thread only */
+    size_t nWritten;
+
+    explicit HTTPChunkedReply(struct evhttp_request* _req) : req(_req), nQueued(0), fClosed(false), nWritten(0) {}
+
+    bool IsClosed()
+    {
+        WaitableLock lock(cs);
+        return fClosed;
+    }
+
+    /** Give back bytes the client has taken, waking the worker if it waits */
+    void Release(size_t nSize)
+    {
+        {
+            WaitableLock lock(cs);
+            nQueued -= nSize;
+        }
+        cond.notify_all();
+    }
+};
+
+static void http_chunked_close_cb(struct evhttp_connection* conn, void* arg)
+{
+    HTTPChunkedReply* reply = static_cast<HTTPChunkedReply*>(arg);
+    {
+        WaitableLock lock(reply->cs);
+        reply->fClosed = true;
+    }
+    reply->cond.notify_all();
+}
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+/** Called by evhttp once the connection's output buffer has drained */
+static void http_chunk_written_cb(struct evhttp_connection* conn, void* arg)
+{
+    HTTPChunkedReply* reply = static_cast<HTTPChunkedReply*>(arg);
+    reply->Release(reply->nWritten);
+    reply->nWritten = 0;
+}
+#endif
+
+/** Re-enable reading from the socket. This is the second part of the libevent
+ * workaround above.
+ */
+static void http_reenable_read(struct evhttp_connection* conn)
+{
+    if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
+        if (conn) {
+            bufferevent* bev = evhttp_connection_get_bufferevent(conn);
+            if (bev) {
+                bufferevent_enable(bev, EV_READ | EV_WRITE);
+            }
+        }
+    }
+}
+
 HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
-                                                       replySent(false)
+                                                       replySent(false),
+                                                       chunkedReply(nullptr)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
+    if (chunkedReply) {
+        // A handler that stopped half way still has to close the chunked body
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        WriteReplyEnd();
+    }
     if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
@@ -593,19 +678,113 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     auto req_copy = req;
     HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
         evhttp_send_reply(req_copy, nStatus, nullptr, nullptr);
-        // Re-enable reading from the socket. This is the second part of the libevent
-        // workaround above.
-        if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
-            evhttp_connection* conn = evhttp_request_get_connection(req_copy);
+        http_reenable_read(evhttp_request_get_connection(req_copy));
+    });
+    ev->trigger(nullptr);
+    replySent = true;
+    req = nullptr; // transferred back to main thread
+}
+
+void HTTPRequest::WriteReplyStart(int nStatus)
+{
+    assert(!replySent && req && !chunkedReply);
+    // Events on the http thread run in the order they were triggered, so the
+    // start, every chunk and the end reach libevent in sequence.
+    HTTPChunkedReply* reply = chunkedReply = new HTTPChunkedReply(req);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reply, nStatus]{
+        evhttp_connection* conn = evhttp_request_get_connection(reply->req);
+        if (conn) {
+            evhttp_connection_set_closecb(conn, http_chunked_close_cb, reply);
+        }
+        evhttp_send_reply_start(reply->req, nStatus, nullptr);
+    });
+    ev->trigger(nullptr);
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(!replySent && chunkedReply);
+    if (strChunk.empty())
+        return true;
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    return WriteReplyChunk(evb);
+}
+
+bool HTTPRequest::WriteReplyChunk(struct evbuffer* evb)
+{
+    assert(!replySent && chunkedReply && evb);
+    HTTPChunkedReply* reply = chunkedReply;
+    const size_t nSize = evbuffer_get_length(evb);
+    bool fTimedOut = false, fStop;
+    {
+        // Hold the worker while the client is behind, so a slow reader
+        // cannot make the node buffer a whole reply; one that does not read
+        // for -rpcservertimeout seconds is dropped.
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(nHTTPWriteTimeout);
+        WaitableLock lock(reply->cs);
+        while (reply->nQueued >= HTTP_REPLY_QUEUE_SIZE && !reply->fClosed && !fHTTPInterrupted) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                fTimedOut = true;
+                break;
+            }
+            reply->cond.wait_for(lock, std::chrono::seconds(1));
+        }
+        fStop = fTimedOut || reply->fClosed || fHTTPInterrupted;
+        if (!fStop)
+            reply->nQueued += nSize;
+    }
+    if (fTimedOut) {
+        LogPrint(BCLog::HTTP, "Dropping HTTP client that stopped reading its reply\n");
+        // Freeing the connection frees req too: mark the reply closed so later events leave it alone
+        HTTPEvent* ev = new HTTPEvent(eventBase, true, [reply]{
+            if (!reply->IsClosed()) {
+                evhttp_connection* conn = evhttp_request_get_connection(reply->req);
+                if (conn) evhttp_connection_free(conn);
+                http_chunked_close_cb(conn, reply);
+            }
+        });
+        ev->trigger(nullptr);
+    }
+    if (fStop) {
+        evbuffer_free(evb);
+        return false;
+    }
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reply, evb, nSize]{
+        if (!reply->IsClosed()) {
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+            reply->nWritten += nSize;
+            evhttp_send_reply_chunk_with_cb(reply->req, evb, http_chunk_written_cb, reply);
+#else
+            evhttp_send_reply_chunk(reply->req, evb);
+            reply->Release(nSize);
+#endif
+        }
+        evbuffer_free(evb);
+    });
+    ev->trigger(nullptr);
+    return true;
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(!replySent && chunkedReply);
+    HTTPChunkedReply* reply = chunkedReply;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reply]{
+        if (!reply->IsClosed()) {
+            evhttp_connection* conn = evhttp_request_get_connection(reply->req);
             if (conn) {
-                bufferevent* bev = evhttp_connection_get_bufferevent(conn);
-                if (bev) {
-                    bufferevent_enable(bev, EV_READ | EV_WRITE);
-                }
+                // The connection may be kept alive for the next request
+                evhttp_connection_set_closecb(conn, nullptr, nullptr);
             }
+            evhttp_send_reply_end(reply->req);
+            http_reenable_read(conn);
         }
+        delete reply;
     });
     ev->trigger(nullptr);
+    chunkedReply = nullptr;
     replySent = true;
     req = nullptr; // transferred back to main thread
 }
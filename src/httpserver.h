@@ -13,6 +13,7 @@ static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
 
+struct evbuffer;
 struct evhttp_request;
 struct event_base;
 class CService;
@@ -54,11 +55,14 @@ struct event_base* EventBase();
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
+struct HTTPChunkedReply;
+
 class HTTPRequest
 {
 private:
     struct evhttp_request* req;
     bool replySent;
+    HTTPChunkedReply* chunkedReply;
 
 public:
     explicit HTTPRequest(struct evhttp_request* req);
@@ -114,6 +118,39 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a chunked HTTP reply, for bodies too large to build in memory first.
+     * Follow with any number of WriteReplyChunk calls and exactly one WriteReplyEnd.
+     *
+     * @note Call this instead of WriteReply, after all WriteHeader calls.
+     */
+    void WriteReplyStart(int nStatus);
+
+    /**
+     * Queue the next part of a chunked reply. Empty chunks are skipped.
+     * Blocks while the client is more than a few megabytes behind, and drops
+     * a client that reads nothing for -rpcservertimeout seconds. Never call
+     * it holding cs_main, mempool.cs or another lock the node needs.
+     * Returns false once the client went away or the server shuts down.
+     */
+    bool WriteReplyChunk(const std::string& strChunk);
+
+    /**
+     * Queue the contents of evb as the next part of a chunked reply, taking
+     * ownership of it. This can carry file segments that are never copied
+     * into memory. Blocks and returns as the string version does.
+     */
+    bool WriteReplyChunk(struct evbuffer* evb);
+
+    /**
+     * Finish a chunked reply. As with WriteReply, do not call any other
+     * HTTPRequest methods afterwards.
+     */
+    void WriteReplyEnd();
+
+    /** Whether WriteReplyStart was called and the reply is not finished yet. */
+    bool IsReplyStreaming() const { return chunkedReply != nullptr; }
 };
 
 /** Event handler closure.
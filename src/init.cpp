@@ -10,6 +10,7 @@
 
 #include <init.h>
 
+#include <addressindex.h>
 #include <addrman.h>
 #include <amount.h>
 #include <chain.h>
@@ -31,10 +32,12 @@
 #include <rpc/server.h>
 #include <rpc/register.h>
 #include <rpc/blockchain.h>
+#include <rpc/mining.h>
 #include <script/standard.h>
 #include <script/sigcache.h>
 #include <scheduler.h>
 #include <shutdown.h>
+#include <stratum.h>
 #include <timedata.h>
 #include <txdb.h>
 #include <txmempool.h>
@@ -59,12 +62,17 @@
 #include <boost/interprocess/sync/file_lock.hpp>
 #include <boost/thread.hpp>
 
+#ifdef ENABLE_WALLET
+#include <wallet/wallet.h>
+#endif
+
 #if ENABLE_ZMQ
 #include <zmq/zmqnotificationinterface.h>
 #include <zmq/zmqrpc.h>
 #endif
 
 #include <crypto/scrypt.h>
+#include <crypto/Lyra2Z.h>
 
 static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
@@ -172,6 +180,7 @@ void Interrupt()
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    InterruptStratum();
     InterruptMapPort();
     if (g_connman)
         g_connman->Interrupt();
@@ -196,6 +205,9 @@ void Shutdown()
     StopREST();
     StopRPC();
     StopHTTPServer();
+#ifdef ENABLE_WALLET
+    StopMiners();
+#endif
     g_wallet_init_interface.Flush();
     StopMapPort();
 
@@ -205,12 +217,15 @@ void Shutdown()
     if (g_connman) g_connman->Stop();
 
     StopTorControl();
+    StopStratum();
 
     // After everything has been shut down, but before things get flushed, stop the
     // CScheduler/checkqueue threadGroup
     threadGroup.interrupt_all();
     threadGroup.join_all();
 
+    if (g_addressindex) UnregisterValidationInterface(g_addressindex.get());
+
     // After the threads that potentially access these pointers have been stopped,
     // destruct and reset all to nullptr.
     peerLogic.reset();
@@ -243,6 +258,7 @@ void Shutdown()
         pcoinsTip.reset();
         pcoinscatcher.reset();
         pcoinsdbview.reset();
+        g_addressindex.reset();
         pblocktree.reset();
     }
     g_wallet_init_interface.Stop();
@@ -309,12 +325,17 @@ static void registerSignalHandler(int signal, void(*handler)(int))
 static void OnRPCStarted()
 {
     uiInterface.NotifyBlockTip.connect(&RPCNotifyBlockChange);
+    uiInterface.NotifyBlockTip.connect(&RPCNotifyLongPollTip);
+    mempool.NotifyEntryAdded.connect(&RPCNotifyLongPollEntry);
 }
 
 static void OnRPCStopped()
 {
     uiInterface.NotifyBlockTip.disconnect(&RPCNotifyBlockChange);
+    mempool.NotifyEntryAdded.disconnect(&RPCNotifyLongPollEntry);
+    uiInterface.NotifyBlockTip.disconnect(&RPCNotifyLongPollTip);
     RPCNotifyBlockChange(false, nullptr);
+    RPCInterruptLongPoll();
     g_best_block_cv.notify_all();
     LogPrint(BCLog::RPC, "RPC stopped.\n");
 }
@@ -354,7 +375,7 @@ void SetupServerArgs()
     gArgs.AddArg("-maxorphantx=<n>", strprintf("Keep at most <n> unconnectable transactions in memory (default: %u)", DEFAULT_MAX_ORPHAN_TRANSACTIONS), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-mempoolexpiry=<n>", strprintf("Do not keep transactions in the mempool longer than <n> hours (default: %u)", DEFAULT_MEMPOOL_EXPIRY), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-minimumchainwork=<hex>", strprintf("Minimum work assumed to exist on a valid chain in hex (default: %s, testnet: %s)", defaultChainParams->GetConsensus().nMinimumChainWork.GetHex(), testnetChainParams->GetConsensus().nMinimumChainWork.GetHex()), true, OptionsCategory::OPTIONS);
-    gArgs.AddArg("-par=<n>", strprintf("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)",
+    gArgs.AddArg("-par=<n>", strprintf("Set the number of script and header PoW verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)",
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-persistmempool", strprintf("Whether to save the mempool on shutdown and load on restart (default: %u)", DEFAULT_PERSIST_MEMPOOL), false, OptionsCategory::OPTIONS);
 #ifndef WIN32
@@ -372,10 +393,13 @@ void SetupServerArgs()
 #else
     hidden_args.emplace_back("-sysperms");
 #endif
+    gArgs.AddArg("-addressindex", strprintf("Maintain an address index, used by the address rpc and rest calls; when enabled on an existing node it is built in the background (default: %u)", DEFAULT_ADDRESSINDEX), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-txindex", strprintf("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)", DEFAULT_TXINDEX), false, OptionsCategory::OPTIONS);
 
     gArgs.AddArg("-gen", "PoW generate enable", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-stakegen", "PoS generate enable", true, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-stakethreads=<n>", strprintf("Set the number of PoS kernel search threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)",
+        -GetNumCores(), MAX_STAKE_THREADS, DEFAULT_STAKE_THREADS), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-gencomment", "coinbase comment", false, OptionsCategory::OPTIONS);
 
     gArgs.AddArg("-addnode=<ip>", "Add a node to connect to and attempt to keep the connection open (see the `addnode` RPC command help for more info). This option can be specified multiple times to add multiple nodes.", false, OptionsCategory::CONNECTION);
@@ -483,7 +507,13 @@ void SetupServerArgs()
 
     gArgs.AddArg("-blockmaxweight=<n>", strprintf("Set maximum BIP141 block weight (default: %d)", DEFAULT_BLOCK_MAX_WEIGHT), false, OptionsCategory::BLOCK_CREATION);
     gArgs.AddArg("-blockmintxfee=<amt>", strprintf("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)", CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)), false, OptionsCategory::BLOCK_CREATION);
+    gArgs.AddArg("-longpollfeedelta=<amt>", strprintf("Fees (in %s) entering the mempool that answer a longpolling getblocktemplate request early (default: %s)", CURRENCY_UNIT, FormatMoney(DEFAULT_LONGPOLL_FEE_DELTA)), false, OptionsCategory::BLOCK_CREATION);
     gArgs.AddArg("-blockversion=<n>", "Override block version to test forking scenarios", true, OptionsCategory::BLOCK_CREATION);
+    gArgs.AddArg("-stratum", strprintf("Accept Stratum connections from PoW miners (default: %u)", DEFAULT_STRATUM_ENABLE), false, OptionsCategory::BLOCK_CREATION);
+    gArgs.AddArg("-stratumaddress=<addr>", "Address that blocks mined through the Stratum server pay to (required with -stratum)", false, OptionsCategory::BLOCK_CREATION);
+    gArgs.AddArg("-stratumbind=<addr>", "Bind the Stratum server to the given address (default: 127.0.0.1)", false, OptionsCategory::BLOCK_CREATION);
+    gArgs.AddArg("-stratumdifficulty=<n>", strprintf("Share difficulty sent to Stratum miners, 1 meaning a target of 0x00000000ffff0000... (default: %s)", DEFAULT_STRATUM_DIFFICULTY), false, OptionsCategory::BLOCK_CREATION);
+    gArgs.AddArg("-stratumport=<port>", strprintf("Listen for Stratum connections on <port> (default: %u)", DEFAULT_STRATUM_PORT), false, OptionsCategory::BLOCK_CREATION);
 
     gArgs.AddArg("-rest", strprintf("Accept public REST requests (default: %u)", DEFAULT_REST_ENABLE), false, OptionsCategory::RPC);
     gArgs.AddArg("-restapi", strprintf("Accept public API requests (default: %u)", false), false, OptionsCategory::RPC);
@@ -689,6 +719,10 @@ static void ThreadImport(std::vector<fs::path> vImportFiles)
         LoadMempool();
     }
     g_is_mempool_loaded = !ShutdownRequested();
+
+    if (!ShutdownRequested() && !BackfillCoinsKernelData(chainparams)) {
+        LogPrintf("Backfilling coin time and offset interrupted, it runs again on next start\n");
+    }
 }
 
 /** Sanity checks
@@ -1096,6 +1130,13 @@ bool AppInitParameterInteraction()
             return InitError(AmountErrMsg("blockmintxfee", gArgs.GetArg("-blockmintxfee", "")));
     }
 
+    if (gArgs.IsArgSet("-longpollfeedelta"))
+    {
+        CAmount n = 0;
+        if (!ParseMoney(gArgs.GetArg("-longpollfeedelta", ""), n))
+            return InitError(AmountErrMsg("longpollfeedelta", gArgs.GetArg("-longpollfeedelta", "")));
+    }
+
     // Feerate used to define dust.  Shouldn't be changed lightly as old
     // implementations may inadvertently create non-standard transactions
     if (gArgs.IsArgSet("-dustrelayfee"))
@@ -1165,6 +1206,7 @@ bool AppInitSanityChecks()
     LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
     std::string sse2detect = scrypt_detect_sse2();
     LogPrintf("%s\n", sse2detect);
+    LogPrintf("%s\n", lyra2z_detect());
     RandomInit();
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1229,10 +1271,12 @@ bool AppInitMain()
     InitSignatureCache();
     InitScriptExecutionCache();
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for script and header PoW verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadPoWCheck);
+        }
     }
 
     // Start the lightweight task scheduler thread
@@ -1494,6 +1538,11 @@ bool AppInitMain()
                     break;
                 }
 
+                if (!pblocktree->UpgradeAddressIndex()) {
+                    strLoadError = _("Error upgrading address index database");
+                    break;
+                }
+
                 // ReplayBlocks is a no-op if we cleared the coinsviewdb with -reindex or -reindex-chainstate
                 if (!ReplayBlocks(chainparams, pcoinsdbview.get())) {
                     strLoadError = _("Unable to replay blocks. You will need to rebuild the database using -reindex-chainstate.");
@@ -1617,6 +1666,15 @@ bool AppInitMain()
         }
     }
 
+    if (!InitAddressIndex(chainparams, gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))) {
+        return InitError(_("Error loading address index database"));
+    }
+    if (g_addressindex) {
+        // Before ThreadImport loads mempool.dat, so every transaction is indexed
+        mempool.setAddressIndex(true);
+        threadGroup.create_thread(&ThreadAddressIndex);
+    }
+
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
     // Wait for genesis block to be processed
@@ -1650,6 +1708,9 @@ bool AppInitMain()
     if (gArgs.GetBoolArg("-listenonion", DEFAULT_LISTEN_ONION))
         StartTorControl();
 
+    if (gArgs.GetBoolArg("-stratum", DEFAULT_STRATUM_ENABLE) && !StartStratum())
+        return false;
+
     Discover();
 
     // Map ports with UPnP
@@ -1721,6 +1782,19 @@ bool AppInitMain()
     g_wallet_init_interface.Start(scheduler);
 
 #ifdef ENABLE_WALLET
+    // -stakethreads=0 means autodetect, but nStakeThreads==0 means no concurrency
+    nStakeThreads = gArgs.GetArg("-stakethreads", DEFAULT_STAKE_THREADS);
+    if (nStakeThreads <= 0)
+        nStakeThreads += GetNumCores();
+    if (nStakeThreads <= 1)
+        nStakeThreads = 0;
+    else if (nStakeThreads > MAX_STAKE_THREADS)
+        nStakeThreads = MAX_STAKE_THREADS;
+    if (nStakeThreads) {
+        LogPrintf("Using %u threads for PoS kernel search\n", nStakeThreads);
+        for (int i=0; i<nStakeThreads-1; i++)
+            threadGroup.create_thread(&ThreadStakeKernelSearch);
+    }
     if (gArgs.GetBoolArg("-gen", false)) { generateCoin (7); } else
         if (gArgs.GetBoolArg("-stakegen", true)) { generateCoin (0); }
     std::string cmt = gArgs.GetArg("-gencomment", "");
@@ -0,0 +1,82 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <jsonstream.h>
+
+#include <assert.h>
+
+CJSONStream::CJSONStream(const Sink& sinkIn, size_t nChunkSizeIn) : sink(sinkIn), nChunkSize(nChunkSizeIn), fAfterKey(false)
+{
+    buffer.reserve(nChunkSize);
+}
+
+void CJSONStream::Separator()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vFirst.empty()) {
+        if (!vFirst.back()) buffer += ',';
+        vFirst.back() = false;
+    }
+}
+
+void CJSONStream::Written()
+{
+    if (buffer.size() >= nChunkSize) Flush();
+}
+
+void CJSONStream::BeginObject()
+{
+    Separator();
+    buffer += '{';
+    vFirst.push_back(true);
+}
+
+void CJSONStream::EndObject()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    vFirst.pop_back();
+    buffer += '}';
+    Written();
+}
+
+void CJSONStream::BeginArray()
+{
+    Separator();
+    buffer += '[';
+    vFirst.push_back(true);
+}
+
+void CJSONStream::EndArray()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    vFirst.pop_back();
+    buffer += ']';
+    Written();
+}
+
+void CJSONStream::Key(const std::string& key)
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    Separator();
+    buffer += UniValue(key).write();
+    buffer += ':';
+    fAfterKey = true;
+}
+
+void CJSONStream::Value(const UniValue& val)
+{
+    Separator();
+    buffer += val.write();
+    Written();
+}
+
+void CJSONStream::Flush()
+{
+    if (buffer.empty()) return;
+    sink(buffer);
+    buffer.clear();
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_JSONSTREAM_H
+#define BITCOIN_JSONSTREAM_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+/** Default number of bytes collected before they are handed to the sink. */
+static const size_t JSON_STREAM_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Writes one compact JSON document piece by piece, so a large response never
+ * exists as a single UniValue tree or string. Output is passed to the sink in
+ * chunks of about nChunkSize bytes; call Flush() once the document is done.
+ * The result is identical to building the same tree and calling write().
+ */
+class CJSONStream
+{
+public:
+    typedef std::function<void(const std::string&)> Sink;
+
+    explicit CJSONStream(const Sink& sinkIn, size_t nChunkSizeIn = JSON_STREAM_CHUNK_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    /** Name of the next member of the current object. */
+    void Key(const std::string& key);
+    /** A complete value: an array element, or the member named by the last Key(). */
+    void Value(const UniValue& val);
+    void Pair(const std::string& key, const UniValue& val) { Key(key); Value(val); }
+    /** Hand everything written so far to the sink. */
+    void Flush();
+
+    /** True after Key() until its value is written. */
+    bool AwaitingValue() const { return fAfterKey; }
+    /** Number of objects and arrays still open. */
+    size_t Depth() const { return vFirst.size(); }
+
+private:
+    Sink sink;
+    size_t nChunkSize;
+    std::string buffer;
+    //! Per open object or array: nothing written into it yet
+    std::vector<bool> vFirst;
+    bool fAfterKey;
+
+    void Separator();
+    void Written();
+};
+
+#endif // BITCOIN_JSONSTREAM_H
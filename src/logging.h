@@ -55,6 +55,7 @@ namespace BCLog {
         QT          = (1 << 19),
         LEVELDB     = (1 << 20),
         NETDUMP     = (1 << 21),
+        STRATUM     = (1 << 22),
         ALL         = ~(uint32_t)0,
     };
 
@@ -0,0 +1,85 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_LRUCACHE_H
+#define BITCOIN_LRUCACHE_H
+
+#include <assert.h>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+/** Map holding at most nMaxSize entries, dropping the least recently used one to make room. Not thread safe. */
+template <typename K, typename V, typename Hash = std::hash<K>>
+class lrucache
+{
+public:
+    typedef std::pair<K, V> value_type;
+    typedef typename std::list<value_type>::size_type size_type;
+
+protected:
+    //! Most recently used first
+    std::list<value_type> items;
+    std::unordered_map<K, typename std::list<value_type>::iterator, Hash> index;
+    size_type nMaxSize;
+
+public:
+    explicit lrucache(size_type nMaxSizeIn) : nMaxSize(nMaxSizeIn) { assert(nMaxSize > 0); }
+    size_type size() const { return items.size(); }
+    size_type max_size() const { return nMaxSize; }
+
+    /** Copy out the value of key and mark it as the most recently used. */
+    bool get(const K& key, V& value)
+    {
+        auto it = index.find(key);
+        if (it == index.end()) return false;
+        items.splice(items.begin(), items, it->second);
+        value = it->second->second;
+        return true;
+    }
+
+    void insert(const K& key, const V& value)
+    {
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->second = value;
+            items.splice(items.begin(), items, it->second);
+            return;
+        }
+        items.emplace_front(key, value);
+        index.emplace(key, items.begin());
+        if (items.size() > nMaxSize) {
+            index.erase(items.back().first);
+            items.pop_back();
+        }
+    }
+
+    /** Take out the least recently used entry, for callers that evict by their own measure. */
+    bool pop_oldest(K& key, V& value)
+    {
+        if (items.empty()) return false;
+        key = items.back().first;
+        value = items.back().second;
+        index.erase(key);
+        items.pop_back();
+        return true;
+    }
+
+    void erase(const K& key)
+    {
+        auto it = index.find(key);
+        if (it == index.end()) return;
+        items.erase(it->second);
+        index.erase(it);
+    }
+
+    void clear()
+    {
+        index.clear();
+        items.clear();
+    }
+};
+
+#endif // BITCOIN_LRUCACHE_H
@@ -29,9 +29,16 @@
 #include <shutdown.h>
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
 #include <queue>
+#include <thread>
 #include <utility>
 
+#include <boost/bind.hpp>
+
 #include <wallet/wallet.h>
 
 // Unconfirmed transactions in the memory pool often depend on other
@@ -41,7 +48,7 @@
 
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockWeight = 0;
-int64_t nLastCoinStakeSearchInterval = 0;
+std::atomic<int64_t> nLastCoinStakeSearchInterval(0);
 
 BlockAssembler::Options::Options() {
     blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
@@ -73,6 +80,59 @@ static BlockAssembler::Options DefaultOptions()
 
 BlockAssembler::BlockAssembler(const CChainParams& params) : BlockAssembler(params, DefaultOptions()) {}
 
+/**
+ * Transactions chosen by the last package selection on a tip, kept between
+ * templates. Mempool additions are queued by the NotifyEntryAdded signal and
+ * appended to the cached selection by the next template, so that only the
+ * coinbase/coinstake has to be finalised per request. Guarded by mempool.cs.
+ */
+struct CTemplateCache
+{
+    const CBlockIndex* pindexPrev = nullptr;
+    bool fIncludeWitness = false;
+    unsigned int nBlockMaxWeight = 0;
+    CFeeRate blockMinFeeRate;
+    int64_t nTimeSelected = 0;
+    //! Selected transactions in block order
+    std::vector<uint256> vTxids;
+    //! Transactions that entered the mempool after the selection and are not in it
+    std::vector<uint256> vAdded;
+    bool fConnected = false;
+
+    void Clear()
+    {
+        pindexPrev = nullptr;
+        vTxids.clear();
+        vAdded.clear();
+    }
+
+    void EntryAdded(CTransactionRef ptx)
+    {
+        if (!pindexPrev) return;
+        if (vAdded.size() >= TEMPLATE_CACHE_MAX_ADDED) {
+            Clear();
+            return;
+        }
+        vAdded.push_back(ptx->GetHash());
+    }
+
+    void EntryRemoved(CTransactionRef ptx, MemPoolRemovalReason reason)
+    {
+        // Anything else drops the transaction together with its descendants,
+        // which a refill simply skips; a block means the tip is moving anyway.
+        if (reason == MemPoolRemovalReason::BLOCK || reason == MemPoolRemovalReason::REORG)
+            Clear();
+    }
+};
+
+static CTemplateCache templateCache;
+
+void ResetBlockTemplateCache()
+{
+    LOCK(mempool.cs);
+    templateCache.Clear();
+}
+
 void BlockAssembler::resetBlock()
 {
     inBlock.clear();
@@ -99,6 +159,47 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewPoSBlock(bool& fPoSCanc
     return CreateNewBlock(scriptDummy, fMineWitnessTx, true, fPoSCancel, pwallet);
 }
 
+void BlockAssembler::InitBlockHeader(const CBlockIndex* pindexPrev, bool fProofOfStake)
+{
+    nHeight = pindexPrev->nHeight + 1;
+    if (chainparams.forkNumber(nHeight) >= 3) {
+        pblock->SetVersion(3);
+    } else if (chainparams.forkNumber(nHeight) >= 2) {
+        pblock->SetNewFormatBlock();
+        pblock->nVersion = 0x20000000;
+    } else {
+        pblock->nVersion = 0x20000000;
+    }
+    pblock->hashPrevBlock = pindexPrev->GetBlockHash();
+    if (fProofOfStake) {
+        pblock->SetProofOfStake();
+    }
+    pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
+    pblock->nNonce = 0;
+}
+
+void BlockAssembler::FinishBlock(CBlockIndex* pindexPrev)
+{
+    bool fHaveWitness = false;
+    for (const auto& tx : pblock->vtx) {
+        if (tx->HasWitness()) { fHaveWitness = true; break; }
+    }
+    if (fHaveWitness)
+        pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
+    pblocktemplate->vTxFees[0] = -nFees;
+    if (pblock->IsNewestFormat()) pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+
+    LogPrintf("CreateNewBlock(): block weight: %u txs: %u fees: %ld sigops %d\n", GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
+
+    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
+
+    CValidationState state;
+    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+        templateCache.Clear();
+        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", "CreateNewBlock", FormatStateMessage(state)));
+    }
+}
+
 std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx, bool fAddProofOfStake, bool& fPoSCancel, std::shared_ptr<CWallet> pwallet)
 {
     int64_t nTimeStart = GetTimeMicros();
@@ -116,125 +217,146 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
 
-    LOCK2(cs_main, mempool.cs);
-    CBlockIndex* pindexPrev = chainActive.Tip();
-    assert(pindexPrev != nullptr);
-    nHeight = pindexPrev->nHeight + 1;
-    if (chainparams.forkNumber(nHeight) >= 3) {
-        pblock->SetVersion(3);
-    } else if (chainparams.forkNumber(nHeight) >= 2) {
-        pblock->SetNewFormatBlock();
-        pblock->nVersion = 0x20000000;
-    } else {
-        pblock->nVersion = 0x20000000;
-    }
-    pblock->hashPrevBlock = pindexPrev->GetBlockHash();
-    if (fAddProofOfStake) {
-        if (chainparams.forkNumber(nHeight) < 2) {
-            return nullptr;
-        }
-        pblock->SetProofOfStake();
-    }
-    pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
-    pblock->nNonce = 0;
-
-    // pos: if coinstake available add coinstake tx
-    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime();  // only initialized at startup
+    // pos: the kernel search runs before cs_main and mempool.cs are taken for assembly, so a large
+    // staking wallet does not stall the node; the result is dropped if the tip moved meanwhile.
+    // nLastCoinStakeSearchTime and nLastCoinStakeSearchInterval are shared by all staking threads
+    // and read by getstakinginfo without a lock, hence atomic; a thread claims its search window
+    // with a compare-exchange so two threads never search the same seconds.
+    static std::atomic<int64_t> nLastCoinStakeSearchTime(GetAdjustedTime());  // only initialized at startup
     uint32_t nCoinStakeTime;
     CAmount nPosReward;
+    CBlockIndex* pindexStake = nullptr;
+    CMutableTransaction txCoinStake;
     if (fAddProofOfStake) {
         fPoSCancel = true;
-        CMutableTransaction txCoinStake;
+        CBlockHeader header;
+        {
+            LOCK(cs_main);
+            pindexStake = chainActive.Tip();
+            assert(pindexStake != nullptr);
+            if (chainparams.forkNumber(pindexStake->nHeight + 1) < 2) {
+                return nullptr;
+            }
+            InitBlockHeader(pindexStake, true);
+            header = pblock->GetBlockHeader();
+        }
+        bool fStakeFound = false;
         nCoinStakeTime = GetAdjustedTime();
         int64_t nSearchTime = nCoinStakeTime;
-        if (nSearchTime > nLastCoinStakeSearchTime) {
-            CBlockHeader header = pblock->GetBlockHeader();
+        int64_t nLastSearchTime = nLastCoinStakeSearchTime.load();
+        if (nSearchTime > nLastSearchTime && nLastCoinStakeSearchTime.compare_exchange_strong(nLastSearchTime, nSearchTime)) {
             header.nTime = nCoinStakeTime;
-            if (pwallet->CreateCoinStake(header, nSearchTime-nLastCoinStakeSearchTime, txCoinStake, nPosReward)) {
-                if (header.nTime >= std::max(pindexPrev->GetMedianTimePast()+1, pindexPrev->GetBlockTime() - MAX_FUTURE_BLOCK_TIME)) {
-                    pblock->vtx.push_back(MakeTransactionRef(std::move(txCoinStake)));
-                    fPoSCancel = false;
-                }
+            if (pwallet->CreateCoinStake(header, nSearchTime-nLastSearchTime, txCoinStake, nPosReward)) {
+                fStakeFound = true;
             }
-            nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-            nLastCoinStakeSearchTime = nSearchTime;
-            nCoinStakeTime = header.nTime;            
+            nLastCoinStakeSearchInterval = nSearchTime - nLastSearchTime;
+            nCoinStakeTime = header.nTime;
         }
-        if (fPoSCancel)
+        if (!fStakeFound)
             return nullptr;
     }
 
-    pblock->nTime = pblock->IsProofOfStake() ? nCoinStakeTime : std::max(pindexPrev->GetBlockTime()+1, GetAdjustedTime());
-    const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
-
-    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                       ? nMedianTimePast
-                       : pblock->GetBlockTime();
-
-    // Decide whether to include witness transactions
-    // This is only needed in case the witness softfork activation is reverted
-    // (which would require a very deep reorganization).
-    // Note that the mempool would accept transactions with witness data before
-    // IsWitnessEnabled, but we would only ever mine blocks after IsWitnessEnabled
-    // unless there is a massive block reorganization with the witness softfork
-    // not activated.
-    // TODO: replace this with a call to main to assess validity of a mempool
-    // transaction (which in most cases can be a no-op).
-    fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus()) && fMineWitnessTx;
-
+    // Assembly runs in three steps: selection under cs_main and mempool.cs; for a
+    // fork-3 PoS block, signing the coinstake without them; then, on the tip the
+    // selection was made for, the commitment and the validity check.
+    CBlockIndex* pindexPrev;
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
-
-    int64_t nTime1 = GetTimeMicros();
-
-    nLastBlockTx = nBlockTx;
-    nLastBlockWeight = nBlockWeight;
+    bool fCached;
+    bool fSignStake;
+    int64_t nTime1;
+    {
+        LOCK2(cs_main, mempool.cs);
+        pindexPrev = chainActive.Tip();
+        assert(pindexPrev != nullptr);
+        if (fAddProofOfStake) {
+            if (pindexPrev != pindexStake) return nullptr;
+            if (nCoinStakeTime >= std::max(pindexPrev->GetMedianTimePast()+1, pindexPrev->GetBlockTime() - MAX_FUTURE_BLOCK_TIME)) {
+                pblock->vtx.push_back(MakeTransactionRef(std::move(txCoinStake)));
+                fPoSCancel = false;
+            }
+            if (fPoSCancel)
+                return nullptr;
+        } else {
+            InitBlockHeader(pindexPrev, false);
+        }
 
-    // Create coinbase transaction.
-    CMutableTransaction coinbaseTx;
-    coinbaseTx.vin.resize(1);
-    coinbaseTx.vin[0].prevout.SetNull();
-    coinbaseTx.vout.resize(1);
-    if (pblock->IsProofOfStake()) {
-        coinbaseTx.vout[0].scriptPubKey = pblock->vtx[1]->vout[1].scriptPubKey;
-        coinbaseTx.vout[0].nValue = nFees + nPosReward;
-    } else {
-        coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
-        coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(pindexPrev->nPowHeight + 1, chainparams.GetConsensus());
+        pblock->nTime = pblock->IsProofOfStake() ? nCoinStakeTime : std::max(pindexPrev->GetBlockTime()+1, GetAdjustedTime());
+        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
+
+        nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                           ? nMedianTimePast
+                           : pblock->GetBlockTime();
+
+        // Decide whether to include witness transactions
+        // This is only needed in case the witness softfork activation is reverted
+        // (which would require a very deep reorganization).
+        // Note that the mempool would accept transactions with witness data before
+        // IsWitnessEnabled, but we would only ever mine blocks after IsWitnessEnabled
+        // unless there is a massive block reorganization with the witness softfork
+        // not activated.
+        // TODO: replace this with a call to main to assess validity of a mempool
+        // transaction (which in most cases can be a no-op).
+        fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus()) && fMineWitnessTx;
+
+        const size_t nFirstTx = pblock->vtx.size();
+        fCached = addCachedTxs(pindexPrev, nPackagesSelected);
+        if (!fCached)
+            addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+
+        nTime1 = GetTimeMicros();
+
+        nLastBlockTx = nBlockTx;
+        nLastBlockWeight = nBlockWeight;
+
+        // Create coinbase transaction.
+        CMutableTransaction coinbaseTx;
+        coinbaseTx.vin.resize(1);
+        coinbaseTx.vin[0].prevout.SetNull();
+        coinbaseTx.vout.resize(1);
+        if (pblock->IsProofOfStake()) {
+            coinbaseTx.vout[0].scriptPubKey = pblock->vtx[1]->vout[1].scriptPubKey;
+            coinbaseTx.vout[0].nValue = nFees + nPosReward;
+        } else {
+            coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+            coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(pindexPrev->nPowHeight + 1, chainparams.GetConsensus());
+        }
+        coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+        pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+        // The selection is final here; record it while its mempool entries are still locked.
+        saveCachedTxs(pindexPrev, nFirstTx, !fCached);
+
+        fSignStake = pblock->IsProofOfStake() && pblock->IsNewestFormat();
+        if (!fSignStake)
+            FinishBlock(pindexPrev);
     }
-    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
-    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
-    if (pblock->IsProofOfStake() && pblock->IsNewestFormat())  {
+
+    if (fSignStake) {
+        // pos: the coinstake commits to the whole block, so it is signed last, without
+        // cs_main and mempool.cs so relay and RPC are not held up by the wallet.
         CMutableTransaction staketx(*pblock->vtx[1]);
         staketx.vout[0].nValue = 0;
         staketx.vout[0].scriptPubKey = MakeCheckStakeScript (*pblock);
-        if (!pwallet->SignTransaction(staketx)) {
-            LogPrintf("CreateCoinStake : failed to sign coinstake");
-            return nullptr;
-        }    
+        {
+            LOCK(pwallet->cs_wallet);
+            if (!pwallet->SignTransaction(staketx)) {
+                LogPrintf("CreateCoinStake : failed to sign coinstake\n");
+                return nullptr;
+            }
+        }
         pblock->vtx[1] = MakeTransactionRef(std::move(staketx));
-    }
-    bool fHaveWitness = false;
-    for (const auto& tx : pblock->vtx) {
-        if (tx->HasWitness()) { fHaveWitness = true; break; }
-    }
-    if (fHaveWitness)
-        pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
-    pblocktemplate->vTxFees[0] = -nFees;
-    if (pblock->IsNewestFormat()) pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
-
-    LogPrintf("CreateNewBlock(): block weight: %u txs: %u fees: %ld sigops %d\n", GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
 
-    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
-
-    CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+        LOCK2(cs_main, mempool.cs);
+        // The block is dropped if the tip moved while it was signed.
+        if (chainActive.Tip() != pindexPrev) {
+            fPoSCancel = true;
+            return nullptr;
+        }
+        FinishBlock(pindexPrev);
     }
     int64_t nTime2 = GetTimeMicros();
 
-    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants%s), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, fCached ? ", cached" : "", 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
 
     return std::move(pblocktemplate);
 }
@@ -349,6 +471,105 @@ void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, std::ve
     std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
 }
 
+bool BlockAssembler::addCachedTxs(const CBlockIndex* pindexPrev, int &nPackagesSelected)
+{
+    const CTemplateCache& cache = templateCache;
+    if (cache.pindexPrev != pindexPrev || cache.fIncludeWitness != fIncludeWitness ||
+            cache.nBlockMaxWeight != nBlockMaxWeight || cache.blockMinFeeRate != blockMinFeeRate)
+        return false;
+    if (GetTime() - cache.nTimeSelected > TEMPLATE_CACHE_MAX_AGE)
+        return false;
+
+    // On an unchanged tip a cached transaction can only have left the mempool
+    // together with its descendants, so skipping the missing ones keeps the
+    // remaining ones in a valid order.
+    for (const uint256& txid : cache.vTxids) {
+        CTxMemPool::txiter it = mempool.mapTx.find(txid);
+        if (it != mempool.mapTx.end())
+            AddToBlock(it);
+    }
+
+    // Append what arrived since, with any ancestors the selection left out,
+    // best ancestor feerate first. Another pass is needed when a package made
+    // it in after a descendant that depended on it had already been tried.
+    std::vector<CTxMemPool::txiter> vCandidates;
+    for (const uint256& txid : cache.vAdded) {
+        CTxMemPool::txiter iter = mempool.mapTx.find(txid);
+        if (iter != mempool.mapTx.end() && !inBlock.count(iter))
+            vCandidates.push_back(iter);
+    }
+    std::sort(vCandidates.begin(), vCandidates.end(), [](CTxMemPool::txiter a, CTxMemPool::txiter b) {
+        return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+    });
+
+    bool fProgress = !vCandidates.empty();
+    while (fProgress) {
+        fProgress = false;
+        for (CTxMemPool::txiter iter : vCandidates) {
+            if (inBlock.count(iter))
+                continue;
+
+            CTxMemPool::setEntries ancestors;
+            uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+            std::string dummy;
+            mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+            onlyUnconfirmed(ancestors);
+            ancestors.insert(iter);
+
+            uint64_t packageSize = 0;
+            CAmount packageFees = 0;
+            int64_t packageSigOpsCost = 0;
+            for (CTxMemPool::txiter it : ancestors) {
+                packageSize += it->GetTxSize();
+                packageFees += it->GetModifiedFee();
+                packageSigOpsCost += it->GetSigOpCost();
+            }
+            if (packageFees < blockMinFeeRate.GetFee(packageSize))
+                continue;
+            if (!TestPackage(packageSize, packageSigOpsCost) || !TestPackageTransactions(ancestors))
+                continue;
+
+            std::vector<CTxMemPool::txiter> sortedEntries;
+            SortForBlock(ancestors, sortedEntries);
+            for (CTxMemPool::txiter it : sortedEntries)
+                AddToBlock(it);
+            ++nPackagesSelected;
+            fProgress = true;
+        }
+    }
+    return true;
+}
+
+void BlockAssembler::saveCachedTxs(const CBlockIndex* pindexPrev, size_t nFirstTx, bool fReselected)
+{
+    CTemplateCache& cache = templateCache;
+    if (!cache.fConnected) {
+        mempool.NotifyEntryAdded.connect(boost::bind(&CTemplateCache::EntryAdded, &cache, _1));
+        mempool.NotifyEntryRemoved.connect(boost::bind(&CTemplateCache::EntryRemoved, &cache, _1, _2));
+        cache.fConnected = true;
+    }
+    cache.pindexPrev = pindexPrev;
+    cache.fIncludeWitness = fIncludeWitness;
+    cache.nBlockMaxWeight = nBlockMaxWeight;
+    cache.blockMinFeeRate = blockMinFeeRate;
+    if (fReselected)
+        cache.nTimeSelected = GetTime();
+    cache.vTxids.clear();
+    for (size_t i = nFirstTx; i < pblock->vtx.size(); i++)
+        cache.vTxids.push_back(pblock->vtx[i]->GetHash());
+    // Additions that did not make it stay queued, as a later child may pay for them.
+    std::vector<uint256> vPending;
+    if (!fReselected) {
+        for (const uint256& txid : cache.vAdded) {
+            CTxMemPool::txiter it = mempool.mapTx.find(txid);
+            if (it != mempool.mapTx.end() && !inBlock.count(it))
+                vPending.push_back(txid);
+        }
+    }
+    cache.vAdded.swap(vPending);
+}
+
 // This transaction selection algorithm orders the mempool based
 // on feerate of a transaction including all unconfirmed ancestors.
 // Since we don't remove transactions from the mempool as we select them
@@ -512,166 +733,288 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 
 #ifdef ENABLE_WALLET
 
-// PoW mining
+// Mining scheduler
+
+/** Rebuild a PoW template after mempool changes once it is this old (ms) */
+static const int64_t MINER_MEMPOOL_REFRESH = 10000;
+/** Rebuild a PoW template at least this often so its time stays current (ms) */
+static const int64_t MINER_TEMPLATE_MAX_AGE = 60000;
+/** Delay between PoS kernel searches while the tip does not move (ms) */
+static const int64_t MINER_STAKE_INTERVAL = 3000;
+
+/**
+ * Owns the PoW and PoS miner threads. Workers block on a condition variable
+ * instead of polling: every new tip bumps nTipSeq, which makes PoW workers
+ * drop the template they are hashing and wakes the stakers at once.
+ */
+class CMinerScheduler : public CValidationInterface
+{
+private:
+    std::mutex cs;
+    std::condition_variable cond;
+    std::atomic<uint64_t> nTipSeq{0};
+    std::atomic<uint64_t> nMempoolSeq{0};
+    std::atomic<bool> fRunPoW{false};
+    std::atomic<bool> fRunPoS{false};
+    std::atomic<int> nPoWThreads{0};
+    std::atomic<int> nPoSThreads{0};
+
+    /** Serializes Start/Stop; never held by the workers */
+    std::mutex cs_control;
+    bool fRegistered = false;
+    std::vector<std::thread> vPoWThreads;
+    std::vector<std::thread> vPoSThreads;
+    CScript scriptPoW;
+
+    /** Block until the tip moves past nSeq, the pool is stopped or nTimeout ms pass */
+    void WaitForTip(const std::atomic<bool>& fRun, uint64_t nSeq, int64_t nTimeout);
+    void StopPool(std::atomic<bool>& fRun, std::atomic<int>& nCount, std::vector<std::thread>& vThreads);
+    void Register();
+    void PoWWorker(int nIndex);
+    void PoSWorker(int nIndex, std::shared_ptr<CWallet> pwallet);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+    void TransactionAddedToMempool(const CTransactionRef& ptx) override;
+
+public:
+    /** (Re)start PoW mining to script with nThreads workers; 0 only stops them */
+    int StartPoW(int nThreads, const CScript& script);
+    /** (Re)start staking for the first nThreads wallets; 0 only stops them */
+    int StartPoS(int nThreads);
+    int CountPoW() const { return nPoWThreads; }
+    int CountPoS() const { return nPoSThreads; }
+    /** Stop and join all workers */
+    void Stop();
+};
+
+static CMinerScheduler g_miner;
+
+void CMinerScheduler::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        ++nTipSeq;
+    }
+    cond.notify_all();
+}
+
+void CMinerScheduler::TransactionAddedToMempool(const CTransactionRef& ptx)
+{
+    // Nobody sleeps on this; PoW workers pick it up between nonce batches.
+    ++nMempoolSeq;
+}
+
+void CMinerScheduler::WaitForTip(const std::atomic<bool>& fRun, uint64_t nSeq, int64_t nTimeout)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait_for(lock, std::chrono::milliseconds(nTimeout), [&] { return !fRun || nTipSeq != nSeq || ShutdownRequested(); });
+}
 
-static int POWCount = 0;
-static int POWWorked = 0;
-static CScript POWScript;
-static int POWTries = 0x0000FFFF;
-static bool isready = false;
+void CMinerScheduler::StopPool(std::atomic<bool>& fRun, std::atomic<int>& nCount, std::vector<std::thread>& vThreads)
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fRun = false;
+    }
+    cond.notify_all();
+    for (std::thread& thread : vThreads) {
+        if (thread.joinable()) thread.join();
+    }
+    vThreads.clear();
+    nCount = 0;
+}
 
-void POWMinerThread (int POWIndex) {
-    LogPrintf("POWMinerThread %d started\n", POWIndex);
+void CMinerScheduler::Register()
+{
+    if (fRegistered) return;
+    RegisterValidationInterface(this);
+    fRegistered = true;
+}
+
+int CMinerScheduler::StartPoW(int nThreads, const CScript& script)
+{
+    std::lock_guard<std::mutex> lock(cs_control);
+    StopPool(fRunPoW, nPoWThreads, vPoWThreads);
+    if (nThreads <= 0) return 0;
+    Register();
+    scriptPoW = script;
+    fRunPoW = true;
+    for (int i = 1; i <= nThreads; i++) {
+        vPoWThreads.emplace_back(&CMinerScheduler::PoWWorker, this, i);
+    }
+    nPoWThreads = vPoWThreads.size();
+    return nPoWThreads;
+}
+
+int CMinerScheduler::StartPoS(int nThreads)
+{
+    std::lock_guard<std::mutex> lock(cs_control);
+    StopPool(fRunPoS, nPoSThreads, vPoSThreads);
+    std::vector<std::shared_ptr<CWallet>> wallets = GetWallets();
+    if (nThreads > (int)wallets.size()) nThreads = wallets.size();
+    if (nThreads <= 0) return 0;
+    Register();
+    fRunPoS = true;
+    for (int i = 1; i <= nThreads; i++) {
+        vPoSThreads.emplace_back(&CMinerScheduler::PoSWorker, this, i, wallets[i-1]);
+    }
+    nPoSThreads = vPoSThreads.size();
+    return nPoSThreads;
+}
+
+void CMinerScheduler::Stop()
+{
+    std::lock_guard<std::mutex> lock(cs_control);
+    StopPool(fRunPoW, nPoWThreads, vPoWThreads);
+    StopPool(fRunPoS, nPoSThreads, vPoSThreads);
+    if (fRegistered) {
+        UnregisterValidationInterface(this);
+        fRegistered = false;
+    }
+}
+
+static const CBlockIndex* GetTemplateParent(const CBlock& block)
+{
+    LOCK(cs_main);
+    return LookupBlockIndex(block.hashPrevBlock);
+}
+
+static bool IsTemplateOnTip(const CBlock& block)
+{
+    LOCK(cs_main);
+    return chainActive.Tip()->GetBlockHash() == block.hashPrevBlock;
+}
+
+void CMinerScheduler::PoWWorker(int nIndex)
+{
+    LogPrintf("POWMinerThread %d started\n", nIndex);
     RenameThread("coin-pow-miner");
-    POWWorked++;
     unsigned int extra = 0;
+    const Consensus::Params& consensus = Params().GetConsensus();
     try {
-        while (true) {
-            if (ShutdownRequested()) break;
-            if (POWIndex > POWCount) break;
-            if (!isready) {
-                if (IsInitialBlockDownload()) { MilliSleep(5000); continue; } else { isready = true; }
-            }
-            int64_t nTime = GetTimeMillis();
-            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(POWScript));
-            if (!pblocktemplate.get()) continue;
+        while (fRunPoW && !ShutdownRequested()) {
+            const uint64_t nSeq = nTipSeq;
+            if (IsInitialBlockDownload()) { WaitForTip(fRunPoW, nSeq, 5000); continue; }
+            const uint64_t nMempool = nMempoolSeq;
+            const int64_t nStart = GetTimeMillis();
+            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(scriptPoW));
+            if (!pblocktemplate) { WaitForTip(fRunPoW, nSeq, 1000); continue; }
             CBlock *pblock = &pblocktemplate->block;
-            IncrementExtraNonce(pblock, chainActive.Tip(), extra);
-            int nMaxTries = POWTries;
+            const CBlockIndex* pindexPrev = GetTemplateParent(*pblock);
+            if (!pindexPrev) continue;
+            IncrementExtraNonce(pblock, pindexPrev, extra);
             bool fNegative, fOverflow;
             arith_uint256 bnTarget;
             bnTarget.SetCompact (pblock->nBits, &fNegative, &fOverflow);
-            const Consensus::Params& consensus = Params().GetConsensus();
-            int nHeight = chainActive.Height() + 1;
-            while ((nMaxTries > 0) && (UintToArith256(pblock->GetPoWHash(nHeight, consensus)) >= bnTarget)) {
-                pblock->nNonce++;
-                nMaxTries--;
-            }
-            nTime = GetTimeMillis() - nTime; if (nTime < 1) nTime = 1;
-            LogPrintf("POWMinerThread %d speed is %d kb\n", POWIndex, (POWTries-nMaxTries) / nTime);
-            if ((nTime < 15000) || (nTime > 45000)) {
-                POWTries = ((POWTries-nMaxTries) / nTime) * 30000;
-                if (POWTries < 0x00000FFF) POWTries = 0x00000FFF;
+            const int nHeight = pindexPrev->nHeight + 1;
+            // Hash a batch of consecutive nonces per call so the multi-lane Lyra2Z core can be used.
+            static const int POW_BATCH = 8;
+            CBlockHeader headers[POW_BATCH];
+            uint256 hashes[POW_BATCH];
+            int heights[POW_BATCH];
+            std::fill(heights, heights + POW_BATCH, nHeight);
+            bool fFound = false;
+            uint64_t nHashes = 0;
+            while (!fFound) {
+                // Stale work is abandoned between batches: a new tip at once,
+                // mempool changes and the block time once the template has aged.
+                if (nTipSeq != nSeq || !fRunPoW || ShutdownRequested()) break;
+                const int64_t nAge = GetTimeMillis() - nStart;
+                if (nAge > MINER_TEMPLATE_MAX_AGE) break;
+                if ((nMempoolSeq != nMempool) && (nAge > MINER_MEMPOOL_REFRESH)) break;
+                if (pblock->nNonce > std::numeric_limits<uint32_t>::max() - POW_BATCH) break;
+                for (int i = 0; i < POW_BATCH; i++) {
+                    headers[i] = pblock->GetBlockHeader();
+                    headers[i].nNonce = pblock->nNonce + i;
+                }
+                GetPoWHashes(headers, heights, POW_BATCH, consensus, hashes);
+                nHashes += POW_BATCH;
+                for (int i = 0; i < POW_BATCH; i++) {
+                    if (UintToArith256(hashes[i]) < bnTarget) {
+                        pblock->nNonce += i;
+                        fFound = true;
+                        break;
+                    }
+                }
+                if (!fFound) pblock->nNonce += POW_BATCH;
             }
-            if (nMaxTries == 0) { continue; }
+            int64_t nTime = GetTimeMillis() - nStart; if (nTime < 1) nTime = 1;
+            LogPrintf("POWMinerThread %d speed is %d kb\n", nIndex, nHashes / nTime);
+            if (!fFound) continue;
             if (UintToArith256(pblock->GetPoWHash(nHeight, consensus)) >= bnTarget) { continue; }
             std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
             if (!ProcessNewBlock(Params(), shared_pblock, true, nullptr))
                 LogPrintf("POWMinerThread: ProcessNewBlock, block not accepted...\n");
-        };
-    }
-    catch (const boost::thread_interrupted&) {
-        POWWorked--;
-        LogPrintf("POWMinerThread terminated\n");
-        return;
-    }
-    catch (const std::runtime_error &e) {
-        POWWorked--;
+        }
+    } catch (const std::runtime_error &e) {
         LogPrintf("POWMinerThread runtime error: %s\n", e.what());
         return;
     } catch (...) {
         PrintExceptionContinue(NULL, "POWMinerThread()");
     }
-    POWWorked--;
-    LogPrintf("POWMinerThread %d stopped\n", POWIndex);
+    LogPrintf("POWMinerThread %d stopped\n", nIndex);
 }
 
-int generatePoWCoin (int nThreads) {
-    if (nThreads < 0) { nThreads = std::thread::hardware_concurrency(); }
-    if (nThreads > 255) { return POWCount; }
-    if (POWCount > 0) {
-        POWCount = 0;
-        while (POWWorked > 0) MilliSleep(200);
-    }
-    if (nThreads == 0) return 0;
-    if (GetWallets().size() == 0) return 0;
-    std::shared_ptr<CWallet> pwallet = GetWallets().front();
-    std::shared_ptr<CReserveScript> coinbase;
-    pwallet->GetScriptForMining (coinbase);
-    if (!coinbase) return 0;
-    if (coinbase->reserveScript.empty()) return 0;
-    POWScript = coinbase->reserveScript;
-    CTxDestination Addr;
-    if (ExtractDestination(POWScript, Addr)) { LogPrintf("POWMiner to %s\n", EncodeDestination(Addr)); }
-    for (int i = 1; i <= nThreads; i++) {
-        POWCount++;
-        std::thread newthread (POWMinerThread, i);
-        newthread.detach();
-    }
-    return POWCount;
-}
-
-// PoS mining
-
-static int POSCount = 0;
-static int POSWorked = 0;
-
-void POSMinerThread (int POSIndex) {
-    LogPrintf("POSMinerThread %d started\n", POSIndex);
+void CMinerScheduler::PoSWorker(int nIndex, std::shared_ptr<CWallet> pwallet)
+{
+    LogPrintf("POSMinerThread %d started\n", nIndex);
     RenameThread("coin-pos-miner");
-    POSWorked++;
     unsigned int extra = 0;
     try {
-        std::shared_ptr<CWallet> pwallet = GetWallets()[POSIndex-1];
-        while (true) {
-            if (ShutdownRequested()) break;
-            if (POSIndex > POSCount) break;
-            if (!isready) {
-                if (IsInitialBlockDownload()) { MilliSleep(3000); continue; } else { isready = true; }
-            }
-            if (pwallet->IsLocked()) { MilliSleep(3000); continue; };
+        while (fRunPoS && !ShutdownRequested()) {
+            const uint64_t nSeq = nTipSeq;
+            if (IsInitialBlockDownload() || pwallet->IsLocked()) { WaitForTip(fRunPoS, nSeq, MINER_STAKE_INTERVAL); continue; }
             bool fPoSCancel = false;
             std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewPoSBlock(fPoSCancel, pwallet));
-            if (fPoSCancel) { MilliSleep (2000); continue; }
-            if (!pblocktemplate.get()) continue;
-            CBlock *pblock = &pblocktemplate->block;
-            if (!pblock->IsNewestFormat()) IncrementExtraNonce(pblock, chainActive.Tip(), extra);
-            if (pblock->IsProofOfStake()) {
-                if (!pblock->IsNewestFormat()) {
-                    if (!SignBlock(*pblock, *pwallet)) continue;
-                }
-                LogPrintf("POSMinerThread: proof-of-stake block found %s\n", pblock->GetHash().ToString());
-                std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
-                try {
-                    if (ProcessNewBlock(Params(), shared_pblock, true, nullptr)) { MilliSleep (10000); };
-                } catch (...) {
-                    PrintExceptionContinue(NULL, "POSMinerThread()");
+            CBlock *pblock = pblocktemplate ? &pblocktemplate->block : nullptr;
+            if (!fPoSCancel && pblock && pblock->IsProofOfStake()) {
+                const CBlockIndex* pindexPrev = GetTemplateParent(*pblock);
+                if (pindexPrev && !pblock->IsNewestFormat()) IncrementExtraNonce(pblock, pindexPrev, extra);
+                if (pindexPrev && (pblock->IsNewestFormat() || SignBlock(*pblock, *pwallet))) {
+                    // Signing ran without cs_main, a block on a stale tip would only be an orphan.
+                    if (!IsTemplateOnTip(*pblock)) {
+                        LogPrintf("POSMinerThread: tip changed while signing, proof-of-stake block dropped\n");
+                        continue;
+                    }
+                    LogPrintf("POSMinerThread: proof-of-stake block found %s\n", pblock->GetHash().ToString());
+                    std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
+                    try {
+                        ProcessNewBlock(Params(), shared_pblock, true, nullptr);
+                    } catch (...) {
+                        PrintExceptionContinue(NULL, "POSMinerThread()");
+                    }
                 }
-            };
-            MilliSleep (3000);
-        };
-    }
-    catch (const boost::thread_interrupted&) {
-        POSWorked--;
-        LogPrintf("POSMinerThread terminated\n");
-        return;
+            }
+            // An accepted block moves the tip, so the next search starts right away.
+            WaitForTip(fRunPoS, nSeq, MINER_STAKE_INTERVAL);
+        }
     } catch (const std::runtime_error &e) {
-        POSWorked--;
         LogPrintf("POSMinerThread runtime error: %s\n", e.what());
         return;
     } catch (...) {
         PrintExceptionContinue(NULL, "POSMinerThread()");
     }
-    POSWorked--;
-    LogPrintf("POSMinerThread %d stopped\n", POSIndex);
+    LogPrintf("POSMinerThread %d stopped\n", nIndex);
+}
+
+int generatePoWCoin (int nThreads) {
+    if (nThreads < 0) { nThreads = std::thread::hardware_concurrency(); }
+    if (nThreads > 255) { return g_miner.CountPoW(); }
+    if ((nThreads == 0) || (GetWallets().size() == 0)) return g_miner.StartPoW(0, CScript());
+    std::shared_ptr<CWallet> pwallet = GetWallets().front();
+    std::shared_ptr<CReserveScript> coinbase;
+    pwallet->GetScriptForMining (coinbase);
+    if (!coinbase || coinbase->reserveScript.empty()) return g_miner.StartPoW(0, CScript());
+    CTxDestination Addr;
+    if (ExtractDestination(coinbase->reserveScript, Addr)) { LogPrintf("POWMiner to %s\n", EncodeDestination(Addr)); }
+    return g_miner.StartPoW(nThreads, coinbase->reserveScript);
 }
 
 int generatePoSCoin (int nThreads) {
     if (nThreads < 0) { nThreads = GetWallets().size(); }
-    if (nThreads > 255) { return POSCount; }
-    if (nThreads > GetWallets().size()) { nThreads = GetWallets().size(); }
-    if (POSCount > 0) {
-        POSCount = 0;
-        while (POSWorked > 0) MilliSleep(200);
-    }
-    if (nThreads == 0) return 0;
-    if (GetWallets().size() == 0) return 0;
-    for (int i = 1; i <= nThreads; i++) {
-        POSCount++;
-        std::thread newthread (POSMinerThread, i);
-        newthread.detach();
-    }
-    return POSCount;
+    if (nThreads > 255) { return g_miner.CountPoS(); }
+    return g_miner.StartPoS(nThreads);
 }
 
 int generateCoin (int nThreads) {
@@ -684,9 +1027,13 @@ int generateCoin (int nThreads) {
         if (nThreads <= 1) nThreads = 1;
         generatePoWCoin (nThreads);
     }
-    if (POSCount > 0) return 0;
-    if (POWCount > 0) return POWCount;
+    if (g_miner.CountPoS() > 0) return 0;
+    if (g_miner.CountPoW() > 0) return g_miner.CountPoW();
     return -1;
 }
 
+void StopMiners () {
+    g_miner.Stop();
+}
+
 #endif // ENABLE_WALLET
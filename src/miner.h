@@ -11,6 +11,7 @@
 #include <txmempool.h>
 #include <validation.h>
 
+#include <atomic>
 #include <stdint.h>
 #include <memory>
 #include <boost/multi_index_container.hpp>
@@ -122,7 +123,7 @@ struct update_for_parent_inclusion
     CTxMemPool::txiter iter;
 };
 
-extern int64_t nLastCoinStakeSearchInterval;
+extern std::atomic<int64_t> nLastCoinStakeSearchInterval;
 
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
@@ -169,14 +170,23 @@ private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
+    /** Set version, parent, PoS flag and nBits of the block being assembled on top of pindexPrev */
+    void InitBlockHeader(const CBlockIndex* pindexPrev, bool fProofOfStake) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
+    /** Fill in the witness commitment, merkle root and coinbase costs, then check the block on pindexPrev */
+    void FinishBlock(CBlockIndex* pindexPrev) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     // Methods for how to add transactions to a block.
     /** Add transactions based on feerate including unconfirmed ancestors
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
       * statistics from the package selection (for logging statistics). */
     void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    /** Refill the block from the selection cached for pindexPrev and append packages
+      * that entered the mempool since. Returns false if the selection must be redone. */
+    bool addCachedTxs(const CBlockIndex* pindexPrev, int &nPackagesSelected) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    /** Cache the transactions from vtx[nFirstTx] on for later templates on pindexPrev */
+    void saveCachedTxs(const CBlockIndex* pindexPrev, size_t nFirstTx, bool fReselected) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
 
     // helper functions for addPackageTxs()
     /** Remove confirmed (inBlock) entries from given set */
@@ -199,10 +209,26 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
 };
 
+/** Age (seconds) after which the cached selection is redone from scratch, so that
+ *  better paying transactions can displace earlier ones once the block is full */
+static const int64_t TEMPLATE_CACHE_MAX_AGE = 30;
+/** Number of mempool additions beyond which patching the cached selection is not worth it */
+static const size_t TEMPLATE_CACHE_MAX_ADDED = 5000;
+
+/** Drop the cached transaction selection, e.g. after fee deltas changed */
+void ResetBlockTemplateCache();
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
 int generateCoin (int nThreads);
+/** Stop and join all miner threads started by generateCoin */
+void StopMiners ();
+
+/** Default for -stakethreads (0 = one per core) */
+static const int DEFAULT_STAKE_THREADS = 0;
+/** Maximum number of PoS kernel search threads */
+static const int MAX_STAKE_THREADS = 64;
 
 #endif // BITCOIN_MINER_H
@@ -213,4 +213,26 @@ uint32_t GetNextWorkRequired(const CBlockIndex *pindexLast, const CBlockHeader *
     if (bnNew < (bnOld >> 3)) bnNew = bnOld >> 3;
     if (bnNew > bnLimit) bnNew = bnLimit;
     return bnNew.GetCompact();
-}
\ No newline at end of file
+}
+
+bool CPoWHashCache::Get(const uint256& hashBlock, CPoWHash& entry) const {
+    LOCK(cs);
+    auto it = map.find(hashBlock);
+    if (it == map.end()) return false;
+    entry = it->second;
+    return true;
+}
+
+void CPoWHashCache::Insert(const uint256& hashBlock, const CPoWHash& entry) {
+    LOCK(cs);
+    auto ret = map.emplace(hashBlock, entry);
+    if (!ret.second) {
+        ret.first->second = entry;
+        return;
+    }
+    order.push_back(hashBlock);
+    while (order.size() > nMaxSize) {
+        map.erase(order.front());
+        order.pop_front();
+    }
+}
@@ -8,16 +8,59 @@
 #define BITCOIN_POW_H
 
 #include <consensus/params.h>
+#include <serialize.h>
+#include <sync.h>
+#include <uint256.h>
 
+#include <deque>
 #include <stdint.h>
+#include <unordered_map>
 
 class CBlockHeader;
 class CBlockIndex;
-class uint256;
 
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, const Consensus::Params& params, bool fProofOfStake);
 
 uint32_t GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params);
 
+/** PoW hash of a block, tagged with the algorithm it was computed with (scrypt before nLyra2ZHeight). */
+struct CPoWHash
+{
+    uint256 hash;
+    bool fLyra2Z;
+
+    CPoWHash() : fLyra2Z(false) {}
+    CPoWHash(const uint256& hashIn, bool fLyra2ZIn) : hash(hashIn), fLyra2Z(fLyra2ZIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(fLyra2Z);
+    }
+};
+
+/** Bounded cache of PoW hashes keyed by block hash. The oldest entries are evicted first. */
+class CPoWHashCache
+{
+private:
+    struct Hasher
+    {
+        size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+    };
+
+    mutable CCriticalSection cs;
+    std::unordered_map<uint256, CPoWHash, Hasher> map;
+    std::deque<uint256> order;
+    size_t nMaxSize;
+
+public:
+    explicit CPoWHashCache(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn) {}
+
+    bool Get(const uint256& hashBlock, CPoWHash& entry) const;
+    void Insert(const uint256& hashBlock, const CPoWHash& entry);
+};
+
 
 #endif // BITCOIN_POW_H
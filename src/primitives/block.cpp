@@ -25,6 +25,32 @@ uint256 CBlockHeader::GetPoWHash(int nHeight, const Consensus::Params& params) c
     return thash;
 }
 
+void GetPoWHashes(const CBlockHeader* headers, const int* heights, size_t count, const Consensus::Params& params, uint256* hashes) {
+    static const size_t BATCH = 8;
+    char input[BATCH * 80];
+    char output[BATCH * 32];
+    size_t index[BATCH];
+
+    while (count > 0) {
+        size_t n = 0, chunk = std::min(count, BATCH);
+        for (size_t i = 0; i < chunk; i++) {
+            if (heights[i] >= params.nLyra2ZHeight) {
+                memcpy(input + n * 80, BEGIN(headers[i].nVersion), 80);
+                index[n++] = i;
+            } else {
+                scrypt_1024_1_1_256(BEGIN(headers[i].nVersion), BEGIN(hashes[i]));
+            }
+        }
+        lyra2z_hash_many(input, output, n);
+        for (size_t k = 0; k < n; k++)
+            memcpy(hashes[index[k]].begin(), output + k * 32, 32);
+        headers += chunk;
+        heights += chunk;
+        hashes += chunk;
+        count -= chunk;
+    }
+}
+
 uint256 CBlockHeader::GetHash() const {
     CHashWriter writer(SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_BLOCK_LEGACY);
     ::Serialize(writer, *this);
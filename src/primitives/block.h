@@ -192,6 +192,11 @@ public:
     std::string ToString() const;
 };
 
+/** Compute the PoW hashes of count headers in one pass, header i being at height heights[i].
+ *  Lyra2Z headers are hashed several lanes at a time where the CPU allows it.
+ */
+void GetPoWHashes(const CBlockHeader* headers, const int* heights, size_t count, const Consensus::Params& params, uint256* hashes);
+
 /** Describes a place in the block chain to another node such that if the
  * other node doesn't have the same branch, it can find a recent common trunk.
  * The further back it is, the further before the fork it may be.
@@ -4,9 +4,13 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <addressindex.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <core_io.h>
+#include <crypto/common.h>
+#include <fs.h>
+#include <hash.h>
 #include <primitives/block.h>
 #include <primitives/transaction.h>
 #include <validation.h>
@@ -14,22 +18,37 @@
 #include <net.h>
 #include <net_processing.h>
 #include <key_io.h>
+#include <lrucache.h>
 #include <httpserver.h>
+#include <jsonstream.h>
 #include <rpc/blockchain.h>
 #include <rpc/server.h>
 #include <streams.h>
 #include <sync.h>
 #include <txmempool.h>
+#include <undo.h>
 #include <utilstrencodings.h>
+#include <utiltime.h>
+#include <validationinterface.h>
 #include <version.h>
 #include <policy/policy.h>
 #include <consensus/validation.h>
 
+#include <atomic>
+#include <map>
+#include <memory>
+
+#include <unistd.h>
+
 #include <boost/algorithm/string.hpp>
 
+#include <event2/buffer.h>
+#include <event2/event.h>
+
 #include <univalue.h>
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const int MAX_REST_BLOCKS_COUNT = 1000; //blocks in one /rest/blocks reply
 
 enum class RetFormat {
     UNDEF,
@@ -111,6 +130,27 @@ static std::string AvailableDataFormatsString()
     return formats;
 }
 
+/** Sink sending a CJSONStream as a chunked application/json reply, started by the first chunk */
+static CJSONStream::Sink JSONReplySink(HTTPRequest* req)
+{
+    return [req](const std::string& chunk) {
+        if (!req->IsReplyStreaming()) {
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReplyStart(HTTP_OK);
+        }
+        req->WriteReplyChunk(chunk);
+    };
+}
+
+/** Finish a reply written by a CJSONStream from JSONReplySink, with the newline the other replies end in */
+static bool JSONReplyEnd(HTTPRequest* req, CJSONStream& stream)
+{
+    stream.Flush();
+    req->WriteReplyChunk("\n");
+    req->WriteReplyEnd();
+    return true;
+}
+
 static bool ParseHashStr(const std::string& strReq, uint256& v)
 {
     if (!IsHex(strReq) || (strReq.size() != 64))
@@ -252,7 +292,12 @@ static bool rest_block(HTTPRequest* req,
         UniValue objBlock;
         {
             LOCK(cs_main);
-            objBlock = blockToJSON(block, pblockindex, showTxDetails);
+            objBlock = blockToJSON(block, pblockindex, false);
+        }
+        if (showTxDetails) {
+            CJSONStream stream(JSONReplySink(req));
+            blockToJSONStream(stream, block, objBlock);
+            return JSONReplyEnd(req, stream);
         }
         std::string strJSON = objBlock.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
@@ -276,6 +321,141 @@ static bool rest_block_notxdetails(HTTPRequest* req, const std::string& strURIPa
     return rest_block(req, strURIPart, false);
 }
 
+/**
+ * The blk and rev files read by one /rest/blocks reply. Where libevent has
+ * file segments, each file is opened once and the records are added to the
+ * reply as ranges of it, which go out to the socket without being copied
+ * through the node.
+ */
+class CBlockFileRanges
+{
+public:
+    CBlockFileRanges() {}
+    CBlockFileRanges(const CBlockFileRanges&) = delete;
+    CBlockFileRanges& operator=(const CBlockFileRanges&) = delete;
+
+    ~CBlockFileRanges()
+    {
+        for (auto& it : files) {
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+            // Replies still holding ranges of the segment keep it open
+            if (it.second.seg) evbuffer_file_segment_free(it.second.seg);
+#endif
+            fclose(it.second.file);
+        }
+    }
+
+    /** Add the record at pos to evb, after its size as 4 little endian bytes. */
+    bool Append(struct evbuffer* evb, const CDiskBlockPos& pos, bool fUndo)
+    {
+        const std::pair<int, bool> key(pos.nFile, fUndo);
+        auto it = files.find(key);
+        if (it == files.end()) {
+            File file;
+            file.file = fsbridge::fopen(GetBlockPosFilename(CDiskBlockPos(pos.nFile, 0), fUndo ? "rev" : "blk"), "rb");
+            if (!file.file) return false;
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+            // The segment is freed on the http thread after the last range is sent, so it gets its own descriptor
+            int fd = dup(fileno(file.file));
+            if (fd >= 0 && !(file.seg = evbuffer_file_segment_new(fd, 0, -1, EVBUF_FS_CLOSE_ON_FREE))) close(fd);
+#endif
+            it = files.emplace(key, file).first;
+        }
+
+        // Records are written as message start, size and data
+        unsigned char header[CMessageHeader::MESSAGE_START_SIZE + 4];
+        if (pos.nPos < sizeof(header) || fseek(it->second.file, pos.nPos - sizeof(header), SEEK_SET) != 0 ||
+            fread(header, 1, sizeof(header), it->second.file) != sizeof(header) ||
+            memcmp(header, Params().MessageStart(), CMessageHeader::MESSAGE_START_SIZE) != 0) {
+            return false;
+        }
+        const uint32_t nSize = ReadLE32(header + CMessageHeader::MESSAGE_START_SIZE);
+        if (nSize > MAX_SIZE) return false;
+        evbuffer_add(evb, header + CMessageHeader::MESSAGE_START_SIZE, 4);
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+        if (it->second.seg) return evbuffer_add_file_segment(evb, it->second.seg, pos.nPos, nSize) == 0;
+#endif
+        std::vector<unsigned char> data(nSize);
+        if (fread(data.data(), 1, nSize, it->second.file) != nSize) return false;
+        return evbuffer_add(evb, data.data(), nSize) == 0;
+    }
+
+private:
+    struct File {
+        FILE* file = nullptr;
+        struct evbuffer_file_segment* seg = nullptr;
+    };
+    std::map<std::pair<int, bool>, File> files;
+};
+
+/**
+ * Consecutive blocks of the active chain with their undo data, for indexers.
+ * For every block the reply holds its size (4 bytes, little endian) and the
+ * block as stored in blk?????.dat, then the same for its undo data from
+ * rev?????.dat, which is empty for the genesis block. The range is cut at
+ * the tip, so a reply may hold fewer blocks than asked for.
+ */
+static bool rest_blocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (rf != RetFormat::BINARY)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: bin)");
+
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    int32_t nStart = 0, nCount = 0;
+    if (path.size() != 2 || !ParseInt32(path[0], &nStart) || !ParseInt32(path[1], &nCount) || nStart < 0 || nCount <= 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blocks/<start>/<count>.bin");
+    if (nCount > MAX_REST_BLOCKS_COUNT)
+        return RESTERR(req, HTTP_BAD_REQUEST, strprintf("Block count out of range (max %d)", MAX_REST_BLOCKS_COUNT));
+
+    std::vector<std::pair<CDiskBlockPos, CDiskBlockPos>> vPos;
+    {
+        LOCK(cs_main);
+        if (nStart > chainActive.Height())
+            return RESTERR(req, HTTP_NOT_FOUND, strprintf("Block height %d not found", nStart));
+        nCount = std::min(nCount, chainActive.Height() - nStart + 1);
+        for (int nHeight = nStart; nHeight < nStart + nCount; nHeight++) {
+            const CBlockIndex* pindex = chainActive[nHeight];
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA) || (pindex->pprev && !(pindex->nStatus & BLOCK_HAVE_UNDO)))
+                return RESTERR(req, HTTP_NOT_FOUND, strprintf("Block %d not available (pruned data)", nHeight));
+            vPos.emplace_back(pindex->GetBlockPos(), pindex->GetUndoPos());
+        }
+    }
+
+    CBlockFileRanges files;
+    for (size_t i = 0; i < vPos.size(); i++) {
+        struct evbuffer* evb = evbuffer_new();
+        assert(evb);
+        bool fOk = files.Append(evb, vPos[i].first, false);
+        if (fOk && vPos[i].second.IsNull()) {
+            const unsigned char empty[4] = {};
+            evbuffer_add(evb, empty, sizeof(empty));
+        } else if (fOk) {
+            fOk = files.Append(evb, vPos[i].second, true);
+        }
+        if (!fOk) {
+            evbuffer_free(evb);
+            if (!req->IsReplyStreaming())
+                return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, strprintf("Block %d could not be read", nStart + (int)i));
+            // Already sent blocks stay valid, the client goes on from the first one missing
+            LogPrintf("%s: block %d could not be read\n", __func__, nStart + (int)i);
+            break;
+        }
+        if (!req->IsReplyStreaming()) {
+            req->WriteHeader("Content-Type", "application/octet-stream");
+            req->WriteReplyStart(HTTP_OK);
+        }
+        if (!req->WriteReplyChunk(evb))
+            break;
+    }
+    req->WriteReplyEnd();
+    return true;
+}
+
 // A bit of a hack - dependency on a function defined in rpc/blockchain.cpp
 UniValue getblockchaininfo(const JSONRPCRequest& request);
 
@@ -333,12 +513,9 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RetFormat::JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        std::string strJSON = mempoolObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        CJSONStream stream(JSONReplySink(req));
+        mempoolToJSONStream(stream);
+        return JSONReplyEnd(req, stream);
     }
     default: {
         return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
@@ -585,6 +762,7 @@ static const struct {
 } uri_prefixes[] = {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
+      {"/rest/blocks/", rest_blocks},
       {"/rest/block/", rest_block_extended},
       {"/rest/chaininfo", rest_chaininfo},
       {"/rest/mempool/info", rest_mempool_info},
@@ -605,14 +783,143 @@ static bool API_ERROR (HTTPRequest* req, std::string message) {
     return true;
 }
 
+/** What a cached /api response depends on: it is rebuilt after the next change of any of them. */
+enum ApiCacheFlags {
+    API_CACHE_NONE    = 0,
+    API_CACHE_TIP     = 1, //!< the active chain tip
+    API_CACHE_MEMPOOL = 2, //!< the mempool contents
+    API_CACHE_PEERS   = 4, //!< the connected peers, kept for API_CACHE_PEERS_TTL seconds
+};
+static const int64_t API_CACHE_PEERS_TTL = 2;
+static const size_t API_RESPONSE_CACHE_SIZE = 1000;
+//! Bytes of response bodies kept by apiResponseCache
+static const size_t API_RESPONSE_CACHE_BYTES = 64 * 1024 * 1024;
+//! Larger bodies are not worth the room they would take from many smaller ones
+static const size_t API_RESPONSE_CACHE_MAX_BODY = 4 * 1024 * 1024;
+
+/** Serialized /api responses by URI, valid until the chain tip or the mempool they were built from
+ *  changes. Each carries an ETag, so a poller holding the current copy gets 304 Not Modified. */
+class CApiResponseCache final : public CValidationInterface
+{
+public:
+    struct Entry {
+        std::string strJSON;
+        std::string strETag;
+        int nFlags;
+        uint64_t nTipGeneration;
+        uint64_t nMempoolGeneration;
+        int64_t nTime;
+    };
+
+    CApiResponseCache() : entries(API_RESPONSE_CACHE_SIZE) {}
+
+    /** Taken before a response is built, so a change racing the build leaves it stale, never wrong. */
+    Entry Begin(int nFlags) const {
+        Entry entry;
+        entry.nFlags = nFlags;
+        entry.nTipGeneration = nTipGeneration;
+        entry.nMempoolGeneration = nMempoolGeneration;
+        entry.nTime = GetTime();
+        return entry;
+    }
+
+    bool Get(const std::string& strURI, Entry& entry) {
+        LOCK(cs);
+        if (!entries.get(strURI, entry)) return false;
+        if ((entry.nFlags & API_CACHE_TIP) && entry.nTipGeneration != nTipGeneration) return false;
+        if ((entry.nFlags & API_CACHE_MEMPOOL) && entry.nMempoolGeneration != nMempoolGeneration) return false;
+        if ((entry.nFlags & API_CACHE_PEERS) && GetTime() > entry.nTime + API_CACHE_PEERS_TTL) return false;
+        return true;
+    }
+
+    void Put(const std::string& strURI, Entry& entry) {
+        entry.strETag = "\"" + Hash(entry.strJSON.begin(), entry.strJSON.end()).GetHex().substr(0, 32) + "\"";
+        if (entry.strJSON.size() > API_RESPONSE_CACHE_MAX_BODY) return;
+        LOCK(cs);
+        Entry old;
+        std::string strOldURI;
+        if (entries.get(strURI, old)) {
+            nBytes -= old.strJSON.size();
+        } else if (entries.size() == entries.max_size() && entries.pop_oldest(strOldURI, old)) {
+            nBytes -= old.strJSON.size();
+        }
+        entries.insert(strURI, entry);
+        nBytes += entry.strJSON.size();
+        while (nBytes > API_RESPONSE_CACHE_BYTES && entries.pop_oldest(strOldURI, old))
+            nBytes -= old.strJSON.size();
+    }
+
+protected:
+    // A new tip also takes the block's transactions out of the mempool.
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override {
+        ++nTipGeneration;
+        ++nMempoolGeneration;
+    }
+    void TransactionAddedToMempool(const CTransactionRef& ptx) override { ++nMempoolGeneration; }
+    void TransactionRemovedFromMempool(const CTransactionRef& ptx) override { ++nMempoolGeneration; }
+
+private:
+    std::atomic<uint64_t> nTipGeneration{0};
+    std::atomic<uint64_t> nMempoolGeneration{0};
+    CCriticalSection cs;
+    lrucache<std::string, Entry> entries;
+    //! Bytes of the bodies in entries
+    size_t nBytes = 0;
+};
+
+static std::unique_ptr<CApiResponseCache> apiResponseCache;
+//! The response being built by this thread for apiResponseCache, instead of written out
+static thread_local CApiResponseCache::Entry* apiBuilding = nullptr;
+
+static bool API_REPLY (HTTPRequest* req, const CApiResponseCache::Entry& entry) {
+    req->WriteHeader("ETag", entry.strETag);
+    std::pair<bool, std::string> ifNoneMatch = req->GetHeader("If-None-Match");
+    if (ifNoneMatch.first) {
+        std::vector<std::string> tags;
+        boost::split(tags, ifNoneMatch.second, boost::is_any_of(","));
+        for (std::string& tag : tags) {
+            boost::trim(tag);
+            if (tag == entry.strETag || tag == "*") {
+                req->WriteReply(HTTP_NOT_MODIFIED);
+                return true;
+            }
+        }
+    }
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReply(HTTP_OK, entry.strJSON);
+    return true;
+}
+
 static bool API_OK (HTTPRequest* req, UniValue& json) {
     json.pushKV("status", "ok");
     std::string strJSON = json.write() + "\n";
+    if (apiBuilding) {
+        apiBuilding->strJSON = std::move(strJSON);
+        return true;
+    }
     req->WriteHeader("Content-Type", "application/json");
     req->WriteReply(HTTP_OK, strJSON);
     return true;
 }
 
+/** Serve a GET from apiResponseCache, or build it with handler and keep it; errors are never cached. */
+static bool API_CACHED (HTTPRequest* req, const std::string& strURIPart, int nFlags,
+    bool (*handler)(HTTPRequest* req, const std::string& strReq)) {
+    if (!apiResponseCache || nFlags == API_CACHE_NONE || req->GetRequestMethod() != HTTPRequest::GET)
+        return handler(req, strURIPart);
+    const std::string strURI = req->GetURI();
+    CApiResponseCache::Entry entry;
+    if (!apiResponseCache->Get(strURI, entry)) {
+        entry = apiResponseCache->Begin(nFlags);
+        apiBuilding = &entry;
+        bool ret = handler(req, strURIPart);
+        apiBuilding = nullptr;
+        if (entry.strJSON.empty()) return ret;
+        apiResponseCache->Put(strURI, entry);
+    }
+    return API_REPLY(req, entry);
+}
+
 UniValue GetNetworkHash () {
     CBlockIndex *pb = chainActive.Tip();
     int lookup = 120;
@@ -702,7 +1009,18 @@ bool api_net (HTTPRequest* req, const std::string& strURIPart) {
     return API_OK (req, root);
 }
 
-void getTxData (UniValue& obj, const CTransactionRef tx, uint256 hashBlock) {
+/** Rendered /api/block and /api/tx results: blocks by hash, confirmed transactions by txid with their block. */
+static const size_t API_BLOCK_CACHE_SIZE = 50;
+static const size_t API_TX_CACHE_SIZE = 2000;
+/** Blocks with more transactions are not read whole for the spent outputs of one /api/tx transaction. */
+static const unsigned int API_TX_UNDO_MAX_BLOCK_TX = 500;
+static CCriticalSection cs_api_cache;
+static lrucache<uint256, UniValue, BlockHasher> apiBlockCache(API_BLOCK_CACHE_SIZE);
+static lrucache<uint256, std::pair<uint256, UniValue>, BlockHasher> apiTxCache(API_TX_CACHE_SIZE);
+
+/** Inputs are resolved from txundo, the spent outputs kept in the undo data of the block, when given;
+ *  otherwise each input costs a transaction lookup. */
+void getTxData (UniValue& obj, const CTransactionRef tx, uint256 hashBlock, const CTxUndo* txundo = nullptr) {
     obj.pushKV("hash", tx->GetHash().GetHex());
     obj.pushKV("size", (int)::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
     obj.pushKV("version", tx->nVersion);
@@ -719,7 +1037,13 @@ void getTxData (UniValue& obj, const CTransactionRef tx, uint256 hashBlock) {
             in.pushKV("tx_out", (int64_t)txin.prevout.n);
             CTransactionRef intx;
             uint256 inhashBlock = uint256();
-            if (GetTransaction(txin.prevout.hash, intx, Params().GetConsensus(), inhashBlock, true)) {
+            if (txundo && txundo->vprevout.size() == tx->vin.size()) {
+                const Coin& coin = txundo->vprevout[i];
+                CTxDestination addr;
+                if (ExtractDestination(coin.out.scriptPubKey, addr))
+                    in.pushKV("address", EncodeDestination(addr));
+                in.pushKV("value", ValueFromAmount(coin.out.nValue));
+            } else if (GetTransaction(txin.prevout.hash, intx, Params().GetConsensus(), inhashBlock, true)) {
                 if (intx->vout.size() >= txin.prevout.n + 1) {
                     CTxDestination addr;
                     if (ExtractDestination(intx->vout[txin.prevout.n].scriptPubKey, addr))
@@ -790,11 +1114,16 @@ std::string getHeaderData (UniValue& obj, const CBlockIndex* pi, bool full_tx) {
     obj.pushKV("chainwork", pi->nChainWork().GetHex());
     obj.pushKV("nTx", (uint64_t)pi->nTx());
     obj.pushKV("type", pi->IsProofOfStake() ? "proof-of-stake" : "proof-of-work");
+    // One undo read resolves the inputs of the whole block.
+    CBlockUndo blockundo;
+    bool fUndo = full_tx && pi->pprev && (pi->nStatus & BLOCK_HAVE_UNDO) && UndoReadFromDisk(blockundo, pi) &&
+        blockundo.vtxundo.size() + 1 == block.vtx.size();
     UniValue utx (UniValue::VARR);
-    for(const auto& tx : block.vtx) {
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransactionRef& tx = block.vtx[i];
         if (full_tx) {
             UniValue obj(UniValue::VOBJ);
-            getTxData (obj, tx, uint256());
+            getTxData (obj, tx, uint256(), fUndo && i > 0 ? &blockundo.vtxundo[i - 1] : nullptr);
             utx.push_back(obj);
         } else {
             utx.push_back(tx->GetHash().GetHex());
@@ -860,8 +1189,24 @@ bool api_block (HTTPRequest* req, const std::string& strURIPart) {
     } else return API_ERROR (req, "params " + strURIPart + " is invalid");
     UniValue root (UniValue::VOBJ);
     UniValue obj (UniValue::VOBJ);
-    std::string ret = getHeaderData (obj, pi, true);
-    if (ret != "") return API_ERROR (req, strprintf("[%d]: %s", pi->nHeight, ret));
+    // A rendered block only changes in its place relative to the tip.
+    const CBlockIndex* pnext = chainActive.Next(pi);
+    std::string strNext = pnext ? pnext->GetBlockHash().GetHex() : "";
+    bool fCached;
+    {
+        LOCK(cs_api_cache);
+        fCached = apiBlockCache.get(pi->GetBlockHash(), obj);
+    }
+    const UniValue& next = find_value(obj, "nextblockhash");
+    if (fCached && (next.isNull() ? "" : next.get_str()) == strNext) {
+        obj.pushKV("confirmations", chainActive.Contains(pi) ? chainActive.Height() - pi->nHeight + 1 : -1);
+    } else {
+        obj = UniValue(UniValue::VOBJ);
+        std::string ret = getHeaderData (obj, pi, true);
+        if (ret != "") return API_ERROR (req, strprintf("[%d]: %s", pi->nHeight, ret));
+        LOCK(cs_api_cache);
+        apiBlockCache.insert(pi->GetBlockHash(), obj);
+    }
     root.pushKV(strprintf("%d", pi->nHeight), obj);
     return API_OK (req, root);
 }
@@ -871,45 +1216,104 @@ bool api_tx (HTTPRequest* req, const std::string& strURIPart) {
     uint256 hash;
     if (!ParseHashStr(strURIPart, hash))
         return API_ERROR (req, "tx hash " + strURIPart + " is invalid");
+    std::pair<uint256, UniValue> entry;
+    bool fCached;
+    {
+        LOCK(cs_api_cache);
+        fCached = apiTxCache.get(hash, entry);
+    }
+    if (fCached) {
+        // Valid while its block stays in the active chain.
+        LOCK(cs_main);
+        const CBlockIndex* pi = LookupBlockIndex(entry.first);
+        if (pi && chainActive.Contains(pi)) return API_OK (req, entry.second);
+    }
     CTransactionRef tx;
     uint256 hashBlock = uint256();
     if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
         return API_ERROR (req, "tx hash " + strURIPart + " not found");
     UniValue root (UniValue::VOBJ);
-    getTxData (root, tx, hashBlock);
+    if (hashBlock.IsNull()) {
+        getTxData (root, tx, hashBlock);
+        return API_OK (req, root);
+    }
+    const CBlockIndex* pi;
+    bool fHaveUndo;
+    {
+        LOCK(cs_main);
+        pi = LookupBlockIndex(hashBlock);
+        fHaveUndo = pi && pi->pprev && (pi->nStatus & BLOCK_HAVE_UNDO) && pi->nTx() <= (int)API_TX_UNDO_MAX_BLOCK_TX;
+    }
+    // The undo data of the block holds the spent outputs in block order, so the
+    // transaction is looked up in the block first. Reading both only pays off for
+    // a small block; in a large one each input is looked up by itself instead.
+    CBlock block;
+    CBlockUndo blockundo;
+    const CTxUndo* txundo = nullptr;
+    if (fHaveUndo && ReadBlockFromDisk(block, pi, Params().GetConsensus()) &&
+        UndoReadFromDisk(blockundo, pi) && blockundo.vtxundo.size() + 1 == block.vtx.size()) {
+        for (size_t i = 1; i < block.vtx.size(); i++) {
+            if (block.vtx[i]->GetHash() == hash) {
+                txundo = &blockundo.vtxundo[i - 1];
+                break;
+            }
+        }
+    }
+    getTxData (root, tx, hashBlock, txundo);
+    LOCK(cs_api_cache);
+    apiTxCache.insert(hash, std::make_pair(hashBlock, root));
     return API_OK (req, root);
 }
 
-bool heightSort(std::pair<CAddressKey, CAddressValue> a, std::pair<CAddressKey, CAddressValue> b) {
-    return a.second.height > b.second.height;
-}
+/** Number of outputs per /api/address page. */
+static const size_t API_ADDRESS_PAGE_SIZE = 200;
 
 bool api_address (HTTPRequest* req, const std::string& strURIPart) {
     if (!CheckWarmup(req)) return false;
+    if (!g_addressindex) return API_ERROR (req, "address index is disabled");
+    if (!g_addressindex->IsSynced()) return API_ERROR (req, "address index is syncing");
+    // <address>, <address>_<page number> or <address>_<next_cursor of the previous page>
     int index = 0;
+    CAddressIndexKey cursor;
     const std::string::size_type pos = strURIPart.rfind('_');
     std::string sss;
     if (pos == std::string::npos) { sss = strURIPart; } else {
         sss = strURIPart.substr(0, pos);
         if (sss == "") return API_ERROR (req, "address is null");
-        uint32_t nn = 0;
+        uint32_t nn = 0, nScript = 0;
         std::string s2 = strURIPart.substr(pos + 1);
         if (ParseUInt32(s2, &nn) && (nn < 9999)) { index = nn; } else
+        if (!DecodeAddressCursor(s2, cursor, nScript) || nScript != 0)
             return API_ERROR (req, "address count " + strURIPart + " is invalid");
     }
     if (!IsValidDestination(DecodeDestination(sss))) 
         return API_ERROR (req, "address " + strURIPart + " is invalid");
+    CScript script = GetScriptForDestination(DecodeDestination(sss));
+    CAddressSummary summary;
     std::vector<std::pair<CAddressKey, CAddressValue>> info;
-    if (!pblocktree->ReadAddress(GetScriptForDestination(DecodeDestination(sss)), info))
+    // Unconfirmed activity comes with the first page
+    const bool fFirstPage = index == 0 && cursor.height == 0;
+    std::vector<std::pair<CMempoolAddressKey, CMempoolAddressDelta>> vUnconfirmed;
+    if (fFirstPage) mempool.getAddressIndex(GetAddressScriptHash(script), vUnconfirmed);
+    // A page number still works, at the cost of reading the rows of the pages before it.
+    size_t nSkip = index * API_ADDRESS_PAGE_SIZE;
+    if (!pblocktree->ReadAddressSummary(script, summary) || !pblocktree->ReadAddress(script, cursor, nSkip + API_ADDRESS_PAGE_SIZE, info))
         return API_ERROR (req, "address " + strURIPart + " not found");
-    UniValue coins(UniValue::VARR);
-    CAmount value = 0, receive_amount = 0, send_amount = 0; 
-    int total_in = 0, total_out = 0, total_pos = 0; index *= 200;
-    std::sort(info.begin(), info.end(), heightSort); 
-    for (auto it : info) {
+    // Not kept in apiResponseCache, so the page goes out as it is rendered
+    CJSONStream stream(JSONReplySink(req));
+    stream.BeginObject();
+    stream.Pair("address", sss);
+    stream.Pair("value", ValueFromAmount(summary.GetBalance()));
+    stream.Pair("receive_count", (int64_t)summary.nReceived);
+    stream.Pair("send_count", (int64_t)summary.nSent);
+    stream.Pair("receive_amount", ValueFromAmount(summary.received));
+    stream.Pair("send_amount", ValueFromAmount(summary.sent));
+    stream.Pair("start_offset", (int64_t)nSkip);
+    stream.Key("coins");
+    stream.BeginArray();
+    for (size_t i = nSkip; i < info.size(); i++) {
+        const std::pair<CAddressKey, CAddressValue>& it = info[i];
         UniValue output(UniValue::VOBJ);
-        total_in++;
-        receive_amount += it.second.value;
         output.pushKV("value", ValueFromAmount(it.second.value));
         output.pushKV("tx_hash", it.first.out.hash.GetHex());
         output.pushKV("tx_out", (int64_t)it.first.out.n);
@@ -918,10 +1322,7 @@ bool api_address (HTTPRequest* req, const std::string& strURIPart) {
         if (pi) output.pushKV("tx_time", pi->GetBlockTime());
         if (it.second.spend_height == 0) {
             output.pushKV("isspent", false);
-            value += it.second.value;
         } else {
-            total_out++;
-            send_amount += it.second.value;
             output.pushKV("isspent", true);
             output.pushKV("spent_tx_hash", it.second.spend_hash.GetHex());
             output.pushKV("spent_tx_out", (int64_t)it.second.spend_n);
@@ -929,19 +1330,35 @@ bool api_address (HTTPRequest* req, const std::string& strURIPart) {
             const CBlockIndex* pi = chainActive[it.second.spend_height];
             if (pi) output.pushKV("spent_tx_time", pi->GetBlockTime());
         }
-        total_pos++;
-        if ((index <= total_pos) && (total_pos < index + 200)) coins.push_back(output);
-    }
-    UniValue objTx(UniValue::VOBJ);
-    objTx.pushKV("address", sss);
-    objTx.pushKV("value", ValueFromAmount(value));
-    objTx.pushKV("receive_count", total_in);
-    objTx.pushKV("send_count", total_out);
-    objTx.pushKV("receive_amount", ValueFromAmount(receive_amount));
-    objTx.pushKV("send_amount", ValueFromAmount(send_amount));
-    objTx.pushKV("start_offset", index);
-    objTx.pushKV("coins", coins);
-    return API_OK (req, objTx);
+        stream.Value(output);
+    }
+    stream.EndArray();
+    if (cursor.height != 0) stream.Pair("next_cursor", EncodeAddressCursor(cursor));
+    if (fFirstPage) {
+        CAmount nUnconfirmed = 0;
+        stream.Key("unconfirmed");
+        stream.BeginArray();
+        for (const auto& it : vUnconfirmed) {
+            UniValue delta(UniValue::VOBJ);
+            delta.pushKV("value", ValueFromAmount(it.second.amount));
+            delta.pushKV("tx_hash", it.first.txid.GetHex());
+            if (it.first.fSpend) {
+                delta.pushKV("tx_in", (int64_t)it.first.index);
+                delta.pushKV("prev_tx_hash", it.second.prevout.hash.GetHex());
+                delta.pushKV("prev_tx_out", (int64_t)it.second.prevout.n);
+            } else {
+                delta.pushKV("tx_out", (int64_t)it.first.index);
+            }
+            delta.pushKV("time", it.second.nTime);
+            stream.Value(delta);
+            nUnconfirmed += it.second.amount;
+        }
+        stream.EndArray();
+        stream.Pair("unconfirmed_value", ValueFromAmount(nUnconfirmed));
+    }
+    stream.Pair("status", "ok");
+    stream.EndObject();
+    return JSONReplyEnd(req, stream);
 }
 
 bool api_send (HTTPRequest* req, const std::string& strURIPart) {
@@ -997,19 +1414,56 @@ bool api_send (HTTPRequest* req, const std::string& strURIPart) {
     }
     return API_OK (req, root);
 }
+/** Number of addresses one /api/utxo request may ask for. */
+static const size_t API_UTXO_MAX_ADDRESSES = 100;
+
+bool api_utxo (HTTPRequest* req, const std::string& strURIPart) {
+    if (!CheckWarmup(req)) return false;
+    if (!g_addressindex) return API_ERROR (req, "address index is disabled");
+    if (!g_addressindex->IsSynced()) return API_ERROR (req, "address index is syncing");
+    // <address>[,<address>...]: the outputs spendable now, mempool included
+    std::vector<std::string> vAddress;
+    boost::split(vAddress, strURIPart, boost::is_any_of(","));
+    if (vAddress.size() > API_UTXO_MAX_ADDRESSES)
+        return API_ERROR (req, strprintf("at most %u addresses per request", API_UTXO_MAX_ADDRESSES));
+    std::vector<CScript> scripts;
+    for (const std::string& address : vAddress) {
+        CTxDestination dest = DecodeDestination(address);
+        if (!IsValidDestination(dest)) return API_ERROR (req, "address " + address + " is invalid");
+        scripts.push_back(GetScriptForDestination(dest));
+    }
+    std::vector<CAddressUnspent> vUnspent;
+    if (!GetAddressUnspent(scripts, true, vUnspent)) return API_ERROR (req, "address index read failed");
+    UniValue utxos(UniValue::VARR);
+    for (const CAddressUnspent& it : vUnspent) {
+        CTxDestination dest;
+        UniValue output(UniValue::VOBJ);
+        output.pushKV("address", ExtractDestination(it.script, dest) ? EncodeDestination(dest) : "");
+        output.pushKV("value", ValueFromAmount(it.value));
+        output.pushKV("tx_hash", it.out.hash.GetHex());
+        output.pushKV("tx_out", (int64_t)it.out.n);
+        output.pushKV("tx_height", (int64_t)it.nHeight);
+        utxos.push_back(output);
+    }
+    UniValue root(UniValue::VOBJ);
+    root.pushKV("utxos", utxos);
+    return API_OK (req, root);
+}
 
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
+    int nCacheFlags;
 } api_uri_prefixes[] = {
-      {"/api/chain", api_chain}, 
-      {"/api/net", api_net},
-      {"/api/mempool", api_mempool},
-      {"/api/header/", api_header},     // start_hash, start_hash/num_header, start_index, start_index/num_header
-      {"/api/block/", api_block},       // hash, index
-      {"/api/tx/", api_tx},             // hash
-      {"/api/address/", api_address},   // address
-      {"/api/send/", api_send},         // TX HEX
+      {"/api/chain", api_chain, API_CACHE_TIP | API_CACHE_MEMPOOL},
+      {"/api/net", api_net, API_CACHE_PEERS},
+      {"/api/mempool", api_mempool, API_CACHE_MEMPOOL},
+      {"/api/header/", api_header, API_CACHE_TIP},  // start_hash, start_hash/num_header, start_index, start_index/num_header
+      {"/api/block/", api_block, API_CACHE_TIP},    // hash, index
+      {"/api/tx/", api_tx, API_CACHE_NONE},         // hash
+      {"/api/address/", api_address, API_CACHE_NONE}, // address
+      {"/api/utxo/", api_utxo, API_CACHE_TIP | API_CACHE_MEMPOOL}, // address,address,...
+      {"/api/send/", api_send, API_CACHE_NONE},     // TX HEX
 };
 
 bool StartREST()
@@ -1019,8 +1473,15 @@ bool StartREST()
             RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler);
     }
     if (gArgs.GetBoolArg("-restapi", false)) {
-        for (unsigned int i = 0; i < ARRAYLEN(api_uri_prefixes); i++)
-            RegisterHTTPHandler(api_uri_prefixes[i].prefix, false, api_uri_prefixes[i].handler);
+        apiResponseCache.reset(new CApiResponseCache());
+        RegisterValidationInterface(apiResponseCache.get());
+        for (unsigned int i = 0; i < ARRAYLEN(api_uri_prefixes); i++) {
+            int nFlags = api_uri_prefixes[i].nCacheFlags;
+            bool (*handler)(HTTPRequest* req, const std::string& strReq) = api_uri_prefixes[i].handler;
+            RegisterHTTPHandler(api_uri_prefixes[i].prefix, false, [nFlags, handler](HTTPRequest* req, const std::string& strURIPart) {
+                return API_CACHED(req, strURIPart, nFlags, handler);
+            });
+        }
     }
     return true;
 }
@@ -1038,5 +1499,7 @@ void StopREST()
     if (gArgs.GetBoolArg("-restapi", false)) {
         for (unsigned int i = 0; i < ARRAYLEN(api_uri_prefixes); i++)
             UnregisterHTTPHandler(api_uri_prefixes[i].prefix, false);
+        // Requests still in flight may use it, so it stays allocated.
+        if (apiResponseCache) UnregisterValidationInterface(apiResponseCache.get());
     }
 }
@@ -12,6 +12,7 @@
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <coins.h>
+#include <jsonstream.h>
 #include <consensus/validation.h>
 #include <validation.h>
 #include <core_io.h>
@@ -159,12 +160,33 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
         result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
 
     result.push_back(Pair("flags", strprintf("%s%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier()? " stake-modifier": "")));
-    result.push_back(Pair("proofhash", blockindex->IsProofOfStake() ? blockindex->hashProofOfStake.GetHex() : blockindex->GetBlockHeader().GetPoWHash(blockindex->nHeight, Params().GetConsensus()).GetHex()));
+    result.push_back(Pair("proofhash", blockindex->IsProofOfStake() ? blockindex->hashProofOfStake.GetHex() : GetBlockPoWHash(blockindex->GetBlockHeader(), blockindex->nHeight, Params().GetConsensus()).GetHex()));
     result.push_back(Pair("entropybit", (int)blockindex->GetStakeEntropyBit()));
     result.push_back(Pair("modifier", strprintf("%016llx", blockindex->nStakeModifier)));
     return result;
 }
 
+void blockToJSONStream(CJSONStream& stream, const CBlock& block, const UniValue& blockInfo)
+{
+    stream.BeginObject();
+    for (size_t i = 0; i < blockInfo.size(); i++) {
+        const std::string& key = blockInfo.getKeys()[i];
+        stream.Key(key);
+        if (key != "tx") {
+            stream.Value(blockInfo.getValues()[i]);
+            continue;
+        }
+        stream.BeginArray();
+        for (const auto& tx : block.vtx) {
+            UniValue objTx(UniValue::VOBJ);
+            TxToUniv(*tx, uint256(), objTx, true, RPCSerializationFlags());
+            stream.Value(objTx);
+        }
+        stream.EndArray();
+    }
+    stream.EndObject();
+}
+
 static UniValue getblockcount(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -472,6 +494,35 @@ UniValue mempoolToJSON(bool fVerbose)
     }
 }
 
+/** Mempool entries described per hold of mempool.cs by mempoolToJSONStream */
+static const size_t MEMPOOL_STREAM_BATCH = 1000;
+
+void mempoolToJSONStream(CJSONStream& stream)
+{
+    // Writing waits for the client to read, so a batch is described under mempool.cs and
+    // written after it is released. Entries that leave the mempool meanwhile are skipped.
+    std::vector<uint256> vtxid;
+    mempool.queryHashes(vtxid);
+    stream.BeginObject();
+    std::vector<std::pair<std::string, UniValue>> vBatch;
+    for (size_t i = 0; i < vtxid.size(); i += MEMPOOL_STREAM_BATCH) {
+        vBatch.clear();
+        {
+            LOCK(mempool.cs);
+            for (size_t j = i; j < std::min(vtxid.size(), i + MEMPOOL_STREAM_BATCH); j++) {
+                CTxMemPool::txiter it = mempool.mapTx.find(vtxid[j]);
+                if (it == mempool.mapTx.end()) continue;
+                UniValue info(UniValue::VOBJ);
+                entryToJSON(info, *it);
+                vBatch.emplace_back(vtxid[j].ToString(), std::move(info));
+            }
+        }
+        for (const auto& entry : vBatch)
+            stream.Pair(entry.first, entry.second);
+    }
+    stream.EndObject();
+}
+
 static UniValue getrawmempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
@@ -501,6 +552,10 @@ static UniValue getrawmempool(const JSONRPCRequest& request)
     if (!request.params[0].isNull())
         fVerbose = request.params[0].get_bool();
 
+    if (fVerbose && request.stream) {
+        mempoolToJSONStream(*request.stream);
+        return NullUniValue;
+    }
     return mempoolToJSON(fVerbose);
 }
 
@@ -821,8 +876,6 @@ static UniValue getblock(const JSONRPCRequest& request)
             + HelpExampleRpc("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = request.params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -834,23 +887,35 @@ static UniValue getblock(const JSONRPCRequest& request)
             verbosity = request.params[1].get_bool() ? 1 : 0;
     }
 
-    const CBlockIndex* pblockindex = LookupBlockIndex(hash);
-    if (!pblockindex) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-    }
+    CBlock block;
+    UniValue blockInfo;
+    {
+        LOCK(cs_main);
 
-    const CBlock block = GetBlockChecked(pblockindex);
+        const CBlockIndex* pblockindex = LookupBlockIndex(hash);
+        if (!pblockindex) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        }
 
-    if (verbosity <= 0)
-    {
-        int ser_flags = pblockindex->nHeight < Params().GetConsensus().TLRHeight ? SERIALIZE_BLOCK_LEGACY : 0;
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | ser_flags | RPCSerializationFlags());
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        block = GetBlockChecked(pblockindex);
+
+        if (verbosity <= 0)
+        {
+            int ser_flags = pblockindex->nHeight < Params().GetConsensus().TLRHeight ? SERIALIZE_BLOCK_LEGACY : 0;
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | ser_flags | RPCSerializationFlags());
+            ssBlock << block;
+            std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
+            return strHex;
+        }
+
+        if (verbosity < 2 || !request.stream)
+            return blockToJSON(block, pblockindex, verbosity >= 2);
+        blockInfo = blockToJSON(block, pblockindex, false);
     }
 
-    return blockToJSON(block, pblockindex, verbosity >= 2);
+    // Writing waits for the client to read, so the transactions are streamed without cs_main.
+    blockToJSONStream(*request.stream, block, blockInfo);
+    return NullUniValue;
 }
 
 struct CCoinsStats
@@ -2661,7 +2726,20 @@ static UniValue dumpdb(const JSONRPCRequest& request)
         );
 
     LOCK(cs_main);
-    pblocktree->DumpAddrDB ();
+    // The index keeps only script hashes: take the script from the output, unspent or in its block.
+    pblocktree->DumpAddrDB ([](const COutPoint& out, uint32_t nHeight, CScript& script) {
+        Coin coin;
+        if (pcoinsTip->GetCoin(out, coin)) {
+            script = coin.out.scriptPubKey;
+            return true;
+        }
+        CTransactionRef tx;
+        uint256 hashBlock;
+        if (!GetTransaction(out.hash, tx, Params().GetConsensus(), hashBlock, true, chainActive[nHeight]) || out.n >= tx->vout.size())
+            return false;
+        script = tx->vout[out.n].scriptPubKey;
+        return true;
+    });
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("proof-of-work",        GetDifficulty(false)));
     obj.push_back(Pair("proof-of-stake",       GetDifficulty(true)));
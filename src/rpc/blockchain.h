@@ -12,6 +12,7 @@
 
 class CBlock;
 class CBlockIndex;
+class CJSONStream;
 class UniValue;
 
 static constexpr int NUM_GETBLOCKSTATS_PERCENTILES = 5;
@@ -31,12 +32,19 @@ void RPCNotifyBlockChange(bool ibd, const CBlockIndex *);
 /** Block description to JSON */
 UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 
+/** Write blockToJSON(block, blockindex, true) to stream, given blockInfo = blockToJSON(block, blockindex, false).
+ *  The transactions are decoded one at a time and need no cs_main. */
+void blockToJSONStream(CJSONStream& stream, const CBlock& block, const UniValue& blockInfo);
+
 /** Mempool information to JSON */
 UniValue mempoolInfoToJSON();
 
 /** Mempool to JSON */
 UniValue mempoolToJSON(bool fVerbose = false);
 
+/** Write mempoolToJSON(true) to stream, never holding mempool.cs while writing; entries are read in batches, not as one snapshot */
+void mempoolToJSONStream(CJSONStream& stream);
+
 /** Block header to JSON */
 UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
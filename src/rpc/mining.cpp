@@ -22,12 +22,16 @@
 #include <shutdown.h>
 #include <txmempool.h>
 #include <util.h>
+#include <utilmoneystr.h>
 #include <utilstrencodings.h>
 #include <validationinterface.h>
 #include <warnings.h>
 #include <wallet/fees.h>
 
+#include <condition_variable>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <stdint.h>
 
 /**
@@ -256,6 +260,7 @@ static UniValue prioritisetransaction(const JSONRPCRequest& request)
     }
 
     mempool.PrioritiseTransaction(hash, nAmount);
+    ResetBlockTemplateCache();
     return true;
 }
 
@@ -288,6 +293,98 @@ static std::string gbt_vb_name(const Consensus::DeploymentPos pos) {
     return s;
 }
 
+void CLongPollRegistry::Wake(Waiter* waiter)
+{
+    waiter->fWoken = true;
+    waiter->cond.notify_one();
+    waiters.erase(waiter->it);
+}
+
+void CLongPollRegistry::Register(Waiter& waiter, bool fWake, std::chrono::steady_clock::time_point now)
+{
+    WaitableLock lock(cs);
+    waiter.nFeesWake = nFees + nFeeDelta;
+    waiter.checktxtime = now + std::chrono::minutes(1);
+    // Checked under the lock so that shutdown cannot slip in before we are listed
+    waiter.fWoken = fWake || fInterrupted;
+    if (!waiter.fWoken)
+        waiter.it = waiters.insert(waiters.end(), &waiter);
+}
+
+void CLongPollRegistry::Wait(Waiter& waiter, const std::function<bool()>& fChanged)
+{
+    WaitableLock lock(cs);
+    if (waiter.cond.wait_until(lock, waiter.checktxtime, [&waiter] { return waiter.fWoken; }))
+        return;
+    // A minute without enough new fees: answer if anything changed at all,
+    // otherwise the next transaction wakes us. The mempool lock is taken
+    // before cs by the notifications, so never while holding it.
+    lock.unlock();
+    bool fChangedNow = fChanged();
+    lock.lock();
+    if (!fChangedNow)
+        waiter.cond.wait(lock, [&waiter] { return waiter.fWoken; });
+    if (!waiter.fWoken)
+        waiters.erase(waiter.it);
+}
+
+void CLongPollRegistry::NotifyTip()
+{
+    WaitableLock lock(cs);
+    while (!waiters.empty())
+        Wake(waiters.front());
+}
+
+void CLongPollRegistry::NotifyEntry(CAmount nFee, std::chrono::steady_clock::time_point now)
+{
+    WaitableLock lock(cs);
+    if (nFee > 0)
+        nFees += nFee;
+    while (!waiters.empty()) {
+        Waiter* waiter = waiters.front();
+        if (nFees < waiter->nFeesWake && now < waiter->checktxtime)
+            break;
+        Wake(waiter);
+    }
+}
+
+void CLongPollRegistry::Interrupt()
+{
+    WaitableLock lock(cs);
+    fInterrupted = true;
+    while (!waiters.empty())
+        Wake(waiters.front());
+}
+
+static CAmount LongPollFeeDelta()
+{
+    CAmount n = DEFAULT_LONGPOLL_FEE_DELTA;
+    if (gArgs.IsArgSet("-longpollfeedelta"))
+        ParseMoney(gArgs.GetArg("-longpollfeedelta", ""), n);
+    return n;
+}
+
+static CLongPollRegistry& LongPollRegistry()
+{
+    static CLongPollRegistry registry(LongPollFeeDelta());
+    return registry;
+}
+
+void RPCNotifyLongPollTip(bool ibd, const CBlockIndex* pindex)
+{
+    LongPollRegistry().NotifyTip();
+}
+
+void RPCNotifyLongPollEntry(CTransactionRef tx, CAmount nFee)
+{
+    LongPollRegistry().NotifyEntry(nFee, std::chrono::steady_clock::now());
+}
+
+void RPCInterruptLongPoll()
+{
+    LongPollRegistry().Interrupt();
+}
+
 static UniValue getblocktemplate(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
@@ -443,12 +540,13 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Wallet is downloading blocks...");
 
     static unsigned int nTransactionsUpdatedLast;
+    bool fLongPollWoken = false;
 
     if (!lpval.isNull())
     {
-        // Wait to respond until either the best block changes, OR a minute has passed and there are more transactions
+        // Wait to respond until either the best block changes, OR enough fees came in,
+        // OR a minute has passed and there are more transactions
         uint256 hashWatchedChain;
-        std::chrono::steady_clock::time_point checktxtime;
         unsigned int nTransactionsUpdatedLastLP;
 
         if (lpval.isStr())
@@ -466,23 +564,14 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
             nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
         }
 
+        // Registered under cs_main, so a tip change we have not seen yet still wakes us
+        CLongPollRegistry::Waiter waiter;
+        LongPollRegistry().Register(waiter, hashWatchedChain != chainActive.Tip()->GetBlockHash(), std::chrono::steady_clock::now());
+
         // Release the wallet and main lock while waiting
         LEAVE_CRITICAL_SECTION(cs_main);
-        {
-            checktxtime = std::chrono::steady_clock::now() + std::chrono::minutes(1);
-
-            WaitableLock lock(g_best_block_mutex);
-            while (g_best_block == hashWatchedChain && IsRPCRunning())
-            {
-                if (g_best_block_cv.wait_until(lock, checktxtime) == std::cv_status::timeout)
-                {
-                    // Timeout: Check transactions for update
-                    if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
-                        break;
-                    checktxtime += std::chrono::seconds(10);
-                }
-            }
-        }
+        LongPollRegistry().Wait(waiter, [nTransactionsUpdatedLastLP] { return mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP; });
+        fLongPollWoken = true;
         ENTER_CRITICAL_SECTION(cs_main);
 
         if (!IsRPCRunning())
@@ -503,7 +592,7 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
     // a segwit-block to a non-segwit caller.
     static bool fLastTemplateSupportsSegwit = true;
     if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5) ||
+        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && (GetTime() - nStart > 5 || fLongPollWoken)) ||
         fLastTemplateSupportsSegwit != fSupportsSegwit)
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
@@ -6,11 +6,75 @@
 #ifndef BITCOIN_RPC_MINING_H
 #define BITCOIN_RPC_MINING_H
 
+#include <amount.h>
+#include <primitives/transaction.h>
 #include <script/script.h>
+#include <sync.h>
+
+#include <chrono>
+#include <functional>
+#include <list>
 
 #include <univalue.h>
 
+class CBlockIndex;
+
+/** Mempool fees that wake longpolling getblocktemplate requests before their minute is up */
+static const CAmount DEFAULT_LONGPOLL_FEE_DELTA = COIN / 10000;
+
+/**
+ * Longpolling getblocktemplate requests. Each waiter sleeps on its own
+ * condition variable and is woken once: by the next tip change, by nFeeDelta
+ * worth of fees entering the mempool, or, once it has waited a minute, by any
+ * new transaction. Waiters are kept in registration order, in which both their
+ * fee mark and their deadline only grow, so a new mempool entry only visits
+ * the waiters it actually wakes.
+ */
+class CLongPollRegistry
+{
+public:
+    struct Waiter
+    {
+        CAmount nFeesWake;
+        std::chrono::steady_clock::time_point checktxtime;
+        bool fWoken = false;
+        CConditionVariable cond;
+        std::list<Waiter*>::iterator it;
+    };
+
+    explicit CLongPollRegistry(CAmount nFeeDeltaIn) : nFeeDelta(nFeeDeltaIn) {}
+
+    /** List the waiter, or mark it woken at once if fWake or the registry is interrupted */
+    void Register(Waiter& waiter, bool fWake, std::chrono::steady_clock::time_point now);
+    /** Sleep until the waiter is woken. If its minute passes first, fChanged (called
+      * without cs) decides whether to return now or to wait for the next transaction. */
+    void Wait(Waiter& waiter, const std::function<bool()>& fChanged);
+    /** Wake every waiter */
+    void NotifyTip();
+    /** Account a new mempool entry and wake the waiters whose fee mark or deadline it passes */
+    void NotifyEntry(CAmount nFee, std::chrono::steady_clock::time_point now);
+    /** Wake every waiter and keep waking new ones from now on */
+    void Interrupt();
+
+private:
+    void Wake(Waiter* waiter) EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+    const CAmount nFeeDelta;
+    CWaitableCriticalSection cs;
+    std::list<Waiter*> waiters GUARDED_BY(cs);
+    /** Fees of the mempool entries added so far, only ever growing */
+    CAmount nFees GUARDED_BY(cs) = 0;
+    bool fInterrupted GUARDED_BY(cs) = false;
+};
+
 /** Generate blocks (mine) */
 UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGenerate, uint64_t nMaxTries, bool keepScript);
 
+/** Callback for when block tip changed, wakes every longpolling getblocktemplate request */
+void RPCNotifyLongPollTip(bool ibd, const CBlockIndex* pindex);
+/** Callback for when a transaction entered the mempool, with its modified fee */
+void RPCNotifyLongPollEntry(CTransactionRef tx, CAmount nFee);
+/** Wake every longpolling getblocktemplate request for shutdown */
+void RPCInterruptLongPoll();
+
 #endif
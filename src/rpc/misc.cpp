@@ -4,6 +4,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <addressindex.h>
 #include <chain.h>
 #include <clientversion.h>
 #include <core_io.h>
@@ -19,6 +20,7 @@
 #include <rpc/server.h>
 #include <rpc/util.h>
 #include <timedata.h>
+#include <txmempool.h>
 #include <util.h>
 #include <utilstrencodings.h>
 #ifdef ENABLE_WALLET
@@ -299,56 +301,280 @@ bool getAddressesFromParams(const UniValue& params, std::vector<CScript> &addres
     return true;
 }
 
+/** Throw unless the address index is enabled and has caught up, so that partial answers are not served */
+static void EnsureAddressIndexSynced()
+{
+    if (!g_addressindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is disabled (-addressindex)");
+    if (!g_addressindex->IsSynced())
+        throw JSONRPCError(RPC_IN_WARMUP, "Address index is syncing, see getaddressindexinfo");
+}
+
+static UniValue AddressOutputToJSON(const std::pair<CAddressKey, CAddressValue>& it)
+{
+    CAddressKey key = it.first;
+    UniValue output(UniValue::VOBJ);
+    output.pushKV("address", key.GetAddr(true));
+    output.pushKV("value", ValueFromAmount(it.second.value));
+    output.pushKV("from", strprintf("[%d] %s:%d", it.second.height, it.first.out.hash.ToString(), it.first.out.n));
+    if (it.second.spend_height == 0) {
+        output.pushKV("to", "unspend");
+    } else {
+        output.pushKV("to", strprintf("[%d] %s:%d", it.second.spend_height, it.second.spend_hash.ToString(), it.second.spend_n));
+    }
+    return output;
+}
+
 UniValue getaddressbalance(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
         throw std::runtime_error(
             "getaddressbalance\n"
-            "\nReturns the balance for an address(es) (requires txindex to be enabled).\n"
+            "\nReturns the outputs received by an address(es) (requires txindex to be enabled).\n"
             "\nArguments:\n"
             "{\n"
             "  \"addresses\"\n"
             "    [\n"
             "      \"address\"  (string) The base58check encoded address\n"
             "      ,...\n"
-            "    ]\n"
+            "    ],\n"
+            "  \"limit\"    (numeric, optional) Return at most this many outputs, newest first\n"
+            "  \"cursor\"   (string, optional) The next_cursor of the previous page\n"
             "}\n"
             "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\"  (string) The address\n"
+            "    \"value\"    (numeric) The output value\n"
+            "    \"from\"     (string) [height] txid:n of the output\n"
+            "    \"to\"       (string) [height] txid:n of the spending input, or \"unspend\"\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nResult with limit:\n"
             "{\n"
-            "  \"balance\"  (string) The current balance in duffs\n"
-            "  \"received\"  (string) The total number of duffs received (including change)\n"
+            "  \"outputs\"      (array) The outputs as above\n"
+            "  \"next_cursor\"  (string) Pass as cursor to get the next page, absent on the last page\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"limit\": 100}'")
             + HelpExampleRpc("getaddressbalance", "{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
         );
 
+    EnsureAddressIndexSynced();
+
     std::vector<CScript> addresses;
     if (!getAddressesFromParams(request.params, addresses)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
+    int64_t nLimit = 0;
+    std::string strCursor;
+    if (request.params[0].isObject()) {
+        const UniValue& limit = find_value(request.params[0].get_obj(), "limit");
+        if (!limit.isNull()) {
+            nLimit = limit.get_int64();
+            if (nLimit <= 0) throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid limit");
+        }
+        const UniValue& cursor = find_value(request.params[0].get_obj(), "cursor");
+        if (!cursor.isNull()) strCursor = cursor.get_str();
+    }
+
+    if (nLimit == 0) {
+        std::vector<std::pair<CAddressKey, CAddressValue>> info;
+        for (auto it : addresses) {
+            if (!pblocktree->ReadAddress(it, info))
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+        UniValue result(UniValue::VARR);
+        for (const auto& it : info) result.push_back(AddressOutputToJSON(it));
+        return result;
+    }
+
+    // Walk the addresses in order, each newest first; the cursor records the address and the last row returned.
+    CAddressIndexKey cursor;
+    uint32_t nScript = 0;
+    if (!strCursor.empty() && (!DecodeAddressCursor(strCursor, cursor, nScript) || nScript >= addresses.size()))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
     std::vector<std::pair<CAddressKey, CAddressValue>> info;
-    for (auto it : addresses) {
-        if (!pblocktree->ReadAddress(it, info))
+    while (nScript < addresses.size() && info.size() < (size_t)nLimit) {
+        if (!pblocktree->ReadAddress(addresses[nScript], cursor, nLimit - info.size(), info))
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        if (cursor.height == 0) nScript++;
+    }
+    UniValue outputs(UniValue::VARR);
+    for (const auto& it : info) outputs.push_back(AddressOutputToJSON(it));
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("outputs", outputs);
+    if (nScript < addresses.size()) result.pushKV("next_cursor", EncodeAddressCursor(cursor, nScript));
+    return result;
+}
+
+UniValue getaddressmempool(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "getaddressmempool\n"
+            "\nReturns the unconfirmed outputs paying to, and inputs spending from, an address(es), oldest first.\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"addresses\"\n"
+            "    [\n"
+            "      \"address\"  (string) The base58check encoded address\n"
+            "      ,...\n"
+            "    ]\n"
+            "}\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\"   (string) The address\n"
+            "    \"txid\"      (string) The unconfirmed transaction\n"
+            "    \"index\"     (numeric) Its output paying to the address, or its input spending from it\n"
+            "    \"value\"     (numeric) The amount received, or minus the amount spent\n"
+            "    \"time\"      (numeric) When the transaction entered the mempool\n"
+            "    \"prevtxid\"  (string) For an input, the transaction of the output it spends\n"
+            "    \"prevout\"   (numeric) For an input, the index of the output it spends\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressmempool", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleRpc("getaddressmempool", "{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
+        );
+
+    if (!g_addressindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is disabled (-addressindex)");
+
+    std::vector<CScript> addresses;
+    if (!getAddressesFromParams(request.params, addresses)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
+
+    std::vector<std::pair<CMempoolAddressKey, CMempoolAddressDelta>> vDeltas;
+    std::map<uint160, std::string> mapAddress;
+    for (const CScript& script : addresses) {
+        const uint160 hashScript = GetAddressScriptHash(script);
+        CTxDestination dest;
+        if (!mapAddress.emplace(hashScript, ExtractDestination(script, dest) ? EncodeDestination(dest) : HexStr(script.begin(), script.end())).second)
+            continue;
+        mempool.getAddressIndex(hashScript, vDeltas);
     }
+    std::stable_sort(vDeltas.begin(), vDeltas.end(), [](const std::pair<CMempoolAddressKey, CMempoolAddressDelta>& a, const std::pair<CMempoolAddressKey, CMempoolAddressDelta>& b) {
+        return a.second.nTime < b.second.nTime;
+    });
 
     UniValue result(UniValue::VARR);
-    for (auto it : info) {
-        UniValue output(UniValue::VOBJ);
-        output.pushKV("address", it.first.GetAddr(true));
-        output.pushKV("value", ValueFromAmount(it.second.value));
-        output.pushKV("from", strprintf("[%d] %s:%d", it.second.height, it.first.out.hash.ToString(), it.first.out.n));
-        if (it.second.spend_height == 0) {
-            output.pushKV("to", "unspend");
-        } else {
-            output.pushKV("to", strprintf("[%d] %s:%d", it.second.spend_height, it.second.spend_hash.ToString(), it.second.spend_n));
+    for (const auto& it : vDeltas) {
+        UniValue delta(UniValue::VOBJ);
+        delta.pushKV("address", mapAddress[it.first.hashScript]);
+        delta.pushKV("txid", it.first.txid.GetHex());
+        delta.pushKV("index", (int64_t)it.first.index);
+        delta.pushKV("value", ValueFromAmount(it.second.amount));
+        delta.pushKV("time", it.second.nTime);
+        if (it.first.fSpend) {
+            delta.pushKV("prevtxid", it.second.prevout.hash.GetHex());
+            delta.pushKV("prevout", (int64_t)it.second.prevout.n);
         }
+        result.push_back(delta);
+    }
+    return result;
+}
+
+UniValue getaddressutxos(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "getaddressutxos\n"
+            "\nReturns the unspent outputs of an address(es), read from the address index.\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"addresses\"\n"
+            "    [\n"
+            "      \"address\"  (string) The base58check encoded address\n"
+            "      ,...\n"
+            "    ],\n"
+            "  \"include_mempool\"  (boolean, optional, default=true) Leave out the outputs spent by mempool transactions\n"
+            "                       and add the unspent outputs of mempool transactions\n"
+            "}\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\"       (string) The address\n"
+            "    \"txid\"          (string) The transaction id\n"
+            "    \"vout\"          (numeric) The output index\n"
+            "    \"value\"         (numeric) The output value\n"
+            "    \"height\"        (numeric) The height of the block with the transaction, 0 for a mempool transaction\n"
+            "    \"scriptPubKey\"  (string) The output script, hex encoded\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"include_mempool\": false}")
+        );
+
+    EnsureAddressIndexSynced();
+
+    std::vector<CScript> addresses;
+    if (!getAddressesFromParams(request.params, addresses)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
+    bool fMempool = true;
+    if (request.params[0].isObject()) {
+        const UniValue& include_mempool = find_value(request.params[0].get_obj(), "include_mempool");
+        if (!include_mempool.isNull()) fMempool = include_mempool.get_bool();
+    }
+
+    std::vector<CAddressUnspent> vUnspent;
+    if (!GetAddressUnspent(addresses, fMempool, vUnspent))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    UniValue result(UniValue::VARR);
+    for (const CAddressUnspent& it : vUnspent) {
+        CTxDestination dest;
+        UniValue output(UniValue::VOBJ);
+        output.pushKV("address", ExtractDestination(it.script, dest) ? EncodeDestination(dest) : "");
+        output.pushKV("txid", it.out.hash.GetHex());
+        output.pushKV("vout", (int64_t)it.out.n);
+        output.pushKV("value", ValueFromAmount(it.value));
+        output.pushKV("height", (int64_t)it.nHeight);
+        output.pushKV("scriptPubKey", HexStr(it.script.begin(), it.script.end()));
         result.push_back(output);
     }
     return result;
 }
 
+UniValue getaddressindexinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getaddressindexinfo\n"
+            "\nReturns the state of the address index, which is built in the background when enabled on an existing node.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\"     (boolean) Whether the address index is maintained (-addressindex)\n"
+            "  \"synced\"      (boolean) Whether it has caught up with the block chain, before which the address queries fail\n"
+            "  \"height\"      (numeric) The height of the last block indexed\n"
+            "  \"bestblock\"   (string) The hash of the last block indexed\n"
+            "  \"progress\"    (numeric) The indexed fraction of the block chain\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressindexinfo", "")
+            + HelpExampleRpc("getaddressindexinfo", "")
+        );
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("enabled", g_addressindex != nullptr);
+    if (!g_addressindex) return result;
+    LOCK(cs_main);
+    const CBlockIndex* pindex = g_addressindex->BestBlock();
+    int nHeight = pindex ? pindex->nHeight : 0;
+    result.pushKV("synced", g_addressindex->IsSynced());
+    result.pushKV("height", nHeight);
+    result.pushKV("bestblock", pindex ? pindex->GetBlockHash().GetHex() : "");
+    result.pushKV("progress", chainActive.Height() > 0 ? std::min(1.0, (double)nHeight / chainActive.Height()) : 1.0);
+    return result;
+}
+
 static UniValue RPCLockedMemoryInfo()
 {
     LockedPool::Stats stats = LockedPoolManager::Instance().stats();
@@ -550,6 +776,9 @@ static const CRPCCommand commands[] =
     { "util",               "verifymessage",          &verifymessage,          {"address","signature","message"} },
     { "util",               "signmessagewithprivkey", &signmessagewithprivkey, {"privkey","message"} },
     { "address",            "getaddressbalance",      &getaddressbalance,      {"addresses"} },
+    { "address",            "getaddressindexinfo",    &getaddressindexinfo,    {} },
+    { "address",            "getaddressmempool",      &getaddressmempool,      {"addresses"} },
+    { "address",            "getaddressutxos",        &getaddressutxos,        {"addresses"} },
 
     /* Not shown in help */
     { "hidden",             "setmocktime",            &setmocktime,            {"timestamp"}},
@@ -20,6 +20,7 @@
 
 static const unsigned int DEFAULT_RPC_SERIALIZE_VERSION = 1;
 
+class CJSONStream;
 class CRPCCommand;
 
 namespace RPCServer
@@ -47,8 +48,11 @@ public:
     std::string URI;
     std::string authUser;
     std::string peerAddr;
+    /** Where a handler with a large result may write it instead of returning it,
+     *  or nullptr. A handler that writes exactly one value returns NullUniValue. */
+    CJSONStream* stream;
 
-    JSONRPCRequest() : id(NullUniValue), params(NullUniValue), fHelp(false) {}
+    JSONRPCRequest() : id(NullUniValue), params(NullUniValue), fHelp(false), stream(nullptr) {}
     void parse(const UniValue& valRequest);
 };
 
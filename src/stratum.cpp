@@ -0,0 +1,756 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <stratum.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <consensus/merkle.h>
+#include <hash.h>
+#include <key_io.h>
+#include <miner.h>
+#include <netbase.h>
+#include <random.h>
+#include <script/standard.h>
+#include <streams.h>
+#include <sync.h>
+#include <timedata.h>
+#include <txmempool.h>
+#include <ui_interface.h>
+#include <util.h>
+#include <utilstrencodings.h>
+#include <validation.h>
+#include <validationinterface.h>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <thread>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/thread.h>
+#include <event2/util.h>
+
+/** Seconds between checks whether the mempool changed enough to hand out a new job */
+static const int STRATUM_JOB_REFRESH = 30;
+/** Jobs kept for late shares; all of them are dropped when the tip moves */
+static const size_t MAX_STRATUM_JOBS = 16;
+/** Longest request line accepted from a miner */
+static const size_t MAX_STRATUM_LINE = 16 * 1024;
+/** Unsent output after which a miner that does not read is dropped */
+static const size_t MAX_STRATUM_SEND_BUFFER = 1024 * 1024;
+static const size_t MAX_STRATUM_CLIENTS = 1024;
+/** Rejected shares, beyond the accepted ones, after which a miner is dropped */
+static const uint64_t MAX_STRATUM_REJECTED = 100;
+
+arith_uint256 StratumTarget(double dDifficulty)
+{
+    arith_uint256 bnDiff1;
+    bnDiff1.SetCompact(0x1d00ffff);
+    // Divide in 1/65536 steps so that fractional difficulties work too.
+    const double dScaled = dDifficulty * 65536;
+    uint64_t nScaled = 1;
+    if (dScaled >= (double)std::numeric_limits<uint64_t>::max())
+        nScaled = std::numeric_limits<uint64_t>::max();
+    else if (dScaled > 1)
+        nScaled = (uint64_t)dScaled;
+    return (bnDiff1 << 16) / arith_uint256(nScaled);
+}
+
+bool CStratumJob::Init(const std::string& idIn, const CBlock& blockIn, int nHeightIn)
+{
+    id = idIn;
+    block = blockIn;
+    nHeight = nHeightIn;
+    setShares.clear();
+
+    bool fNegative, fOverflow;
+    bnTarget.SetCompact(block.nBits, &fNegative, &fOverflow);
+    if (fNegative || fOverflow || bnTarget == 0 || block.vtx.empty())
+        return false;
+
+    // Height first, as BIP34 wants it, then room for both extranonces.
+    const CScript scriptHeight = CScript() << nHeight;
+    const size_t nExtraNonceSize = STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE;
+    CMutableTransaction txCoinbase(*block.vtx[0]);
+    txCoinbase.vin[0].scriptSig = (CScript(scriptHeight) << std::vector<unsigned char>(nExtraNonceSize, 0)) + COINBASE_FLAGS;
+    if (txCoinbase.vin[0].scriptSig.size() > 100)
+        return false;
+    block.vtx[0] = MakeTransactionRef(txCoinbase);
+
+    // Miners hash the coinbase without witness: version, input count, prevout,
+    // script length, height push and the extranonce push opcode come first.
+    std::vector<unsigned char> vchTx;
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS, vchTx, 0, *block.vtx[0]);
+    const size_t nOffset = 4 + 1 + 36 + GetSizeOfCompactSize(txCoinbase.vin[0].scriptSig.size()) + scriptHeight.size() + 1;
+    vchCoinbase1.assign(vchTx.begin(), vchTx.begin() + nOffset);
+    vchCoinbase2.assign(vchTx.begin() + nOffset + nExtraNonceSize, vchTx.end());
+
+    // The coinbase is leaf 0, so its branch is the first node of every level
+    // of the tree built from the other transactions.
+    vMerkleBranch.clear();
+    std::vector<uint256> vLevel;
+    for (size_t i = 1; i < block.vtx.size(); i++)
+        vLevel.push_back(block.vtx[i]->GetHash());
+    while (!vLevel.empty()) {
+        vMerkleBranch.push_back(vLevel[0]);
+        std::vector<uint256> vNext;
+        for (size_t i = 1; i < vLevel.size(); i += 2) {
+            const uint256& right = (i + 1 < vLevel.size()) ? vLevel[i + 1] : vLevel[i];
+            vNext.push_back(Hash(vLevel[i].begin(), vLevel[i].end(), right.begin(), right.end()));
+        }
+        vLevel.swap(vNext);
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return true;
+}
+
+UniValue CStratumJob::NotifyParams(bool fCleanJobs) const
+{
+    // The previous block hash goes out as eight 32-bit words, each byte-swapped.
+    std::vector<unsigned char> vchPrev(block.hashPrevBlock.begin(), block.hashPrevBlock.end());
+    for (size_t i = 0; i < vchPrev.size(); i += 4)
+        std::reverse(vchPrev.begin() + i, vchPrev.begin() + i + 4);
+
+    UniValue branch(UniValue::VARR);
+    for (const uint256& hash : vMerkleBranch)
+        branch.push_back(HexStr(hash.begin(), hash.end()));
+
+    UniValue params(UniValue::VARR);
+    params.push_back(id);
+    params.push_back(HexStr(vchPrev));
+    params.push_back(HexStr(vchCoinbase1));
+    params.push_back(HexStr(vchCoinbase2));
+    params.push_back(branch);
+    params.push_back(strprintf("%08x", (uint32_t)block.nVersion));
+    params.push_back(strprintf("%08x", block.nBits));
+    params.push_back(strprintf("%08x", block.nTime));
+    params.push_back(UniValue(fCleanJobs));
+    return params;
+}
+
+bool CStratumJob::BuildBlock(const std::vector<unsigned char>& vchExtraNonce1, const std::vector<unsigned char>& vchExtraNonce2,
+                             uint32_t nTime, uint32_t nNonce, CBlock& blockOut) const
+{
+    if (vchExtraNonce1.size() != STRATUM_EXTRANONCE1_SIZE || vchExtraNonce2.size() != STRATUM_EXTRANONCE2_SIZE)
+        return false;
+
+    std::vector<unsigned char> vchTx(vchCoinbase1);
+    vchTx.insert(vchTx.end(), vchExtraNonce1.begin(), vchExtraNonce1.end());
+    vchTx.insert(vchTx.end(), vchExtraNonce2.begin(), vchExtraNonce2.end());
+    vchTx.insert(vchTx.end(), vchCoinbase2.begin(), vchCoinbase2.end());
+    CMutableTransaction txCoinbase;
+    try {
+        CDataStream ss(vchTx, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+        ss >> txCoinbase;
+    } catch (const std::exception&) {
+        return false;
+    }
+    // The witness reserved value is not part of what miners get to see.
+    txCoinbase.vin[0].scriptWitness = block.vtx[0]->vin[0].scriptWitness;
+
+    blockOut = block;
+    blockOut.vtx[0] = MakeTransactionRef(std::move(txCoinbase));
+    uint256 hash = blockOut.vtx[0]->GetHash();
+    for (const uint256& step : vMerkleBranch)
+        hash = Hash(hash.begin(), hash.end(), step.begin(), step.end());
+    blockOut.hashMerkleRoot = hash;
+    blockOut.nTime = nTime;
+    blockOut.nNonce = nNonce;
+    return true;
+}
+
+// Stratum server
+
+/** Error codes of the Stratum protocol */
+enum StratumErrorCode
+{
+    STRATUM_OTHER           = 20,
+    STRATUM_JOB_NOT_FOUND   = 21,
+    STRATUM_DUPLICATE_SHARE = 22,
+    STRATUM_LOW_DIFFICULTY  = 23,
+    STRATUM_UNAUTHORIZED    = 24,
+    STRATUM_NOT_SUBSCRIBED  = 25,
+};
+
+struct CStratumClient
+{
+    std::string strPeer;
+    std::vector<unsigned char> vchExtraNonce1;
+    std::string strWorker;
+    bool fSubscribed = false;
+    bool fAuthorized = false;
+    uint64_t nAccepted = 0;
+    uint64_t nRejected = 0;
+};
+
+/**
+ * Everything but UpdatedBlockTip runs on the Stratum event thread. Building
+ * templates and connecting found blocks take cs_main, so they are handed to
+ * the Stratum worker thread, which posts finished jobs back.
+ */
+class CStratumServer : public CValidationInterface
+{
+public:
+    CScript scriptPayout;
+    double dDifficulty;
+    arith_uint256 bnShareTarget;
+    std::map<struct bufferevent*, CStratumClient> mapClients;
+
+    CStratumServer(const CScript& scriptPayoutIn, double dDifficultyIn);
+
+    void AddClient(struct bufferevent* bev, const std::string& strPeer);
+    void RemoveClient(struct bufferevent* bev);
+    /** Handle one request line. Returns false if the connection should be dropped. */
+    bool HandleLine(struct bufferevent* bev, const std::string& strLine);
+    /** Have the worker build a job from the current template, unless one is being built already */
+    void UpdateJob(bool fCleanJobs);
+    /** Take a job built by the worker and push it to all subscribed miners */
+    void InstallJob(std::shared_ptr<CStratumJob> job, bool fCleanJobs, unsigned int nUpdated);
+    /** Hand out a new job if the mempool changed since the last one */
+    void RefreshJob();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+
+private:
+    std::map<uint64_t, std::shared_ptr<CStratumJob>> mapJobs;
+    uint64_t nJobId;
+    uint32_t nNextExtraNonce1;
+    unsigned int nMempoolUpdated;
+    /** A job is being built; further requests are folded into one more build */
+    bool fBuilding;
+    bool fBuildAgain;
+    bool fBuildAgainClean;
+
+    bool Send(struct bufferevent* bev, const UniValue& msg);
+    bool Notify(struct bufferevent* bev, const CStratumJob& job, bool fCleanJobs);
+    bool Submit(CStratumClient& client, const UniValue& params, int& nCode, std::string& strError);
+};
+
+static struct event_base* stratumBase = nullptr;
+static struct evconnlistener* stratumListener = nullptr;
+static struct event* stratumTipEvent = nullptr;
+static struct event* stratumRefreshEvent = nullptr;
+static std::thread stratumThread;
+static std::unique_ptr<CStratumServer> g_stratum;
+
+static CWaitableCriticalSection cs_stratumWork;
+static CConditionVariable stratumWorkCond;
+static std::deque<std::function<void()>> stratumWorkQueue;
+static bool fStratumWorkStop = false;
+static std::thread stratumWorkThread;
+
+/** Run f on the Stratum worker thread */
+static void StratumWork(std::function<void()> f)
+{
+    {
+        WaitableLock lock(cs_stratumWork);
+        stratumWorkQueue.push_back(std::move(f));
+    }
+    stratumWorkCond.notify_one();
+}
+
+static void StratumWorkThread()
+{
+    while (true) {
+        std::function<void()> f;
+        {
+            WaitableLock lock(cs_stratumWork);
+            stratumWorkCond.wait(lock, [] { return fStratumWorkStop || !stratumWorkQueue.empty(); });
+            if (fStratumWorkStop)
+                return;
+            f = std::move(stratumWorkQueue.front());
+            stratumWorkQueue.pop_front();
+        }
+        f();
+    }
+}
+
+static void stratum_post_cb(evutil_socket_t fd, short what, void* arg)
+{
+    std::unique_ptr<std::function<void()>> f(static_cast<std::function<void()>*>(arg));
+    (*f)();
+}
+
+/** Run f on the Stratum event thread */
+static void StratumPost(std::function<void()> f)
+{
+    std::function<void()>* arg = new std::function<void()>(std::move(f));
+    if (event_base_once(stratumBase, -1, EV_TIMEOUT, stratum_post_cb, arg, nullptr) != 0)
+        delete arg;
+}
+
+/** Build a job paying to scriptPayout from a new template, on the worker thread */
+static std::shared_ptr<CStratumJob> BuildStratumJob(const CScript& scriptPayout)
+{
+    if (!Params().MineBlocksOnDemand() && IsInitialBlockDownload())
+        return nullptr;
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    try {
+        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptPayout);
+    } catch (const std::exception& e) {
+        LogPrintf("stratum: unable to create a block template: %s\n", e.what());
+        return nullptr;
+    }
+    if (!pblocktemplate)
+        return nullptr;
+
+    const CBlockIndex* pindexPrev;
+    {
+        LOCK(cs_main);
+        pindexPrev = LookupBlockIndex(pblocktemplate->block.hashPrevBlock);
+    }
+    if (!pindexPrev)
+        return nullptr;
+    std::shared_ptr<CStratumJob> job = std::make_shared<CStratumJob>();
+    if (!job->Init("", pblocktemplate->block, pindexPrev->nHeight + 1)) {
+        LogPrintf("stratum: block template at height %d cannot be handed out\n", pindexPrev->nHeight + 1);
+        return nullptr;
+    }
+    return job;
+}
+
+static UniValue StratumError(int nCode, const std::string& strMessage)
+{
+    UniValue error(UniValue::VARR);
+    error.push_back(nCode);
+    error.push_back(strMessage);
+    error.push_back(NullUniValue);
+    return error;
+}
+
+static UniValue StratumReply(const UniValue& id, const UniValue& result, const UniValue& error)
+{
+    UniValue reply(UniValue::VOBJ);
+    reply.pushKV("id", id);
+    reply.pushKV("result", result);
+    reply.pushKV("error", error);
+    return reply;
+}
+
+static UniValue StratumMessage(const std::string& strMethod, const UniValue& params)
+{
+    UniValue msg(UniValue::VOBJ);
+    msg.pushKV("id", NullUniValue);
+    msg.pushKV("method", strMethod);
+    msg.pushKV("params", params);
+    return msg;
+}
+
+/** Parse a 32-bit field sent as 8 big-endian hex digits */
+static bool ParseHexWord(const UniValue& value, uint32_t& n)
+{
+    if (!value.isStr() || value.get_str().size() != 8 || !IsHex(value.get_str()))
+        return false;
+    n = strtoul(value.get_str().c_str(), nullptr, 16);
+    return true;
+}
+
+CStratumServer::CStratumServer(const CScript& scriptPayoutIn, double dDifficultyIn) :
+    scriptPayout(scriptPayoutIn), dDifficulty(dDifficultyIn), bnShareTarget(StratumTarget(dDifficultyIn)),
+    nJobId(0), nNextExtraNonce1(GetRand(std::numeric_limits<uint32_t>::max())), nMempoolUpdated(0),
+    fBuilding(false), fBuildAgain(false), fBuildAgainClean(false)
+{
+}
+
+void CStratumServer::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    if (!fInitialDownload && stratumTipEvent)
+        event_active(stratumTipEvent, 0, 0);
+}
+
+void CStratumServer::AddClient(struct bufferevent* bev, const std::string& strPeer)
+{
+    CStratumClient& client = mapClients[bev];
+    client.strPeer = strPeer;
+    const uint32_t nExtraNonce1 = nNextExtraNonce1++;
+    for (unsigned int i = 0; i < STRATUM_EXTRANONCE1_SIZE; i++)
+        client.vchExtraNonce1.push_back((nExtraNonce1 >> (8 * (STRATUM_EXTRANONCE1_SIZE - 1 - i))) & 0xff);
+    LogPrint(BCLog::STRATUM, "stratum: connection from %s\n", strPeer);
+}
+
+void CStratumServer::RemoveClient(struct bufferevent* bev)
+{
+    auto it = mapClients.find(bev);
+    if (it != mapClients.end()) {
+        LogPrint(BCLog::STRATUM, "stratum: %s disconnected (%u shares accepted, %u rejected)\n",
+            it->second.strPeer, it->second.nAccepted, it->second.nRejected);
+        mapClients.erase(it);
+    }
+    bufferevent_free(bev);
+}
+
+bool CStratumServer::Send(struct bufferevent* bev, const UniValue& msg)
+{
+    if (evbuffer_get_length(bufferevent_get_output(bev)) > MAX_STRATUM_SEND_BUFFER)
+        return false;
+    const std::string strMsg = msg.write() + "\n";
+    return bufferevent_write(bev, strMsg.data(), strMsg.size()) == 0;
+}
+
+bool CStratumServer::Notify(struct bufferevent* bev, const CStratumJob& job, bool fCleanJobs)
+{
+    return Send(bev, StratumMessage("mining.notify", job.NotifyParams(fCleanJobs)));
+}
+
+void CStratumServer::UpdateJob(bool fCleanJobs)
+{
+    if (fBuilding) {
+        fBuildAgain = true;
+        fBuildAgainClean |= fCleanJobs;
+        return;
+    }
+    fBuilding = true;
+    const CScript script = scriptPayout;
+    StratumWork([script, fCleanJobs] {
+        const unsigned int nUpdated = mempool.GetTransactionsUpdated();
+        std::shared_ptr<CStratumJob> job = BuildStratumJob(script);
+        StratumPost([job, fCleanJobs, nUpdated] { g_stratum->InstallJob(job, fCleanJobs, nUpdated); });
+    });
+}
+
+void CStratumServer::InstallJob(std::shared_ptr<CStratumJob> job, bool fCleanJobs, unsigned int nUpdated)
+{
+    fBuilding = false;
+    if (fBuildAgain) {
+        // The tip or mempool moved while this one was built. After a mempool
+        // change it still goes out, after a new tip it is stale already.
+        const bool fClean = fBuildAgainClean;
+        fBuildAgain = fBuildAgainClean = false;
+        UpdateJob(fClean);
+        if (fClean)
+            return;
+    }
+    if (!job)
+        return;
+    job->id = strprintf("%x", nJobId + 1);
+    nMempoolUpdated = nUpdated;
+
+    // Shares for an older tip could never make a block.
+    if (!mapJobs.empty() && mapJobs.rbegin()->second->block.hashPrevBlock != job->block.hashPrevBlock)
+        fCleanJobs = true;
+    if (fCleanJobs)
+        mapJobs.clear();
+    mapJobs[++nJobId] = job;
+    while (mapJobs.size() > MAX_STRATUM_JOBS)
+        mapJobs.erase(mapJobs.begin());
+
+    LogPrint(BCLog::STRATUM, "stratum: job %s at height %d with %u transactions\n", job->id, job->nHeight, job->block.vtx.size());
+    std::vector<struct bufferevent*> vStalled;
+    for (auto& client : mapClients) {
+        if (client.second.fSubscribed && !Notify(client.first, *job, fCleanJobs))
+            vStalled.push_back(client.first);
+    }
+    for (struct bufferevent* bev : vStalled)
+        RemoveClient(bev);
+}
+
+void CStratumServer::RefreshJob()
+{
+    if (mapJobs.empty() || mempool.GetTransactionsUpdated() != nMempoolUpdated)
+        UpdateJob(false);
+}
+
+bool CStratumServer::Submit(CStratumClient& client, const UniValue& params, int& nCode, std::string& strError)
+{
+    if (!client.fSubscribed) {
+        nCode = STRATUM_NOT_SUBSCRIBED; strError = "Not subscribed";
+        return false;
+    }
+    if (!client.fAuthorized) {
+        nCode = STRATUM_UNAUTHORIZED; strError = "Unauthorized worker";
+        return false;
+    }
+    if (!params.isArray() || params.size() < 5 || !params[1].isStr() || !params[2].isStr()) {
+        nCode = STRATUM_OTHER; strError = "Invalid parameters";
+        return false;
+    }
+
+    uint64_t nId = 0;
+    std::shared_ptr<CStratumJob> job;
+    if (IsHexNumber(params[1].get_str()) && params[1].get_str().size() <= 16) {
+        nId = strtoull(params[1].get_str().c_str(), nullptr, 16);
+        auto it = mapJobs.find(nId);
+        if (it != mapJobs.end()) job = it->second;
+    }
+    if (!job) {
+        nCode = STRATUM_JOB_NOT_FOUND; strError = "Job not found";
+        return false;
+    }
+
+    std::vector<unsigned char> vchExtraNonce2 = ParseHex(params[2].get_str());
+    uint32_t nTime, nNonce;
+    if (vchExtraNonce2.size() != STRATUM_EXTRANONCE2_SIZE || !ParseHexWord(params[3], nTime) || !ParseHexWord(params[4], nNonce)) {
+        nCode = STRATUM_OTHER; strError = "Invalid parameters";
+        return false;
+    }
+    if (nTime < job->block.nTime || nTime > GetAdjustedTime() + MAX_FUTURE_BLOCK_TIME) {
+        nCode = STRATUM_OTHER; strError = "Time out of range";
+        return false;
+    }
+
+    CBlock block;
+    if (!job->BuildBlock(client.vchExtraNonce1, vchExtraNonce2, nTime, nNonce, block)) {
+        nCode = STRATUM_OTHER; strError = "Invalid coinbase";
+        return false;
+    }
+    const uint256 hash = block.GetHash();
+    if (job->setShares.count(hash)) {
+        nCode = STRATUM_DUPLICATE_SHARE; strError = "Duplicate share";
+        return false;
+    }
+
+    const arith_uint256 hashPoW = UintToArith256(block.GetPoWHash(job->nHeight, Params().GetConsensus()));
+    if (hashPoW > bnShareTarget && hashPoW > job->bnTarget) {
+        nCode = STRATUM_LOW_DIFFICULTY; strError = "Low difficulty share";
+        return false;
+    }
+    // Only shares that carry work are remembered, so junk cannot grow the set.
+    job->setShares.insert(hash);
+
+    if (hashPoW <= job->bnTarget) {
+        LogPrintf("stratum: block %s at height %d found by %s\n", hash.ToString(), job->nHeight, client.strWorker);
+        // Connected on the worker; the new tip then brings the next job.
+        std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(block);
+        StratumWork([shared_pblock] {
+            if (!ProcessNewBlock(Params(), shared_pblock, true, nullptr))
+                LogPrintf("stratum: block %s not accepted\n", shared_pblock->GetHash().ToString());
+        });
+    }
+    return true;
+}
+
+bool CStratumServer::HandleLine(struct bufferevent* bev, const std::string& strLine)
+{
+    auto it = mapClients.find(bev);
+    if (it == mapClients.end())
+        return false;
+    CStratumClient& client = it->second;
+
+    UniValue request;
+    if (strLine.find_first_not_of(" \t\r") == std::string::npos)
+        return true;
+    if (!request.read(strLine) || !request.isObject() || !find_value(request, "method").isStr()) {
+        LogPrint(BCLog::STRATUM, "stratum: malformed request from %s\n", client.strPeer);
+        return false;
+    }
+    const UniValue& id = find_value(request, "id");
+    const std::string& strMethod = find_value(request, "method").get_str();
+    const UniValue& params = find_value(request, "params");
+
+    if (strMethod == "mining.subscribe") {
+        UniValue subscription(UniValue::VARR);
+        subscription.push_back("mining.notify");
+        subscription.push_back(HexStr(client.vchExtraNonce1));
+        UniValue subscriptions(UniValue::VARR);
+        subscriptions.push_back(subscription);
+        UniValue result(UniValue::VARR);
+        result.push_back(subscriptions);
+        result.push_back(HexStr(client.vchExtraNonce1));
+        result.push_back((int)STRATUM_EXTRANONCE2_SIZE);
+        client.fSubscribed = true;
+        if (!Send(bev, StratumReply(id, result, NullUniValue)))
+            return false;
+
+        UniValue difficulty(UniValue::VARR);
+        difficulty.push_back(dDifficulty);
+        if (!Send(bev, StratumMessage("mining.set_difficulty", difficulty)))
+            return false;
+        return mapJobs.empty() || Notify(bev, *mapJobs.rbegin()->second, true);
+    }
+    if (strMethod == "mining.authorize") {
+        // Blocks always pay to -stratumaddress; the worker name is only used in the log.
+        client.strWorker = (params.isArray() && params.size() > 0 && params[0].isStr()) ? params[0].get_str() : "";
+        client.fAuthorized = true;
+        LogPrint(BCLog::STRATUM, "stratum: %s authorized as %s\n", client.strPeer, client.strWorker);
+        return Send(bev, StratumReply(id, true, NullUniValue));
+    }
+    if (strMethod == "mining.submit") {
+        int nCode = 0;
+        std::string strError;
+        if (Submit(client, params, nCode, strError)) {
+            client.nAccepted++;
+            return Send(bev, StratumReply(id, true, NullUniValue));
+        }
+        client.nRejected++;
+        LogPrint(BCLog::STRATUM, "stratum: share from %s rejected: %s\n", client.strWorker, strError);
+        if (client.nRejected > client.nAccepted + MAX_STRATUM_REJECTED) {
+            LogPrint(BCLog::STRATUM, "stratum: too many rejected shares from %s, disconnecting\n", client.strPeer);
+            return false;
+        }
+        return Send(bev, StratumReply(id, false, StratumError(nCode, strError)));
+    }
+    if (strMethod == "mining.extranonce.subscribe") {
+        // The extranonce of a connection never changes, so there is nothing to announce.
+        return Send(bev, StratumReply(id, true, NullUniValue));
+    }
+    return Send(bev, StratumReply(id, NullUniValue, StratumError(STRATUM_OTHER, "Method not found")));
+}
+
+static void stratum_read_cb(struct bufferevent* bev, void* ctx)
+{
+    struct evbuffer* input = bufferevent_get_input(bev);
+    size_t n_read_out = 0;
+    char* line;
+    while ((line = evbuffer_readln(input, &n_read_out, EVBUFFER_EOL_CRLF)) != nullptr) {
+        std::string strLine(line, n_read_out);
+        free(line);
+        if (!g_stratum->HandleLine(bev, strLine)) {
+            g_stratum->RemoveClient(bev);
+            return;
+        }
+    }
+    if (evbuffer_get_length(input) > MAX_STRATUM_LINE) {
+        LogPrint(BCLog::STRATUM, "stratum: request line too long, disconnecting\n");
+        g_stratum->RemoveClient(bev);
+    }
+}
+
+static void stratum_event_cb(struct bufferevent* bev, short what, void* ctx)
+{
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+        g_stratum->RemoveClient(bev);
+}
+
+static void stratum_accept_cb(struct evconnlistener* listener, evutil_socket_t fd, struct sockaddr* addr, int socklen, void* ctx)
+{
+    CService peer;
+    peer.SetSockAddr(addr);
+    if (g_stratum->mapClients.size() >= MAX_STRATUM_CLIENTS) {
+        LogPrint(BCLog::STRATUM, "stratum: too many connections, refusing %s\n", peer.ToString());
+        evutil_closesocket(fd);
+        return;
+    }
+    struct bufferevent* bev = bufferevent_socket_new(stratumBase, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (!bev) {
+        evutil_closesocket(fd);
+        return;
+    }
+    g_stratum->AddClient(bev, peer.ToString());
+    bufferevent_setcb(bev, stratum_read_cb, nullptr, stratum_event_cb, nullptr);
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
+}
+
+static void stratum_tip_cb(evutil_socket_t fd, short what, void* ctx)
+{
+    g_stratum->UpdateJob(true);
+}
+
+static void stratum_refresh_cb(evutil_socket_t fd, short what, void* ctx)
+{
+    g_stratum->RefreshJob();
+}
+
+static void StratumThread()
+{
+    event_base_dispatch(stratumBase);
+}
+
+static void FreeStratum()
+{
+    if (g_stratum) {
+        for (auto& client : g_stratum->mapClients)
+            bufferevent_free(client.first);
+        g_stratum->mapClients.clear();
+    }
+    if (stratumListener) evconnlistener_free(stratumListener);
+    if (stratumTipEvent) event_free(stratumTipEvent);
+    if (stratumRefreshEvent) event_free(stratumRefreshEvent);
+    stratumListener = nullptr;
+    stratumTipEvent = nullptr;
+    stratumRefreshEvent = nullptr;
+    g_stratum.reset();
+    if (stratumBase) event_base_free(stratumBase);
+    stratumBase = nullptr;
+}
+
+bool StartStratum()
+{
+    assert(!stratumBase);
+    const std::string strAddress = gArgs.GetArg("-stratumaddress", "");
+    const CTxDestination dest = DecodeDestination(strAddress);
+    if (!IsValidDestination(dest))
+        return InitError(strprintf(_("Invalid -stratumaddress: '%s'"), strAddress));
+
+    double dDifficulty = DEFAULT_STRATUM_DIFFICULTY;
+    if (gArgs.IsArgSet("-stratumdifficulty") && (!ParseDouble(gArgs.GetArg("-stratumdifficulty", ""), &dDifficulty) || !(dDifficulty > 0)))
+        return InitError(strprintf(_("Invalid -stratumdifficulty: '%s'"), gArgs.GetArg("-stratumdifficulty", "")));
+
+    const std::string strBind = gArgs.GetArg("-stratumbind", "127.0.0.1");
+    CService bind;
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    if (!Lookup(strBind.c_str(), bind, gArgs.GetArg("-stratumport", DEFAULT_STRATUM_PORT), false) ||
+            !bind.GetSockAddr((struct sockaddr*)&sockaddr, &len))
+        return InitError(strprintf(_("Invalid -stratumbind address: '%s'"), strBind));
+
+#ifdef WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif
+    stratumBase = event_base_new();
+    if (!stratumBase)
+        return InitError(_("Unable to create the Stratum event base"));
+    g_stratum.reset(new CStratumServer(GetScriptForDestination(dest), dDifficulty));
+    stratumListener = evconnlistener_new_bind(stratumBase, stratum_accept_cb, nullptr, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE,
+        -1, (struct sockaddr*)&sockaddr, len);
+    if (!stratumListener) {
+        FreeStratum();
+        return InitError(strprintf(_("Unable to bind Stratum server to %s"), bind.ToString()));
+    }
+    stratumTipEvent = event_new(stratumBase, -1, 0, stratum_tip_cb, nullptr);
+    stratumRefreshEvent = event_new(stratumBase, -1, EV_PERSIST, stratum_refresh_cb, nullptr);
+    struct timeval tv = {STRATUM_JOB_REFRESH, 0};
+    event_add(stratumRefreshEvent, &tv);
+    // First job right away; later ones follow the tip.
+    event_active(stratumTipEvent, 0, 0);
+    RegisterValidationInterface(g_stratum.get());
+
+    LogPrintf("Stratum server listening on %s, paying to %s\n", bind.ToString(), strAddress);
+    fStratumWorkStop = false;
+    stratumWorkThread = std::thread(std::bind(&TraceThread<void (*)()>, "stratumwork", &StratumWorkThread));
+    stratumThread = std::thread(std::bind(&TraceThread<void (*)()>, "stratum", &StratumThread));
+    return true;
+}
+
+static void StopStratumWork()
+{
+    {
+        WaitableLock lock(cs_stratumWork);
+        fStratumWorkStop = true;
+        stratumWorkQueue.clear();
+    }
+    stratumWorkCond.notify_all();
+}
+
+void InterruptStratum()
+{
+    if (stratumBase) {
+        LogPrint(BCLog::STRATUM, "stratum: Thread interrupt\n");
+        StopStratumWork();
+        event_base_loopbreak(stratumBase);
+    }
+}
+
+void StopStratum()
+{
+    if (stratumBase) {
+        UnregisterValidationInterface(g_stratum.get());
+        StopStratumWork();
+        if (stratumWorkThread.joinable())
+            stratumWorkThread.join();
+        event_base_loopbreak(stratumBase);
+        if (stratumThread.joinable())
+            stratumThread.join();
+        FreeStratum();
+    }
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/**
+ * Built-in Stratum work server for external PoW miners.
+ */
+#ifndef BITCOIN_STRATUM_H
+#define BITCOIN_STRATUM_H
+
+#include <arith_uint256.h>
+#include <primitives/block.h>
+#include <uint256.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+static const bool DEFAULT_STRATUM_ENABLE = false;
+static const unsigned short DEFAULT_STRATUM_PORT = 3333;
+static const double DEFAULT_STRATUM_DIFFICULTY = 1.0;
+/** Bytes of the coinbase extranonce assigned by the server per connection */
+static const unsigned int STRATUM_EXTRANONCE1_SIZE = 4;
+/** Bytes of the coinbase extranonce rolled by the miner */
+static const unsigned int STRATUM_EXTRANONCE2_SIZE = 4;
+
+/** Share target for a Stratum difficulty, difficulty 1 being 0x00000000ffff0000...0 */
+arith_uint256 StratumTarget(double dDifficulty);
+
+/**
+ * A block template cut up the way mining.notify hands it out: the coinbase
+ * split around the extranonce, and the merkle branch that links the
+ * coinbase to the merkle root.
+ */
+class CStratumJob
+{
+public:
+    std::string id;
+    /** Template, with a zero extranonce in the coinbase */
+    CBlock block;
+    int nHeight;
+    arith_uint256 bnTarget;
+    std::vector<unsigned char> vchCoinbase1;
+    std::vector<unsigned char> vchCoinbase2;
+    std::vector<uint256> vMerkleBranch;
+    /** Hashes of the headers already submitted for this job */
+    std::set<uint256> setShares;
+
+    CStratumJob() : nHeight(0) {}
+
+    /** Take over a template from BlockAssembler. Returns false if its coinbase cannot carry the extranonce. */
+    bool Init(const std::string& idIn, const CBlock& blockIn, int nHeightIn);
+    /** Parameters of the mining.notify message for this job */
+    UniValue NotifyParams(bool fCleanJobs) const;
+    /** Rebuild the block a miner solved from the extranonces, time and nonce it worked with */
+    bool BuildBlock(const std::vector<unsigned char>& vchExtraNonce1, const std::vector<unsigned char>& vchExtraNonce2,
+                    uint32_t nTime, uint32_t nNonce, CBlock& blockOut) const;
+};
+
+/** Start the Stratum server on -stratumbind/-stratumport, paying to -stratumaddress */
+bool StartStratum();
+void InterruptStratum();
+void StopStratum();
+
+#endif // BITCOIN_STRATUM_H
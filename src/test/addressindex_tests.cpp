@@ -0,0 +1,78 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <addressindex.h>
+#include <chainparams.h>
+#include <key_io.h>
+#include <rpc/server.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+#include <validation.h>
+
+#include <univalue.h>
+
+#include <boost/test/unit_test.hpp>
+
+extern UniValue CallRPC(std::string args);
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+BOOST_FIXTURE_TEST_CASE(addressindex_rebuild_and_handover, TestChain100Setup)
+{
+    const CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const std::string strAddress = EncodeDestination(coinbaseKey.GetPubKey().GetID());
+    std::vector<std::pair<CAddressKey, CAddressValue>> vRows;
+
+    // The chain was connected without an index: nothing is in it yet.
+    BOOST_CHECK(pblocktree->ReadAddressUnspent(scriptCoinbase, vRows));
+    BOOST_CHECK(vRows.empty());
+
+    // Built from the genesis block, as on a node that just enabled -addressindex.
+    g_addressindex.reset(new CAddressIndexBuilder(nullptr));
+    BOOST_CHECK(!g_addressindex->IsSynced());
+
+    // Queries refuse to answer from the partial index.
+    BOOST_CHECK_THROW(CallRPC("getaddressutxos " + strAddress), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("getaddressbalance " + strAddress), std::runtime_error);
+    BOOST_CHECK_NO_THROW(CallRPC("getaddressmempool " + strAddress));
+
+    // Returns once it has caught up and handed over to ConnectTip.
+    g_addressindex->ThreadSync(Params());
+    BOOST_CHECK(g_addressindex->IsSynced());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(g_addressindex->BestBlock() == chainActive.Tip());
+    }
+    BOOST_CHECK(pblocktree->ReadAddressUnspent(scriptCoinbase, vRows));
+    BOOST_CHECK_EQUAL(vRows.size(), m_coinbase_txns.size());
+    BOOST_CHECK_NO_THROW(CallRPC("getaddressutxos " + strAddress));
+
+    // After the handover new blocks are indexed as they are connected.
+    std::vector<CMutableTransaction> noTxns;
+    const CBlock block = CreateAndProcessBlock(noTxns, scriptCoinbase);
+    vRows.clear();
+    BOOST_CHECK(pblocktree->ReadAddressUnspent(scriptCoinbase, vRows));
+    BOOST_CHECK_EQUAL(vRows.size(), m_coinbase_txns.size() + 1);
+    bool fFound = false;
+    for (const auto& it : vRows) {
+        if (it.first.out == COutPoint(block.vtx[0]->GetHash(), 0)) fFound = true;
+    }
+    BOOST_CHECK(fFound);
+
+    // getaddressindexinfo follows the tip after the handover.
+    UniValue info = CallRPC("getaddressindexinfo");
+    BOOST_CHECK(find_value(info.get_obj(), "synced").get_bool());
+    BOOST_CHECK_EQUAL(find_value(info.get_obj(), "bestblock").get_str(), block.GetHash().GetHex());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(find_value(info.get_obj(), "height").get_int(), chainActive.Height());
+        BOOST_CHECK(g_addressindex->BestBlock() == chainActive.Tip());
+    }
+    BOOST_CHECK_EQUAL(find_value(info.get_obj(), "progress").get_real(), 1.0);
+
+    g_addressindex.reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,7 @@
 #include <test/test_bitcoin.h>
 #include <validation.h>
 #include <consensus/validation.h>
+#include <txdb.h>
 
 #include <vector>
 #include <map>
@@ -855,4 +856,160 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(address_index_summary)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CScript script = CScript() << OP_DUP << OP_HASH160 << ToByteVector(InsecureRand256()) << OP_EQUALVERIFY << OP_CHECKSIG;
+    COutPoint out1(InsecureRand256(), 0), out2(InsecureRand256(), 1);
+
+    // Receive two outputs, the second one spent in the same batch.
+    CAddressValue spent(5 * COIN, 11);
+    spent.addSpend(InsecureRand256(), 0, 11);
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>> vec;
+    vec.emplace_back(CAddressIndexKey(script, 10, out1), CAddressValue(3 * COIN, 10));
+    vec.emplace_back(CAddressIndexKey(script, 11, out2), CAddressValue(5 * COIN, 11));
+    vec.emplace_back(CAddressIndexKey(script, 11, out2), spent);
+    BOOST_CHECK(db.WriteAddress(vec));
+
+    CAddressSummary summary;
+    BOOST_CHECK(db.ReadAddressSummary(script, summary));
+    BOOST_CHECK_EQUAL(summary.received, 8 * COIN);
+    BOOST_CHECK_EQUAL(summary.sent, 5 * COIN);
+    BOOST_CHECK_EQUAL(summary.GetBalance(), 3 * COIN);
+    BOOST_CHECK_EQUAL(summary.nReceived, 2U);
+    BOOST_CHECK_EQUAL(summary.nSent, 1U);
+
+    std::vector<std::pair<CAddressKey, CAddressValue>> info;
+    BOOST_CHECK(db.ReadAddress(script, info));
+    BOOST_CHECK_EQUAL(info.size(), 2U);
+    BOOST_CHECK(info[0].first.out == out1 && info[1].first.out == out2);
+    BOOST_CHECK(info[0].first.script == script);
+
+    // Undo both: the summary row goes away with the last output.
+    vec.clear();
+    vec.emplace_back(CAddressIndexKey(script, 11, out2), CAddressValue());
+    vec.emplace_back(CAddressIndexKey(script, 10, out1), CAddressValue());
+    BOOST_CHECK(db.WriteAddress(vec));
+    BOOST_CHECK(db.ReadAddressSummary(script, summary));
+    BOOST_CHECK(summary.IsNull());
+    info.clear();
+    BOOST_CHECK(db.ReadAddress(script, info));
+    BOOST_CHECK(info.empty());
+}
+
+BOOST_AUTO_TEST_CASE(address_index_cursor)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CScript script = CScript() << OP_DUP << OP_HASH160 << ToByteVector(InsecureRand256()) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CScript other = CScript() << OP_DUP << OP_HASH160 << ToByteVector(InsecureRand256()) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>> vec;
+    for (int i = 1; i <= 5; i++) {
+        vec.emplace_back(CAddressIndexKey(script, i, COutPoint(InsecureRand256(), i)), CAddressValue(i * COIN, i));
+        vec.emplace_back(CAddressIndexKey(other, i, COutPoint(InsecureRand256(), i)), CAddressValue(i * COIN, i));
+    }
+    BOOST_CHECK(db.WriteAddress(vec));
+
+    // Pages of two, newest first, never leaking rows of the other script.
+    CAddressIndexKey cursor;
+    std::vector<std::pair<CAddressKey, CAddressValue>> info;
+    int nPages = 0;
+    do {
+        BOOST_CHECK(db.ReadAddress(script, cursor, 2, info));
+        nPages++;
+    } while (cursor.height != 0 && nPages < 10);
+    BOOST_CHECK_EQUAL(nPages, 3);
+    BOOST_CHECK_EQUAL(info.size(), 5U);
+    for (size_t i = 0; i < info.size(); i++) {
+        BOOST_CHECK_EQUAL(info[i].second.height, (uint32_t)(5 - i));
+        BOOST_CHECK(info[i].first.script == script);
+    }
+
+    // The cursor survives its text form.
+    CAddressIndexKey key(script, 3, COutPoint(InsecureRand256(), 7)), decoded;
+    uint32_t nScript = 0;
+    BOOST_CHECK(DecodeAddressCursor(EncodeAddressCursor(key, 4), decoded, nScript));
+    BOOST_CHECK(decoded.height == key.height && decoded.out == key.out && nScript == 4);
+    BOOST_CHECK(!DecodeAddressCursor("zz", decoded, nScript));
+}
+
+BOOST_AUTO_TEST_CASE(address_index_cache)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CScript script = CScript() << OP_DUP << OP_HASH160 << ToByteVector(InsecureRand256()) << OP_EQUALVERIFY << OP_CHECKSIG;
+    COutPoint out1(InsecureRand256(), 0), out2(InsecureRand256(), 1), out3(InsecureRand256(), 300);
+
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>> vec;
+    vec.emplace_back(CAddressIndexKey(script, 10, out1), CAddressValue(3 * COIN, 10));
+    vec.emplace_back(CAddressIndexKey(script, 11, out2), CAddressValue(5 * COIN, 11));
+    BOOST_CHECK(db.WriteAddress(vec));
+
+    // Cached rows shadow the database before any flush: one spent, one erased, one new.
+    CAddressValue spent(3 * COIN, 10);
+    spent.addSpend(InsecureRand256(), 0, 12);
+    vec.clear();
+    vec.emplace_back(CAddressIndexKey(script, 10, out1), spent);
+    vec.emplace_back(CAddressIndexKey(script, 11, out2), CAddressValue());
+    vec.emplace_back(CAddressIndexKey(script, 12, out3), CAddressValue(7 * COIN, 12));
+    db.CacheAddress(vec);
+    BOOST_CHECK(db.AddressCacheUsage() > 0);
+
+    for (int flushed = 0; flushed < 2; flushed++) {
+        CAddressSummary summary;
+        BOOST_CHECK(db.ReadAddressSummary(script, summary));
+        BOOST_CHECK_EQUAL(summary.received, 10 * COIN);
+        BOOST_CHECK_EQUAL(summary.sent, 3 * COIN);
+        BOOST_CHECK_EQUAL(summary.nReceived, 2U);
+
+        std::vector<std::pair<CAddressKey, CAddressValue>> info;
+        BOOST_CHECK(db.ReadAddress(script, info));
+        BOOST_CHECK_EQUAL(info.size(), 2U);
+        BOOST_CHECK(info[0].first.out == out1 && info[0].second.spend_height == 12 && info[1].first.out == out3);
+
+        info.clear();
+        CAddressIndexKey cursor;
+        BOOST_CHECK(db.ReadAddress(script, cursor, 1, info));
+        BOOST_CHECK(info.size() == 1 && info[0].first.out == out3 && cursor.height != 0);
+        BOOST_CHECK(db.ReadAddress(script, cursor, 1, info));
+        BOOST_CHECK(info.size() == 2 && info[1].first.out == out1 && cursor.height == 0);
+
+        uint256 hashBlock = InsecureRand256(), hashBest;
+        BOOST_CHECK(db.FlushAddress(hashBlock));
+        BOOST_CHECK_EQUAL(db.AddressCacheUsage(), 0U);
+        BOOST_CHECK(db.ReadAddressBestBlock(hashBest) && hashBest == hashBlock);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(address_index_unspent)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CScript script = CScript() << OP_DUP << OP_HASH160 << ToByteVector(InsecureRand256()) << OP_EQUALVERIFY << OP_CHECKSIG;
+    COutPoint out1(InsecureRand256(), 0), out2(InsecureRand256(), 1), out3(InsecureRand256(), 2), out4(InsecureRand256(), 3);
+
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>> vec;
+    CAddressValue spent(2 * COIN, 11);
+    spent.addSpend(InsecureRand256(), 0, 12);
+    vec.emplace_back(CAddressIndexKey(script, 10, out1), CAddressValue(1 * COIN, 10));
+    vec.emplace_back(CAddressIndexKey(script, 11, out2), spent);
+    vec.emplace_back(CAddressIndexKey(script, 12, out3), CAddressValue(3 * COIN, 12));
+    BOOST_CHECK(db.WriteAddress(vec));
+
+    // A cached spend hides a database row, a cached output adds one.
+    spent = CAddressValue(3 * COIN, 12);
+    spent.addSpend(InsecureRand256(), 1, 13);
+    vec.clear();
+    vec.emplace_back(CAddressIndexKey(script, 12, out3), spent);
+    vec.emplace_back(CAddressIndexKey(script, 13, out4), CAddressValue(4 * COIN, 13));
+    db.CacheAddress(vec);
+
+    for (int flushed = 0; flushed < 2; flushed++) {
+        std::vector<std::pair<CAddressKey, CAddressValue>> info;
+        BOOST_CHECK(db.ReadAddressUnspent(script, info));
+        BOOST_CHECK_EQUAL(info.size(), 2U);
+        BOOST_CHECK(info[0].first.out == out1 && info[0].second.value == 1 * COIN);
+        BOOST_CHECK(info[1].first.out == out4 && info[1].second.height == 13);
+        BOOST_CHECK(db.FlushAddress(InsecureRand256()));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
 #include <crypto/sha512.h>
+#include <crypto/Lyra2Z.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
 #include <random.h>
@@ -562,4 +563,41 @@ BOOST_AUTO_TEST_CASE(sha256d64)
     }
 }
 
+BOOST_AUTO_TEST_CASE(lyra2z_testvectors)
+{
+    unsigned char in[80];
+    uint256 out;
+    memset(in, 0, sizeof(in));
+    lyra2z_hash((const char*)in, (char*)out.begin());
+    BOOST_CHECK_EQUAL(HexStr(out.begin(), out.end()), "9b63bf262ec6f678d73e101f57dadcfe07b6d1f01c2b6ebfbc84ed3fa2be947d");
+    for (int i = 0; i < 80; ++i) in[i] = i;
+    lyra2z_hash((const char*)in, (char*)out.begin());
+    BOOST_CHECK_EQUAL(HexStr(out.begin(), out.end()), "6b0ded5afb3b27cf0e601243ffd9b37ee65331a2d46c7add2a6a826958ab1c0b");
+
+    // The detected core must agree with the portable one, with and without a caller-owned scratchpad.
+    char scratchpad[LYRA2Z_SCRATCHPAD_SIZE];
+    for (int i = 0; i < 32; ++i) {
+        uint256 out1, out2;
+        for (int j = 0; j < 80; ++j) in[j] = InsecureRandBits(8);
+        lyra2z_core_fn detected = lyra2z_core_detected;
+        lyra2z_core_detected = &lyra2z_core_generic;
+        lyra2z_hash((const char*)in, (char*)out1.begin());
+        lyra2z_core_detected = detected;
+        lyra2z_hash_sp((const char*)in, (char*)out2.begin(), scratchpad);
+        BOOST_CHECK(out1 == out2);
+    }
+
+    // Batched hashing must match one-at-a-time hashing for every batch length, odd ones included.
+    std::vector<unsigned char> batch(80 * 9);
+    std::vector<uint256> many(9);
+    for (size_t count = 1; count <= 9; ++count) {
+        for (size_t j = 0; j < 80 * count; ++j) batch[j] = InsecureRandBits(8);
+        lyra2z_hash_many((const char*)batch.data(), (char*)many[0].begin(), count);
+        for (size_t k = 0; k < count; ++k) {
+            lyra2z_hash((const char*)batch.data() + 80 * k, (char*)out.begin());
+            BOOST_CHECK(out == many[k]);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
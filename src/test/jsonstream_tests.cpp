@@ -0,0 +1,77 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <jsonstream.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(jsonstream_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(jsonstream_matches_write)
+{
+    UniValue inner(UniValue::VOBJ);
+    inner.pushKV("n", 1);
+    inner.pushKV("s", "quote \" and \\ backslash");
+    UniValue list(UniValue::VARR);
+    list.push_back(inner);
+    list.push_back(NullUniValue);
+    list.push_back(UniValue(UniValue::VARR));
+    UniValue doc(UniValue::VOBJ);
+    doc.pushKV("empty", UniValue(UniValue::VOBJ));
+    doc.pushKV("list", list);
+    doc.pushKV("key \"escaped\"", true);
+
+    // Chunks of a few bytes, so the document is cut everywhere.
+    std::vector<std::string> chunks;
+    CJSONStream stream([&chunks](const std::string& chunk) { chunks.push_back(chunk); }, 4);
+    stream.BeginObject();
+    stream.Key("empty");
+    stream.BeginObject();
+    stream.EndObject();
+    stream.Key("list");
+    stream.BeginArray();
+    stream.BeginObject();
+    stream.Pair("n", 1);
+    stream.Pair("s", "quote \" and \\ backslash");
+    stream.EndObject();
+    stream.Value(NullUniValue);
+    stream.Value(UniValue(UniValue::VARR));
+    stream.EndArray();
+    BOOST_CHECK_EQUAL(stream.Depth(), 1U);
+    stream.Key("key \"escaped\"");
+    BOOST_CHECK(stream.AwaitingValue());
+    stream.Value(true);
+    BOOST_CHECK(!stream.AwaitingValue());
+    stream.EndObject();
+    BOOST_CHECK_EQUAL(stream.Depth(), 0U);
+    stream.Flush();
+
+    std::string out;
+    for (const std::string& chunk : chunks) {
+        BOOST_CHECK(!chunk.empty());
+        out += chunk;
+    }
+    BOOST_CHECK(chunks.size() > 1);
+    BOOST_CHECK_EQUAL(out, doc.write());
+}
+
+BOOST_AUTO_TEST_CASE(jsonstream_buffers_small_documents)
+{
+    size_t nCalls = 0;
+    std::string out;
+    CJSONStream stream([&](const std::string& chunk) { nCalls++; out += chunk; });
+    stream.BeginArray();
+    for (int i = 0; i < 100; i++) stream.Value(i);
+    stream.EndArray();
+    BOOST_CHECK_EQUAL(nCalls, 0U);
+    stream.Flush();
+    stream.Flush();
+    BOOST_CHECK_EQUAL(nCalls, 1U);
+    BOOST_CHECK_EQUAL(out.front(), '[');
+    BOOST_CHECK_EQUAL(out.back(), ']');
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,51 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <lrucache.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(lrucache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(lrucache_test)
+{
+    lrucache<int, int> cache(3);
+    BOOST_CHECK_EQUAL(cache.max_size(), 3U);
+    for (int i = 0; i < 3; i++) cache.insert(i, i * 10);
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+
+    // Reading 0 makes 1 the least recently used, so it goes first.
+    int value = 0;
+    BOOST_CHECK(cache.get(0, value) && value == 0);
+    cache.insert(3, 30);
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+    BOOST_CHECK(!cache.get(1, value));
+    BOOST_CHECK(cache.get(0, value) && value == 0);
+    BOOST_CHECK(cache.get(2, value) && value == 20);
+    BOOST_CHECK(cache.get(3, value) && value == 30);
+
+    // Overwriting refreshes the entry instead of adding one.
+    cache.insert(0, 5);
+    cache.insert(4, 40);
+    BOOST_CHECK(cache.get(0, value) && value == 5);
+    BOOST_CHECK(!cache.get(2, value));
+
+    cache.erase(0);
+    BOOST_CHECK(!cache.get(0, value));
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+
+    // 3 was read last, so 4 is the oldest.
+    int key = 0;
+    BOOST_CHECK(cache.get(3, value));
+    BOOST_CHECK(cache.pop_oldest(key, value) && key == 4 && value == 40);
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+    BOOST_CHECK(!cache.get(4, value));
+    cache.clear();
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+    BOOST_CHECK(!cache.pop_oldest(key, value));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
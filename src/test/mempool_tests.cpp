@@ -5,6 +5,7 @@
 #include <policy/policy.h>
 #include <txmempool.h>
 #include <util.h>
+#include <validation.h>
 
 #include <test/test_bitcoin.h>
 
@@ -749,4 +750,77 @@ BOOST_AUTO_TEST_CASE(MempoolAncestryTests)
     BOOST_CHECK_EQUAL(descendants, 6ULL);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAddressIndexTest)
+{
+    TestMemPoolEntryHelper entry;
+    const CScript scriptA = CScript() << OP_1 << OP_EQUAL;
+    const CScript scriptB = CScript() << OP_2 << OP_EQUAL;
+    const uint160 hashA = GetAddressScriptHash(scriptA);
+    const uint160 hashB = GetAddressScriptHash(scriptB);
+
+    // The parent spends an output unknown to the chain state, so only its outputs are indexed.
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    txParent.vout.resize(3);
+    txParent.vout[0].scriptPubKey = scriptA;
+    txParent.vout[0].nValue = 5000;
+    txParent.vout[1].scriptPubKey = scriptB;
+    txParent.vout[1].nValue = 3000;
+    txParent.vout[2].scriptPubKey = CScript() << OP_RETURN;
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = scriptB;
+    txChild.vout[0].nValue = 4000;
+
+    CTxMemPool pool;
+    std::vector<std::pair<CMempoolAddressKey, CMempoolAddressDelta>> vDeltas;
+    BOOST_CHECK(!pool.getAddressIndex(hashA, vDeltas));
+    pool.setAddressIndex(true);
+
+    LOCK2(cs_main, pool.cs);
+    pool.addUnchecked(txChild.GetHash(), entry.Time(2).FromTx(txChild));
+    pool.addUnchecked(txParent.GetHash(), entry.Time(1).FromTx(txParent));
+
+    // Oldest first; the child came first, before its parent was there to resolve the spent output.
+    BOOST_CHECK(pool.getAddressIndex(hashB, vDeltas));
+    BOOST_CHECK_EQUAL(vDeltas.size(), 2U);
+    BOOST_CHECK(vDeltas[0].first.txid == txParent.GetHash() && vDeltas[0].first.index == 1 && !vDeltas[0].first.fSpend);
+    BOOST_CHECK_EQUAL(vDeltas[0].second.amount, 3000);
+    BOOST_CHECK(vDeltas[1].first.txid == txChild.GetHash() && vDeltas[1].first.index == 0);
+    BOOST_CHECK_EQUAL(vDeltas[1].second.amount, 4000);
+    vDeltas.clear();
+    BOOST_CHECK(pool.getAddressIndex(hashA, vDeltas));
+    BOOST_CHECK_EQUAL(vDeltas.size(), 1U);
+
+    // Added in order, the child's input is a debit of the parent's output.
+    pool.removeRecursive(txChild);
+    pool.removeRecursive(txParent);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    pool.addUnchecked(txParent.GetHash(), entry.Time(1).FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.Time(2).FromTx(txChild));
+    vDeltas.clear();
+    BOOST_CHECK(pool.getAddressIndex(hashA, vDeltas));
+    BOOST_CHECK_EQUAL(vDeltas.size(), 2U);
+    BOOST_CHECK_EQUAL(vDeltas[0].second.amount, 5000);
+    BOOST_CHECK(vDeltas[1].first.fSpend && vDeltas[1].first.txid == txChild.GetHash());
+    BOOST_CHECK_EQUAL(vDeltas[1].second.amount, -5000);
+    BOOST_CHECK(vDeltas[1].second.prevout == txChild.vin[0].prevout);
+
+    // Removing a transaction takes its rows with it.
+    pool.removeRecursive(txChild);
+    vDeltas.clear();
+    BOOST_CHECK(pool.getAddressIndex(hashA, vDeltas));
+    BOOST_CHECK_EQUAL(vDeltas.size(), 1U);
+    vDeltas.clear();
+    BOOST_CHECK(pool.getAddressIndex(hashB, vDeltas));
+    BOOST_CHECK_EQUAL(vDeltas.size(), 1U);
+    pool.removeRecursive(txParent);
+    vDeltas.clear();
+    BOOST_CHECK(pool.getAddressIndex(hashA, vDeltas) && vDeltas.empty());
+    BOOST_CHECK(pool.getAddressIndex(hashB, vDeltas) && vDeltas.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
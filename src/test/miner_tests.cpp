@@ -22,8 +22,12 @@
 
 #include <memory>
 
+#include <univalue.h>
+
 #include <boost/test/unit_test.hpp>
 
+extern UniValue CallRPC(std::string args);
+
 BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
 
 // BOOST_CHECK_EXCEPTION predicates to check the specific validation error
@@ -201,6 +205,125 @@ static void TestPackageSelection(const CChainParams& chainparams, const CScript&
     BOOST_CHECK(pblocktemplate->block.vtx[8]->GetHash() == hashLowFeeTx2);
 }
 
+/** Transactions of the template after the coinbase, in block order */
+static std::vector<uint256> TemplateTxids(const CBlockTemplate& tmpl)
+{
+    std::vector<uint256> vTxids;
+    for (size_t i = 1; i < tmpl.block.vtx.size(); i++)
+        vTxids.push_back(tmpl.block.vtx[i]->GetHash());
+    return vTxids;
+}
+
+/** Check that a template refilled from the cache holds what a full reselection selects */
+static void CheckSameAsReselection(const CChainParams& chainparams, const CScript& scriptPubKey, const std::vector<uint256>& vCached) EXCLUSIVE_LOCKS_REQUIRED(::mempool.cs)
+{
+    ResetBlockTemplateCache();
+    std::vector<uint256> vFresh = TemplateTxids(*AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK(std::set<uint256>(vCached.begin(), vCached.end()) == std::set<uint256>(vFresh.begin(), vFresh.end()));
+}
+
+// Test suite for the transaction selection cached between templates on a tip.
+// The block order tells a refill, which appends new packages after the cached
+// ones, from a full reselection, which puts the best ancestor feerate first.
+static void TestTemplateCache(const CChainParams& chainparams, const CScript& scriptPubKey, const std::vector<CTransactionRef>& txFirst) EXCLUSIVE_LOCKS_REQUIRED(cs_main, ::mempool.cs)
+{
+    TestMemPoolEntryHelper entry;
+    entry.Time(GetTime());
+    std::vector<uint256> vTxids;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+
+    tx.vin[0].prevout = COutPoint(txFirst[0]->GetHash(), 0);
+    tx.vout[0].nValue = 5000000000LL - 10000;
+    CMutableTransaction txA(tx);
+    mempool.addUnchecked(txA.GetHash(), entry.Fee(10000).SpendsCoinbase(true).FromTx(txA));
+
+    tx.vin[0].prevout = COutPoint(txFirst[1]->GetHash(), 0);
+    tx.vout[0].nValue = 5000000000LL - 20000;
+    CMutableTransaction txB(tx);
+    mempool.addUnchecked(txB.GetHash(), entry.Fee(20000).SpendsCoinbase(true).FromTx(txB));
+
+    ResetBlockTemplateCache();
+    std::vector<uint256> vSelected = TemplateTxids(*AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK(vSelected == std::vector<uint256>({txB.GetHash(), txA.GetHash()}));
+
+    // Nothing changed: the cached selection is refilled as it was
+    vTxids = TemplateTxids(*AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK(vTxids == vSelected);
+
+    // New packages are appended in ancestor order: the free F only together with its child G,
+    // which pays more than C, the child of the already selected A
+    tx.vin[0].prevout = COutPoint(txFirst[2]->GetHash(), 0);
+    tx.vout[0].nValue = 5000000000LL;
+    CMutableTransaction txF(tx);
+    mempool.addUnchecked(txF.GetHash(), entry.Fee(0).SpendsCoinbase(true).FromTx(txF));
+
+    tx.vin[0].prevout = COutPoint(txA.GetHash(), 0);
+    tx.vout[0].nValue = txA.vout[0].nValue - 50000;
+    CMutableTransaction txC(tx);
+    mempool.addUnchecked(txC.GetHash(), entry.Fee(50000).SpendsCoinbase(false).FromTx(txC));
+
+    tx.vin[0].prevout = COutPoint(txF.GetHash(), 0);
+    tx.vout[0].nValue = txF.vout[0].nValue - 100000;
+    CMutableTransaction txG(tx);
+    mempool.addUnchecked(txG.GetHash(), entry.Fee(100000).SpendsCoinbase(false).FromTx(txG));
+
+    vTxids = TemplateTxids(*AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK(vTxids == std::vector<uint256>({txB.GetHash(), txA.GetHash(), txF.GetHash(), txG.GetHash(), txC.GetHash()}));
+    CheckSameAsReselection(chainparams, scriptPubKey, vTxids);
+
+    // Removed entries are skipped together with their descendants
+    mempool.removeRecursive(CTransaction(txA));
+    vTxids = TemplateTxids(*AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(vTxids.size(), 3U);
+    BOOST_CHECK(std::find(vTxids.begin(), vTxids.end(), txA.GetHash()) == vTxids.end());
+    BOOST_CHECK(std::find(vTxids.begin(), vTxids.end(), txC.GetHash()) == vTxids.end());
+    CheckSameAsReselection(chainparams, scriptPubKey, vTxids);
+
+    // A better paying H is appended last while the selection is young, and leads it
+    // once the selection has aged out
+    tx.vin[0].prevout = COutPoint(txFirst[3]->GetHash(), 0);
+    tx.vout[0].nValue = 5000000000LL - 1000000;
+    CMutableTransaction txH(tx);
+    mempool.addUnchecked(txH.GetHash(), entry.Fee(1000000).SpendsCoinbase(true).FromTx(txH));
+    vTxids = TemplateTxids(*AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK(vTxids.back() == txH.GetHash());
+
+    SetMockTime(GetTime() + TEMPLATE_CACHE_MAX_AGE + 1);
+    vTxids = TemplateTxids(*AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK(vTxids.front() == txH.GetHash());
+    SetMockTime(0);
+
+    // prioritisetransaction invalidates the selection
+    CallRPC(std::string("prioritisetransaction ") + txB.GetHash().GetHex() + " 0 10000000");
+    vTxids = TemplateTxids(*AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK(vTxids.front() == txB.GetHash());
+    CallRPC(std::string("prioritisetransaction ") + txB.GetHash().GetHex() + " 0 -10000000");
+    vTxids = TemplateTxids(*AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK(vTxids.front() == txH.GetHash());
+
+    // So does a flood of additions: X makes F and G the best package, which a refill
+    // would leave where they are
+    tx.vin[0].prevout = COutPoint(txG.GetHash(), 0);
+    tx.vout[0].nValue = txG.vout[0].nValue - 20 * COIN;
+    CMutableTransaction txX(tx);
+    mempool.addUnchecked(txX.GetHash(), entry.Fee(20 * COIN).SpendsCoinbase(false).FromTx(txX));
+    tx.vout[0].nValue = 1000;
+    for (size_t i = 0; i < TEMPLATE_CACHE_MAX_ADDED; i++) {
+        tx.vin[0].prevout = COutPoint(uint256S("0x1234"), i);
+        mempool.addUnchecked(tx.GetHash(), entry.Fee(0).SpendsCoinbase(false).FromTx(tx));
+    }
+    vTxids = TemplateTxids(*AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK(vTxids.front() == txF.GetHash());
+    BOOST_CHECK_EQUAL(vTxids.size(), 5U);
+
+    mempool.clear();
+    ResetBlockTemplateCache();
+}
+
 // NOTE: These tests rely on CreateNewBlock doing its own self-validation!
 BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 {
@@ -518,6 +641,9 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 
     TestPackageSelection(chainparams, scriptPubKey, txFirst);
 
+    mempool.clear();
+    TestTemplateCache(chainparams, scriptPubKey, txFirst);
+
     fCheckpointsEnabled = true;
 }
 
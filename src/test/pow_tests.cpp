@@ -7,6 +7,7 @@
 #include <pow.h>
 #include <random.h>
 #include <util.h>
+#include <validation.h>
 #include <test/test_bitcoin.h>
 
 #include <boost/test/unit_test.hpp>
@@ -83,4 +84,77 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(pow_hash_cache)
+{
+    CPoWHashCache cache(2);
+    uint256 h1 = InsecureRand256(), h2 = InsecureRand256(), h3 = InsecureRand256();
+    CPoWHash entry;
+    BOOST_CHECK(!cache.Get(h1, entry));
+
+    cache.Insert(h1, CPoWHash(h2, true));
+    BOOST_CHECK(cache.Get(h1, entry));
+    BOOST_CHECK(entry.hash == h2 && entry.fLyra2Z);
+
+    // Re-inserting updates in place and does not take another slot.
+    cache.Insert(h1, CPoWHash(h3, false));
+    BOOST_CHECK(cache.Get(h1, entry));
+    BOOST_CHECK(entry.hash == h3 && !entry.fLyra2Z);
+
+    // The oldest entry is evicted once the cache is full.
+    cache.Insert(h2, CPoWHash(h1, true));
+    cache.Insert(h3, CPoWHash(h1, true));
+    BOOST_CHECK(!cache.Get(h1, entry));
+    BOOST_CHECK(cache.Get(h2, entry));
+    BOOST_CHECK(cache.Get(h3, entry));
+}
+
+/* Reference lookup: walk back from the tip like the pre-index kernel check did. */
+static bool WalkStakeModifier(const CBlockIndex* pindex, int64_t nBound, uint64_t& nStakeModifier)
+{
+    int64_t nStakeModifierTime = pindex->GetBlockTime();
+    if (nStakeModifierTime <= nBound) return false;
+    while (nStakeModifierTime > nBound) {
+        if (!pindex->pprev) return false;
+        pindex = pindex->pprev;
+        if (pindex->GeneratedStakeModifier()) nStakeModifierTime = pindex->GetBlockTime();
+    }
+    nStakeModifier = pindex->nStakeModifier;
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(stake_modifier_index)
+{
+    // Block times wander back and forth so the index has to drop and restore entries.
+    std::vector<CBlockIndex> blocks(600);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : nullptr;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = 1500000000 + i * 60 - InsecureRandRange(600);
+        blocks[i].SetStakeModifier(InsecureRand32(), i == 0 || InsecureRandRange(4) == 0);
+    }
+
+    CStakeModifierIndex index;
+    CChain chain;
+    for (int nTip : {599, 350, 420, 100, 599}) {
+        chain.SetTip(&blocks[nTip]);
+        index.Sync(chain);
+        BOOST_CHECK(index.Tip() == &blocks[nTip]);
+        for (int i = 0; i < 200; i++) {
+            int64_t nBound = blocks[0].nTime - 600 + InsecureRandRange(nTip * 60 + 1200);
+            uint64_t nExpected = 0;
+            CStakeModifierIndex::Entry entry;
+            bool fExpected = blocks[nTip].GetBlockTime() > nBound && WalkStakeModifier(&blocks[nTip], nBound, nExpected);
+            bool fFound = blocks[nTip].GetBlockTime() > nBound && index.Lookup(nBound, entry);
+            BOOST_CHECK_EQUAL(fFound, fExpected);
+            if (fFound && fExpected) BOOST_CHECK_EQUAL(entry.nStakeModifier, nExpected);
+        }
+    }
+
+    // Only blocks extending or at the tip are applied.
+    index.BlockConnected(&blocks[10]);
+    BOOST_CHECK(index.Tip() == &blocks[599]);
+    index.BlockDisconnected(&blocks[599]);
+    BOOST_CHECK(index.Tip() == &blocks[598]);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -17,6 +17,7 @@
 #include <univalue.h>
 
 #include <rpc/blockchain.h>
+#include <rpc/mining.h>
 
 UniValue CallRPC(std::string args)
 {
@@ -413,4 +414,50 @@ BOOST_AUTO_TEST_CASE(rpc_getblockstats_calculate_percentiles_by_weight)
     }
 }
 
+BOOST_AUTO_TEST_CASE(rpc_longpoll_wake_order)
+{
+    CLongPollRegistry registry(100);
+    const auto start = std::chrono::steady_clock::now();
+
+    // Fee marks 100, 150 and 200; deadlines one minute after each registration
+    CLongPollRegistry::Waiter a, b, c;
+    registry.Register(a, false, start);
+    registry.NotifyEntry(50, start);
+    BOOST_CHECK(!a.fWoken);
+    registry.Register(b, false, start + std::chrono::seconds(10));
+    registry.NotifyEntry(50, start + std::chrono::seconds(10));
+    BOOST_CHECK(a.fWoken);
+    BOOST_CHECK(!b.fWoken);
+    registry.Register(c, false, start + std::chrono::seconds(20));
+
+    // Zero and negative fees count towards nothing, but still wake the waiters past their minute
+    registry.NotifyEntry(-10, start + std::chrono::seconds(30));
+    BOOST_CHECK(!b.fWoken && !c.fWoken);
+    registry.NotifyEntry(0, start + std::chrono::seconds(70));
+    BOOST_CHECK(b.fWoken);
+    BOOST_CHECK(!c.fWoken);
+
+    // Reaching the fee mark wakes before the deadline
+    registry.NotifyEntry(100, start + std::chrono::seconds(71));
+    BOOST_CHECK(c.fWoken);
+
+    // A tip change wakes everybody, whatever their marks; so does registering behind a tip
+    CLongPollRegistry::Waiter d, e, f;
+    registry.Register(d, false, start + std::chrono::seconds(80));
+    registry.Register(e, false, start + std::chrono::seconds(90));
+    registry.Register(f, true, start + std::chrono::seconds(90));
+    BOOST_CHECK(f.fWoken);
+    registry.NotifyEntry(1, start + std::chrono::seconds(90));
+    BOOST_CHECK(!d.fWoken && !e.fWoken);
+    registry.NotifyTip();
+    BOOST_CHECK(d.fWoken && e.fWoken);
+
+    // After an interrupt new waiters do not wait at all
+    registry.Interrupt();
+    CLongPollRegistry::Waiter g;
+    registry.Register(g, false, start + std::chrono::seconds(100));
+    BOOST_CHECK(g.fWoken);
+    registry.Wait(g, [] { return false; });
+}
+
 BOOST_AUTO_TEST_SUITE_END()
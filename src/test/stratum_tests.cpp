@@ -0,0 +1,128 @@
+// Copyright (c) 2019-2021 Uladzimir (https://t.me/vovanchik_net)
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <stratum.h>
+
+#include <consensus/merkle.h>
+#include <hash.h>
+#include <utilstrencodings.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stratum_tests, BasicTestingSetup)
+
+static CBlock TemplateBlock(size_t nTx)
+{
+    CBlock block;
+    block.nVersion = 0x00010003;
+    block.hashPrevBlock = InsecureRand256();
+    block.nTime = 1600000000;
+    block.nBits = 0x1e0ffff0;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 1234 << OP_0;
+    coinbase.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(32, 0));
+    coinbase.vout.emplace_back(50 * COIN, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    for (size_t i = 1; i < nTx; i++) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        tx.vout.emplace_back(i, CScript() << OP_TRUE);
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+    return block;
+}
+
+static uint32_t WordFromHex(const UniValue& value)
+{
+    return strtoul(value.get_str().c_str(), nullptr, 16);
+}
+
+/** Build the 80 byte header the way a Stratum miner does from mining.notify */
+static std::vector<unsigned char> MinerHeader(const UniValue& notify, const std::vector<unsigned char>& vchExtraNonce1,
+                                              const std::vector<unsigned char>& vchExtraNonce2, uint32_t nNonce)
+{
+    std::vector<unsigned char> vchCoinbase = ParseHex(notify[2].get_str());
+    vchCoinbase.insert(vchCoinbase.end(), vchExtraNonce1.begin(), vchExtraNonce1.end());
+    vchCoinbase.insert(vchCoinbase.end(), vchExtraNonce2.begin(), vchExtraNonce2.end());
+    std::vector<unsigned char> vchCoinbase2 = ParseHex(notify[3].get_str());
+    vchCoinbase.insert(vchCoinbase.end(), vchCoinbase2.begin(), vchCoinbase2.end());
+
+    uint256 root = Hash(vchCoinbase.begin(), vchCoinbase.end());
+    for (size_t i = 0; i < notify[4].size(); i++) {
+        std::vector<unsigned char> vchStep = ParseHex(notify[4][i].get_str());
+        root = Hash(root.begin(), root.end(), vchStep.begin(), vchStep.end());
+    }
+
+    std::vector<unsigned char> header(80);
+    WriteLE32(&header[0], WordFromHex(notify[5]));
+    std::vector<unsigned char> vchPrev = ParseHex(notify[1].get_str());
+    for (size_t i = 0; i < 32; i += 4)
+        std::reverse_copy(vchPrev.begin() + i, vchPrev.begin() + i + 4, header.begin() + 4 + i);
+    std::copy(root.begin(), root.end(), header.begin() + 36);
+    WriteLE32(&header[68], WordFromHex(notify[7]));
+    WriteLE32(&header[72], WordFromHex(notify[6]));
+    WriteLE32(&header[76], nNonce);
+    return header;
+}
+
+BOOST_AUTO_TEST_CASE(stratum_job_roundtrip)
+{
+    const std::vector<unsigned char> vchExtraNonce1{0x01, 0x02, 0x03, 0x04};
+    const std::vector<unsigned char> vchExtraNonce2{0xaa, 0xbb, 0xcc, 0xdd};
+
+    // Odd and even transaction counts exercise every shape of the merkle branch.
+    for (size_t nTx = 1; nTx <= 9; nTx++) {
+        CStratumJob job;
+        BOOST_CHECK(job.Init("1f", TemplateBlock(nTx), 1234));
+        BOOST_CHECK_EQUAL(job.block.hashMerkleRoot, BlockMerkleRoot(job.block));
+
+        const UniValue notify = job.NotifyParams(true);
+        BOOST_CHECK_EQUAL(notify.size(), 9U);
+        BOOST_CHECK_EQUAL(notify[0].get_str(), "1f");
+        BOOST_CHECK(notify[8].get_bool());
+
+        CBlock block;
+        BOOST_CHECK(job.BuildBlock(vchExtraNonce1, vchExtraNonce2, job.block.nTime + 5, 0x12345678, block));
+        BOOST_CHECK_EQUAL(block.hashMerkleRoot, BlockMerkleRoot(block));
+        BOOST_CHECK_EQUAL(block.vtx.size(), nTx);
+        BOOST_CHECK(block.vtx[0]->vin[0].scriptWitness.stack == job.block.vtx[0]->vin[0].scriptWitness.stack);
+
+        // The miner's header and the rebuilt block hash the same.
+        std::vector<unsigned char> header = MinerHeader(notify, vchExtraNonce1, vchExtraNonce2, 0x12345678);
+        WriteLE32(&header[68], job.block.nTime + 5);
+        BOOST_CHECK_EQUAL(Hash(header.begin(), header.end()), block.GetHash());
+
+        // The extranonces land in the coinbase script right after the height.
+        const CScript& scriptSig = block.vtx[0]->vin[0].scriptSig;
+        std::vector<unsigned char> vchExtraNonce(vchExtraNonce1);
+        vchExtraNonce.insert(vchExtraNonce.end(), vchExtraNonce2.begin(), vchExtraNonce2.end());
+        BOOST_CHECK(std::search(scriptSig.begin(), scriptSig.end(), vchExtraNonce.begin(), vchExtraNonce.end()) == scriptSig.begin() + (CScript() << 1234).size() + 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stratum_job_rejects_bad_extranonce)
+{
+    CStratumJob job;
+    BOOST_CHECK(job.Init("1", TemplateBlock(3), 1234));
+    CBlock block;
+    BOOST_CHECK(!job.BuildBlock({0x01, 0x02, 0x03}, {0x01, 0x02, 0x03, 0x04}, job.block.nTime, 0, block));
+    BOOST_CHECK(!job.BuildBlock({0x01, 0x02, 0x03, 0x04}, {0x01, 0x02, 0x03, 0x04, 0x05}, job.block.nTime, 0, block));
+}
+
+BOOST_AUTO_TEST_CASE(stratum_target)
+{
+    arith_uint256 bnDiff1;
+    bnDiff1.SetCompact(0x1d00ffff);
+    BOOST_CHECK(StratumTarget(1) == bnDiff1);
+    BOOST_CHECK(StratumTarget(2) == bnDiff1 / 2);
+    BOOST_CHECK(StratumTarget(0.5) == bnDiff1 * 2);
+    BOOST_CHECK(StratumTarget(1024) == bnDiff1 / 1024);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 #include <consensus/consensus.h>
 #include <consensus/validation.h>
 #include <crypto/sha256.h>
+#include <crypto/Lyra2Z.h>
 #include <validation.h>
 #include <miner.h>
 #include <net_processing.h>
@@ -49,6 +50,7 @@ BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
     : m_path_root(fs::temp_directory_path() / "test_bitcoin" / strprintf("%lu_%i", (unsigned long)GetTime(), (int)(InsecureRandRange(1 << 30))))
 {
     SHA256AutoDetect();
+    lyra2z_detect();
     RandomInit();
     ECC_Start();
     SetupEnvironment();
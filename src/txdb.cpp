@@ -8,6 +8,7 @@
 
 #include <chainparams.h>
 #include <hash.h>
+#include <memusage.h>
 #include <random.h>
 #include <pow.h>
 #include <shutdown.h>
@@ -26,6 +27,10 @@ static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
 static const char DB_ADDRESS = 'a';
+static const char DB_ADDRESS_INDEX = 'A';
+static const char DB_ADDRESS_SUMMARY = 'S';
+static const char DB_ADDRESS_BEST = 'X';
+static const char DB_POW_HASH = 'w';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_HEAD_BLOCKS = 'H';
@@ -227,7 +232,8 @@ void CCoinsViewDBCursor::Next()
     }
 }
 
-bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
+bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo,
+        const std::vector<std::pair<uint256, CPoWHash> >& powinfo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_FILES, it->first), *it->second);
@@ -236,9 +242,16 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    for (const auto& it : powinfo) {
+        batch.Write(std::make_pair(DB_POW_HASH, it.first), it.second);
+    }
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadPoWHash(const uint256 &hashBlock, CPoWHash &entry) {
+    return Read(std::make_pair(DB_POW_HASH, hashBlock), entry);
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(std::make_pair(DB_TXINDEX, txid), pos);
 }
@@ -250,40 +263,263 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
-// CScript, COutpoint  = value, height, spend_tx, spend_in, spend_height
+// Hash160(script), height, COutpoint = value, height, spend_tx, spend_in, spend_height
+// Hash160(script) = received, sent, received count, sent count
 
-bool CBlockTreeDB::WriteAddress (const std::vector<std::pair<CAddressKey, CAddressValue>> &vec) {
-    CDBBatch batch(*this);
-    for (auto it : vec) {
-        if (it.second.height == 0) {
-            batch.Erase(std::make_pair(DB_ADDRESS, it.first));
+/** Above every address index row of a script. */
+static CAddressIndexKey AddressKeyEnd(const uint160& hashScript) {
+    return CAddressIndexKey(hashScript, std::numeric_limits<uint32_t>::max(),
+        COutPoint(uint256S("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"), std::numeric_limits<uint32_t>::max()));
+}
+
+void CBlockTreeDB::WriteAddressRows (CDBBatch& batch, const std::map<CAddressIndexKey, CAddressValue>& mapRows) {
+    std::map<uint160, CAddressSummary> mapSummary;
+    for (const auto& it : mapRows) {
+        std::map<uint160, CAddressSummary>::iterator summary = mapSummary.find(it.first.hashScript);
+        if (summary == mapSummary.end()) {
+            CAddressSummary value;
+            if (!Read(std::make_pair(DB_ADDRESS_SUMMARY, it.first.hashScript), value)) value.SetNull();
+            summary = mapSummary.emplace(it.first.hashScript, value).first;
+        }
+        CAddressValue value;
+        if (!Read(std::make_pair(DB_ADDRESS_INDEX, it.first), value)) value.SetNull();
+        summary->second.Apply(value, -1);
+        summary->second.Apply(it.second, 1);
+        if (it.second.IsNull()) {
+            batch.Erase(std::make_pair(DB_ADDRESS_INDEX, it.first));
+        } else {
+            batch.Write(std::make_pair(DB_ADDRESS_INDEX, it.first), it.second);
+        }
+    }
+    for (const auto& it : mapSummary) {
+        if (it.second.IsNull()) {
+            batch.Erase(std::make_pair(DB_ADDRESS_SUMMARY, it.first));
         } else {
-            batch.Write(std::make_pair(DB_ADDRESS, it.first), it.second);
+            batch.Write(std::make_pair(DB_ADDRESS_SUMMARY, it.first), it.second);
         }
     }
+}
+
+bool CBlockTreeDB::WriteAddress (const std::vector<std::pair<CAddressIndexKey, CAddressValue>> &vec) {
+    // A row may be written more than once (an output created and spent in the same block): the last state wins.
+    std::map<CAddressIndexKey, CAddressValue> mapRows;
+    for (const auto& it : vec) mapRows[it.first] = it.second;
+    CDBBatch batch(*this);
+    WriteAddressRows(batch, mapRows);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddress (const CScript& script, std::vector<std::pair<CAddressKey, CAddressValue>> &vec) {
+void CBlockTreeDB::CacheAddress (const std::vector<std::pair<CAddressIndexKey, CAddressValue>> &vec) {
+    LOCK(cs_address);
+    for (const auto& it : vec) mapAddressCache[it.first] = it.second;
+}
+
+bool CBlockTreeDB::FlushAddress (const uint256& hashBlock) {
+    LOCK(cs_address);
+    CDBBatch batch(*this);
+    WriteAddressRows(batch, mapAddressCache);
+    batch.Write(DB_ADDRESS_BEST, hashBlock);
+    if (!WriteBatch(batch)) return false;
+    mapAddressCache.clear();
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressBestBlock (uint256& hashBlock) {
+    return Read(DB_ADDRESS_BEST, hashBlock);
+}
+
+size_t CBlockTreeDB::AddressCacheUsage () const {
+    LOCK(cs_address);
+    return memusage::DynamicUsage(mapAddressCache);
+}
+
+bool CBlockTreeDB::ReadAddressRows (const uint160& hashScript, const CAddressIndexKey& start, size_t limit,
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>>& vec, bool& fMore, bool fUnspentOnly) {
+    fMore = false;
+    if (limit == 0) return true;
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
-    pcursor->Seek(std::make_pair(DB_ADDRESS, CAddressKey(script, COutPoint())));
+    pcursor->Seek(std::make_pair(DB_ADDRESS_INDEX, start));
+    if (pcursor->Valid()) {
+        pcursor->Prev();
+    } else {
+        pcursor->SeekToLast();
+    }
+    size_t nRead = 0;
     while (pcursor->Valid()) {
-        std::pair<char, CAddressKey> key;
-        if (pcursor->GetKey(key) && (key.first == DB_ADDRESS) && key.second.script == script) {
-            CAddressValue value;
-            if (pcursor->GetValue(value)) {
-                vec.push_back(std::make_pair(key.second, value));
-                pcursor->Next();
-            } else {
-                return error("failed to get address index value");
-            }
+        std::pair<char, CAddressIndexKey> key;
+        if (!pcursor->GetKey(key) || (key.first != DB_ADDRESS_INDEX) || key.second.hashScript != hashScript) break;
+        if (nRead == limit) {
+            fMore = true;
+            break;
+        }
+        CAddressValue value;
+        if (!pcursor->GetValue(value)) return error("failed to get address index value");
+        if (!fUnspentOnly || value.spend_height == 0) {
+            vec.emplace_back(key.second, value);
+            nRead++;
+        }
+        pcursor->Prev();
+    }
+    return true;
+}
+
+void CBlockTreeDB::ReadCachedAddress (const uint160& hashScript, const CAddressIndexKey& start,
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>>& vec) {
+    std::map<CAddressIndexKey, CAddressValue>::const_iterator it = mapAddressCache.lower_bound(CAddressIndexKey(hashScript, 0, COutPoint(uint256(), 0)));
+    for (; it != mapAddressCache.end() && it->first.hashScript == hashScript && it->first < start; ++it) {
+        vec.push_back(*it);
+    }
+}
+
+bool CBlockTreeDB::ReadAddress (const CScript& script, std::vector<std::pair<CAddressKey, CAddressValue>> &vec) {
+    uint160 hashScript = GetAddressScriptHash(script);
+    CAddressKey keyScript(script, COutPoint());
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>> vRows, vCached;
+    bool fMore;
+    LOCK(cs_address);
+    if (!ReadAddressRows(hashScript, AddressKeyEnd(hashScript), std::numeric_limits<size_t>::max(), vRows, fMore)) return false;
+    ReadCachedAddress(hashScript, AddressKeyEnd(hashScript), vCached);
+    std::map<CAddressIndexKey, CAddressValue> mapRows(vRows.begin(), vRows.end());
+    for (const auto& it : vCached) {
+        if (it.second.IsNull()) {
+            mapRows.erase(it.first);
+        } else {
+            mapRows[it.first] = it.second;
+        }
+    }
+    for (const auto& it : mapRows) {
+        keyScript.out = it.first.out;
+        vec.push_back(std::make_pair(keyScript, it.second));
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressUnspent (const CScript& script, std::vector<std::pair<CAddressKey, CAddressValue>> &vec) {
+    uint160 hashScript = GetAddressScriptHash(script);
+    CAddressKey keyScript(script, COutPoint());
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>> vRows, vCached;
+    bool fMore;
+    LOCK(cs_address);
+    if (!ReadAddressRows(hashScript, AddressKeyEnd(hashScript), std::numeric_limits<size_t>::max(), vRows, fMore, true)) return false;
+    ReadCachedAddress(hashScript, AddressKeyEnd(hashScript), vCached);
+    // A cached row replaces the database row, also when it is now spent
+    std::map<CAddressIndexKey, CAddressValue> mapRows(vRows.begin(), vRows.end());
+    for (const auto& it : vCached) {
+        if (it.second.IsNull() || it.second.spend_height != 0) {
+            mapRows.erase(it.first);
+        } else {
+            mapRows[it.first] = it.second;
+        }
+    }
+    for (const auto& it : mapRows) {
+        keyScript.out = it.first.out;
+        vec.push_back(std::make_pair(keyScript, it.second));
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddress (const CScript& script, CAddressIndexKey& cursor, size_t limit, std::vector<std::pair<CAddressKey, CAddressValue>> &vec) {
+    uint160 hashScript = GetAddressScriptHash(script);
+    CAddressKey keyScript(script, COutPoint());
+    // Pages run from the newest row down: start just below the cursor, or above every row of the script.
+    CAddressIndexKey start = cursor;
+    if (start.height == 0) start = AddressKeyEnd(hashScript);
+    start.hashScript = hashScript;
+    cursor = CAddressIndexKey();
+    if (limit == 0) return true;
+
+    LOCK(cs_address);
+    // Every cached row may hide a database row, so read that many more to still fill the page.
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>> vRows, vCached;
+    bool fMore;
+    ReadCachedAddress(hashScript, start, vCached);
+    if (!ReadAddressRows(hashScript, start, limit + vCached.size(), vRows, fMore)) return false;
+    std::map<CAddressIndexKey, CAddressValue> mapRows(vRows.begin(), vRows.end());
+    for (const auto& it : vCached) {
+        // Below the last database row read there may be rows not read yet.
+        if (fMore && it.first < vRows.back().first) continue;
+        if (it.second.IsNull()) {
+            mapRows.erase(it.first);
         } else {
+            mapRows[it.first] = it.second;
+        }
+    }
+    size_t nRead = 0;
+    for (std::map<CAddressIndexKey, CAddressValue>::reverse_iterator it = mapRows.rbegin(); it != mapRows.rend(); ++it) {
+        if (nRead == limit) {
+            // Another row follows the page: hand out where to continue.
+            cursor = start;
             break;
         }
+        keyScript.out = it->first.out;
+        vec.push_back(std::make_pair(keyScript, it->second));
+        start = it->first;
+        nRead++;
+    }
+    if (fMore && nRead == limit) cursor = start;
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressSummary (const CScript& script, CAddressSummary &summary) {
+    uint160 hashScript = GetAddressScriptHash(script);
+    LOCK(cs_address);
+    if (!Read(std::make_pair(DB_ADDRESS_SUMMARY, hashScript), summary))
+        summary.SetNull();
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>> vCached;
+    ReadCachedAddress(hashScript, AddressKeyEnd(hashScript), vCached);
+    for (const auto& it : vCached) {
+        CAddressValue value;
+        if (!Read(std::make_pair(DB_ADDRESS_INDEX, it.first), value)) value.SetNull();
+        summary.Apply(value, -1);
+        summary.Apply(it.second, 1);
     }
     return true;
 }
 
+/** Move address index rows from the script-keyed layout to the hashed layout and build the summaries.
+ *  Rows of one script are contiguous in the old layout, so a batch is only written between scripts
+ *  and an interrupted upgrade leaves every summary consistent with the rows already moved.
+ */
+bool CBlockTreeDB::UpgradeAddressIndex () {
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESS, CAddressKey()));
+    if (!pcursor->Valid()) return true;
+    std::pair<char, CAddressKey> key;
+    if (!pcursor->GetKey(key) || key.first != DB_ADDRESS) return true;
+
+    LogPrintf("Upgrading address index database...\n");
+    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    CDBBatch batch(*this);
+    uint160 hashScript;
+    CAddressSummary summary;
+    size_t nRows = 0;
+    while (true) {
+        bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESS;
+        uint160 hash = fValid ? GetAddressScriptHash(key.second.script) : uint160();
+        if (!summary.IsNull() && (!fValid || hash != hashScript)) {
+            batch.Write(std::make_pair(DB_ADDRESS_SUMMARY, hashScript), summary);
+            summary.SetNull();
+            if (batch.SizeEstimate() > batch_size) {
+                if (!WriteBatch(batch)) return false;
+                batch.Clear();
+                if (ShutdownRequested()) return error("%s: interrupted", __func__);
+            }
+        }
+        if (!fValid) break;
+        CAddressValue value;
+        if (!pcursor->GetValue(value)) return error("%s: unable to read value", __func__);
+        hashScript = hash;
+        summary.Apply(value, 1);
+        batch.Write(std::make_pair(DB_ADDRESS_INDEX, CAddressIndexKey(hash, value.height, key.second.out)), value);
+        batch.Erase(std::make_pair(DB_ADDRESS, key.second));
+        nRows++;
+        pcursor->Next();
+    }
+    if (!WriteBatch(batch)) return false;
+    LogPrintf("Upgraded %u address index rows\n", nRows);
+    return true;
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -370,19 +606,33 @@ void log (const std::string str) {
 	cfile_numinfile++;
 }
 
-bool CBlockTreeDB::DumpAddrDB () {
+bool CBlockTreeDB::DumpAddrDB (std::function<bool(const COutPoint&, uint32_t, CScript&)> lookupScript) {
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
-    pcursor->Seek(std::make_pair(DB_ADDRESS, CAddressKey(CScript(), COutPoint())));
+    pcursor->Seek(std::make_pair(DB_ADDRESS_INDEX, CAddressIndexKey()));
+    // Rows of a script are contiguous: its address is looked up until one of its outputs is found.
+    uint160 hashScript;
+    std::string strAddress;
+    bool fFirst = true, fDecoded = false;
     while (pcursor->Valid()) {
-        std::pair<char, CAddressKey> key;
-        if (pcursor->GetKey(key) && (key.first == DB_ADDRESS)) {
+        std::pair<char, CAddressIndexKey> key;
+        if (pcursor->GetKey(key) && (key.first == DB_ADDRESS_INDEX)) {
             CAddressValue value;
             if (pcursor->GetValue(value)) {
-                std::string s, ss;
-                s = key.second.GetAddr(true);
+                if (fFirst || key.second.hashScript != hashScript) {
+                    fFirst = false;
+                    hashScript = key.second.hashScript;
+                    strAddress = hashScript.GetHex();
+                    fDecoded = false;
+                }
+                CScript script;
+                if (!fDecoded && lookupScript(key.second.out, value.height, script) && GetAddressScriptHash(script) == hashScript) {
+                    strAddress = CAddressKey(script, key.second.out).GetAddr(true);
+                    fDecoded = true;
+                }
+                std::string ss;
                 if (value.spend_height > 0) 
                     ss = strprintf(" - %d (%s:%d)", value.spend_height, value.spend_hash.GetHex(), value.spend_n);
-                log (strprintf("%s - %s - %d (%s:%d)%s", s, FormatMoney(value.value), value.height,
+                log (strprintf("%s - %s - %d (%s:%d)%s", strAddress, FormatMoney(value.value), value.height,
                     key.second.out.hash.GetHex(), key.second.out.n, (value.spend_height > 0 ? ss : "")));
                 pcursor->Next();
             } else {
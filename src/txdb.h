@@ -10,7 +10,9 @@
 #include <coins.h>
 #include <dbwrapper.h>
 #include <chain.h>
+#include <pow.h>
 #include <primitives/block.h>
+#include <sync.h>
 
 #include <map>
 #include <memory>
@@ -114,19 +116,50 @@ class CBlockTreeDB : public CDBWrapper
 public:
     explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo,
+        const std::vector<std::pair<uint256, CPoWHash> >& powinfo = std::vector<std::pair<uint256, CPoWHash> >());
+    bool ReadPoWHash(const uint256 &hashBlock, CPoWHash &entry);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &info);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindexing);
     bool ReadReindexing(bool &fReindexing);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
-    bool WriteAddress (const std::vector<std::pair<CAddressKey, CAddressValue>> &vec);
+    /** Write address index rows (a null value erases the row) and update the summaries of their scripts in the same batch. */
+    bool WriteAddress (const std::vector<std::pair<CAddressIndexKey, CAddressValue>> &vec);
+    /** Keep address index rows in memory until the next FlushAddress; reads see them at once. */
+    void CacheAddress (const std::vector<std::pair<CAddressIndexKey, CAddressValue>> &vec);
+    /** Write the cached rows and their summaries together with the block the index is now at. */
+    bool FlushAddress (const uint256& hashBlock);
+    bool ReadAddressBestBlock (uint256& hashBlock);
+    size_t AddressCacheUsage () const;
     bool ReadAddress (const CScript& script, std::vector<std::pair<CAddressKey, CAddressValue>> &vec);
+    /** Up to limit rows of script, newest first, continuing below cursor (a null cursor starts at the newest row).
+     *  On return cursor is the position to continue from, or null when no rows are left. */
+    bool ReadAddress (const CScript& script, CAddressIndexKey& cursor, size_t limit, std::vector<std::pair<CAddressKey, CAddressValue>> &vec);
+    /** The unspent rows of script (spend_height == 0), oldest first: one range read, skipping the spent rows. */
+    bool ReadAddressUnspent (const CScript& script, std::vector<std::pair<CAddressKey, CAddressValue>> &vec);
+    /** Totals of an address: a single read, a null summary if the address is unknown. */
+    bool ReadAddressSummary (const CScript& script, CAddressSummary &summary);
+    /** Convert address index rows written in the script-keyed layout; a no-op once none are left. */
+    bool UpgradeAddressIndex ();
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
-    bool DumpAddrDB ();
+    /** Log every address index row. Rows show the address of the script lookupScript finds for one of
+     *  the script's outputs (the outpoint and its height), or the script hash when it finds none. */
+    bool DumpAddrDB (std::function<bool(const COutPoint&, uint32_t, CScript&)> lookupScript);
+
+private:
+    /** Address index rows changed since the last FlushAddress, a null value for an erased row. */
+    std::map<CAddressIndexKey, CAddressValue> mapAddressCache;
+    mutable CCriticalSection cs_address;
+
+    void WriteAddressRows (CDBBatch& batch, const std::map<CAddressIndexKey, CAddressValue>& mapRows);
+    bool ReadAddressRows (const uint160& hashScript, const CAddressIndexKey& start, size_t limit,
+        std::vector<std::pair<CAddressIndexKey, CAddressValue>>& vec, bool& fMore, bool fUnspentOnly = false);
+    void ReadCachedAddress (const uint160& hashScript, const CAddressIndexKey& start,
+        std::vector<std::pair<CAddressIndexKey, CAddressValue>>& vec) EXCLUSIVE_LOCKS_REQUIRED(cs_address);
 };
 
 #endif // BITCOIN_TXDB_H
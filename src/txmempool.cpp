@@ -326,7 +326,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
     assert(int(nSigOpCostWithAncestors) >= 0);
 }
 
-CTxMemPool::CTxMemPool() : nTransactionsUpdated(0)
+CTxMemPool::CTxMemPool() : nTransactionsUpdated(0), fAddressIndex(false)
 {
     _clear(); //lock free clear
 
@@ -356,7 +356,6 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 
 void CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, setEntries &setAncestors, bool validFeeEstimate)
 {
-    NotifyEntryAdded(entry.GetSharedTx());
     // Add to memory pool without checking anything.
     // Used by AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
@@ -373,6 +372,7 @@ void CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
             mapTx.modify(newit, update_fee_delta(delta));
         }
     }
+    NotifyEntryAdded(newit->GetSharedTx(), newit->GetModifiedFee());
 
     // Update cachedInnerUsage to include contained transaction's usage.
     // (When we update the entry for in-mempool parents, memory usage will be
@@ -407,6 +407,77 @@ void CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
 
     vTxHashes.emplace_back(tx.GetWitnessHash(), newit);
     newit->vTxHashesIdx = vTxHashes.size() - 1;
+
+    if (fAddressIndex) addAddressIndex(*newit);
+}
+
+void CTxMemPool::setAddressIndex(bool fEnable)
+{
+    LOCK(cs);
+    fAddressIndex = fEnable;
+    if (!fEnable) {
+        mapAddress.clear();
+        mapAddressInserted.clear();
+        cachedAddressUsage = 0;
+    }
+}
+
+void CTxMemPool::addAddressIndex(const CTxMemPoolEntry& entry)
+{
+    const CTransaction& tx = entry.GetTx();
+    const uint256& txid = tx.GetHash();
+    std::vector<CMempoolAddressKey>& inserted = mapAddressInserted[txid];
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        // The spent output belongs to a mempool parent or is in the chain state,
+        // where AcceptToMemoryPool has just brought it into the cache.
+        const COutPoint& prevout = tx.vin[i].prevout;
+        CTxOut out;
+        txiter pit = mapTx.find(prevout.hash);
+        if (pit != mapTx.end()) {
+            if (prevout.n < pit->GetTx().vout.size()) out = pit->GetTx().vout[prevout.n];
+        } else if (pcoinsTip) {
+            AssertLockHeld(cs_main);
+            const Coin& coin = pcoinsTip->AccessCoin(prevout);
+            if (!coin.IsSpent()) out = coin.out;
+        }
+        if (out.IsNull()) continue;
+        CMempoolAddressKey key(GetAddressScriptHash(out.scriptPubKey), txid, i, true);
+        mapAddress.emplace(key, CMempoolAddressDelta(entry.GetTime(), -out.nValue, prevout));
+        inserted.push_back(key);
+    }
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        const CTxOut& out = tx.vout[k];
+        if (out.scriptPubKey.IsUnspendable()) continue;
+        CMempoolAddressKey key(GetAddressScriptHash(out.scriptPubKey), txid, k, false);
+        mapAddress.emplace(key, CMempoolAddressDelta(entry.GetTime(), out.nValue));
+        inserted.push_back(key);
+    }
+    cachedAddressUsage += memusage::DynamicUsage(inserted);
+}
+
+void CTxMemPool::removeAddressIndex(const uint256& txid)
+{
+    auto it = mapAddressInserted.find(txid);
+    if (it == mapAddressInserted.end()) return;
+    for (const CMempoolAddressKey& key : it->second)
+        mapAddress.erase(key);
+    cachedAddressUsage -= memusage::DynamicUsage(it->second);
+    mapAddressInserted.erase(it);
+}
+
+bool CTxMemPool::getAddressIndex(const uint160& hashScript, std::vector<std::pair<CMempoolAddressKey, CMempoolAddressDelta>>& vDeltas) const
+{
+    LOCK(cs);
+    if (!fAddressIndex) return false;
+    const size_t nStart = vDeltas.size();
+    for (auto it = mapAddress.lower_bound(CMempoolAddressKey(hashScript, uint256(), 0, false));
+         it != mapAddress.end() && it->first.hashScript == hashScript; ++it) {
+        vDeltas.emplace_back(it->first, it->second);
+    }
+    std::stable_sort(vDeltas.begin() + nStart, vDeltas.end(), [](const std::pair<CMempoolAddressKey, CMempoolAddressDelta>& a, const std::pair<CMempoolAddressKey, CMempoolAddressDelta>& b) {
+        return a.second.nTime < b.second.nTime;
+    });
+    return true;
 }
 
 void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
@@ -415,6 +486,7 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     const uint256 hash = it->GetTx().GetHash();
     for (const CTxIn& txin : it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
+    if (fAddressIndex) removeAddressIndex(hash);
 
     if (vTxHashes.size() > 1) {
         vTxHashes[it->vTxHashesIdx] = std::move(vTxHashes.back());
@@ -586,8 +658,11 @@ void CTxMemPool::_clear()
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    mapAddress.clear();
+    mapAddressInserted.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
+    cachedAddressUsage = 0;
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
@@ -899,7 +974,7 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage + memusage::DynamicUsage(mapAddress) + memusage::DynamicUsage(mapAddressInserted) + cachedAddressUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -364,6 +364,37 @@ public:
     }
 };
 
+/** Mempool address index key: script hash, then the transaction and its
+ *  output paying to the script or its input spending from it.
+ */
+struct CMempoolAddressKey {
+    uint160 hashScript;
+    uint256 txid;
+    uint32_t index;
+    bool fSpend;
+
+    CMempoolAddressKey(const uint160& phashScript, const uint256& ptxid, uint32_t pindex, bool pfSpend) :
+        hashScript(phashScript), txid(ptxid), index(pindex), fSpend(pfSpend) {}
+    CMempoolAddressKey() : index(0), fSpend(false) {}
+
+    friend bool operator<(const CMempoolAddressKey& a, const CMempoolAddressKey& b) {
+        if (a.hashScript != b.hashScript) return a.hashScript < b.hashScript;
+        if (a.txid != b.txid) return a.txid < b.txid;
+        if (a.fSpend != b.fSpend) return a.fSpend < b.fSpend;
+        return a.index < b.index;
+    }
+};
+
+/** What an unconfirmed transaction does to a script's balance. */
+struct CMempoolAddressDelta {
+    int64_t nTime;     //!< When the transaction entered the mempool
+    CAmount amount;    //!< Received by an output, or minus the value spent by an input
+    COutPoint prevout; //!< The output spent by an input, null for an output
+
+    CMempoolAddressDelta(int64_t pnTime, CAmount pamount, const COutPoint& pprevout = COutPoint()) :
+        nTime(pnTime), amount(pamount), prevout(pprevout) {}
+};
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain transactions
  * that may be included in the next block.
@@ -513,6 +544,16 @@ private:
 
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
+    typedef std::map<CMempoolAddressKey, CMempoolAddressDelta> addressDeltaMap;
+    bool fAddressIndex GUARDED_BY(cs);
+    addressDeltaMap mapAddress GUARDED_BY(cs);
+    //! The mapAddress keys of each transaction, to remove them with it
+    std::map<uint256, std::vector<CMempoolAddressKey>> mapAddressInserted GUARDED_BY(cs);
+    uint64_t cachedAddressUsage GUARDED_BY(cs); //!< dynamic memory usage of the mapAddressInserted vectors
+
+    void addAddressIndex(const CTxMemPoolEntry& entry) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void removeAddressIndex(const uint256& txid) EXCLUSIVE_LOCKS_REQUIRED(cs);
+
 public:
     indirectmap<COutPoint, const CTransaction*> mapNextTx GUARDED_BY(cs);
     std::map<uint256, CAmount> mapDeltas;
@@ -530,6 +571,11 @@ public:
     void check(const CCoinsViewCache *pcoins) const;
     void setSanityCheck(double dFrequency = 1.0) { LOCK(cs); nCheckFrequency = static_cast<uint32_t>(dFrequency * 4294967295.0); }
 
+    /** Index the outputs and spent outputs of the transactions by script. Call before the mempool is loaded. */
+    void setAddressIndex(bool fEnable);
+    /** Unconfirmed credits and debits of the script with this hash, oldest first. False if the index is off. */
+    bool getAddressIndex(const uint160& hashScript, std::vector<std::pair<CMempoolAddressKey, CMempoolAddressDelta>>& vDeltas) const;
+
     // addUnchecked must updated state for all ancestors of a given transaction,
     // to track size/count of descendant transactions.  First version of
     // addUnchecked can be used to have it call CalculateMemPoolAncestors(), and
@@ -648,7 +694,8 @@ public:
 
     size_t DynamicMemoryUsage() const;
 
-    boost::signals2::signal<void (CTransactionRef)> NotifyEntryAdded;
+    /** Fired with the modified fee of the new entry, prioritisetransaction delta included */
+    boost::signals2::signal<void (CTransactionRef, CAmount)> NotifyEntryAdded;
     boost::signals2::signal<void (CTransactionRef, MemPoolRemovalReason)> NotifyEntryRemoved;
 
 private:
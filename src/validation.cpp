@@ -6,6 +6,7 @@
 
 #include <validation.h>
 
+#include <addressindex.h>
 #include <arith_uint256.h>
 #include <chain.h>
 #include <chainparams.h>
@@ -145,13 +146,15 @@ public:
      * If a block header hasn't already been seen, call CheckBlockHeader on it, ensure
      * that it doesn't descend from an invalid block, and then add it to mapBlockIndex.
      */
-    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW = true) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     // Block (dis)connection on a given view:
-    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
+    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view,
+                    std::vector<std::pair<CAddressIndexKey, CAddressValue>>* pAddressDeltas = nullptr);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false);
+                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false,
+                    std::vector<std::pair<CAddressIndexKey, CAddressValue>>* pAddressDeltas = nullptr);
 
     // Block disconnection on our pcoinsTip:
     bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool);
@@ -1473,7 +1476,9 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
-static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
+} // namespace
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
 {
     CDiskBlockPos pos = pindex->GetUndoPos();
     if (pos.IsNull()) {
@@ -1504,6 +1509,8 @@ static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 static bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1558,9 +1565,57 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
+/** Address index rows changed by connecting (or disconnecting) a block, in the order they apply. The spent
+ *  outputs come from the block undo data, so no coins view is needed. */
+static bool GetAddressDeltas(const CBlock& block, const CBlockUndo& blockundo, int nHeight, bool fConnect,
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>>& vDeltas)
+{
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return false;
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        if (blockundo.vtxundo[i - 1].vprevout.size() != block.vtx[i]->vin.size())
+            return false;
+    }
+
+    if (fConnect) {
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            const CTransaction &tx = *(block.vtx[i]);
+            for (size_t j = 0; i > 0 && j < tx.vin.size(); j++) {
+                const Coin &coin = blockundo.vtxundo[i - 1].vprevout[j];
+                CAddressValue addrval(coin.out.nValue, coin.nHeight);
+                addrval.addSpend(tx.GetHash(), j, nHeight);
+                if (!fTxIndex) addrval.height = 0;
+                vDeltas.push_back(std::make_pair(CAddressIndexKey(coin.out.scriptPubKey, coin.nHeight, tx.vin[j].prevout), addrval));
+            }
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                const CTxOut &out = tx.vout[k];
+                if (out.scriptPubKey.IsUnspendable()) continue;
+                vDeltas.push_back(std::make_pair(CAddressIndexKey(out.scriptPubKey, nHeight, COutPoint(tx.GetHash(), k)),
+                            CAddressValue(out.nValue, nHeight)));
+            }
+        }
+    } else {
+        for (int i = block.vtx.size() - 1; i >= 0; i--) {
+            const CTransaction &tx = *(block.vtx[i]);
+            for (unsigned int k = tx.vout.size(); k-- > 0;) {
+                const CTxOut &out = tx.vout[k];
+                if (out.scriptPubKey.IsUnspendable()) continue;
+                vDeltas.push_back(std::make_pair(CAddressIndexKey(out.scriptPubKey, nHeight, COutPoint(tx.GetHash(), k)), CAddressValue()));
+            }
+            for (unsigned int j = tx.vin.size(); i > 0 && j-- > 0;) {
+                const Coin &coin = blockundo.vtxundo[i - 1].vprevout[j];
+                vDeltas.push_back(std::make_pair(CAddressIndexKey(coin.out.scriptPubKey, coin.nHeight, tx.vin[j].prevout),
+                            CAddressValue(coin.out.nValue, coin.nHeight)));
+            }
+        }
+    }
+    return true;
+}
+
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  When FAILED is returned, view is left in an indeterminate state. */
-DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
+DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view,
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>>* pAddressDeltas)
 {
     bool fClean = true;
 
@@ -1575,7 +1630,10 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
         return DISCONNECT_FAILED;
     }
 
-    std::vector<std::pair<CAddressKey, CAddressValue>> addressKeyValue;
+    if (pAddressDeltas && !GetAddressDeltas(block, blockUndo, pindex->nHeight, false, *pAddressDeltas)) {
+        error("DisconnectBlock(): transaction and undo data inconsistent");
+        return DISCONNECT_FAILED;
+    }
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
@@ -1583,12 +1641,6 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
         uint256 hash = tx.GetHash();
         bool is_coinbase = tx.IsCoinBase();
 
-        for (unsigned int k = tx.vout.size(); k-- > 0;) {
-            const CTxOut &out = tx.vout[k];
-            if (out.scriptPubKey.IsUnspendable()) continue;
-            addressKeyValue.push_back(std::make_pair(CAddressKey(out.scriptPubKey, COutPoint(hash, k)), CAddressValue()));
-        }
-
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
         for (size_t o = 0; o < tx.vout.size(); o++) {
@@ -1614,19 +1666,11 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
                 int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
                 if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
                 fClean = fClean && res != DISCONNECT_UNCLEAN;
-                const Coin &coin = view.AccessCoin(out);
-                addressKeyValue.push_back(std::make_pair(CAddressKey(coin.out.scriptPubKey, out), 
-                            CAddressValue(coin.out.nValue, coin.nHeight)));
             }
             // At this point, all of txundo.vprevout should have been moved out.
         }
     }
 
-    if (!pblocktree->WriteAddress(addressKeyValue)) {
-        AbortNode("Failed to write address");
-        return DISCONNECT_FAILED;
-    }
-
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -1757,60 +1801,48 @@ bool GetStakeModifier (const CBlockIndex* pindexCurrent, uint64_t& nStakeModifie
         return true;
     }
 
-    // Sort candidate blocks by timestamp
-    std::vector<std::pair<int64_t, uint256>> vSortedByTimestamp;
-    vSortedByTimestamp.reserve(64 * consensus.nStakeModifierInterval / consensus.nPosTargetSpacing);
+    // Candidate blocks sorted by timestamp, then by block hash; the selection hash of each
+    // candidate only depends on the previous modifier, so it is computed once up front.
+    struct StakeModifierCandidate {
+        const CBlockIndex* pindex;
+        int64_t nTime;
+        arith_uint256 hashSelection;
+    };
+    std::vector<StakeModifierCandidate> vCandidates;
+    vCandidates.reserve(64 * consensus.nStakeModifierInterval / consensus.nPosTargetSpacing);
     int64_t nSelectionInterval = GetStakeModifierSelectionInterval();
     int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / consensus.nStakeModifierInterval) * consensus.nStakeModifierInterval - nSelectionInterval;
-    const CBlockIndex* pindex = pindexPrev;
-    while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart) {
-        vSortedByTimestamp.push_back(std::make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()));
-        pindex = pindex->pprev;
+    for (const CBlockIndex* pindex = pindexPrev; pindex && pindex->GetBlockTime() >= nSelectionIntervalStart; pindex = pindex->pprev) {
+        // compute the selection hash by hashing its proof-hash and the
+        // previous proof-of-stake modifier
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << (pindex->IsProofOfStake() ? pindex->hashProofOfStake : pindex->GetBlockHash()) << nStakeModifier;
+        arith_uint256 hashSelection = UintToArith256(ss.GetHash());
+        if (pindex->IsProofOfStake()) hashSelection >>= 32;
+        vCandidates.push_back(StakeModifierCandidate{pindex, pindex->GetBlockTime(), hashSelection});
     }
-    int nHeightFirstCandidate = pindex ? (pindex->nHeight + 1) : 0;
-    reverse(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
-    sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
+    std::sort(vCandidates.begin(), vCandidates.end(), [](const StakeModifierCandidate& a, const StakeModifierCandidate& b) {
+        return a.nTime != b.nTime ? a.nTime < b.nTime : *a.pindex->phashBlock < *b.pindex->phashBlock;
+    });
 
     // Select 64 blocks from candidate blocks to generate stake modifier
     uint64_t nStakeModifierNew = 0;
     int64_t nSelectionIntervalStop = nSelectionIntervalStart;
-    std::map<uint32_t, arith_uint256> mapHash;
-    std::map<uint32_t, bool> mapSelected;
-    for (int nRound=0; nRound<std::min(64, (int)vSortedByTimestamp.size()); nRound++) {
+    std::vector<bool> vSelected(vCandidates.size(), false);
+    size_t nFirstUnselected = 0;
+    for (int nRound=0; nRound<std::min(64, (int)vCandidates.size()); nRound++) {
         // add an interval section to the current selection round
         nSelectionIntervalStop += GetStakeModifierSelectionIntervalSection(nRound);
-        // select a block from the candidates of current round
-        bool fSelected = false;
-        arith_uint256 hashBest = 0;
-        for (const std::pair<int64_t, uint256>& item : vSortedByTimestamp) {
-            const CBlockIndex* pi = LookupBlockIndex(item.second);
-            if (!pi) return error("GetStakeModifier: failed to find block index for candidate block %s", item.second.ToString());
-            if (fSelected && pi->GetBlockTime() > nSelectionIntervalStop) break;
-            if (mapSelected.count(pi->nHeight) > 0) continue;
-
-            // compute the selection hash by hashing its proof-hash and the
-            // previous proof-of-stake modifier
-            arith_uint256 hashSelection;
-            if (mapHash.count(pi->nHeight) > 0) { hashSelection = mapHash[pi->nHeight]; } else {
-                uint256 hashProof = pi->IsProofOfStake() ? pi->hashProofOfStake : pi->GetBlockHash();
-                CDataStream ss(SER_GETHASH, 0);
-                ss << hashProof << nStakeModifier;
-                hashSelection = UintToArith256(Hash(ss.begin(), ss.end()));
-                if (pi->IsProofOfStake()) hashSelection >>= 32;
-                mapHash[pi->nHeight] = hashSelection;
-            }
-            if (fSelected && hashSelection < hashBest) {
-                hashBest = hashSelection;
-                pindex = pi;
-            } else if (!fSelected) {
-                fSelected = true;
-                hashBest = hashSelection;
-                pindex = pi;
-            }
+        // select a block from the candidates of current round: the lowest selection hash up to the
+        // stop time, or the first unselected candidate if none is that early
+        while (vSelected[nFirstUnselected]) nFirstUnselected++;
+        size_t nBest = nFirstUnselected;
+        for (size_t i = nFirstUnselected + 1; i < vCandidates.size() && vCandidates[i].nTime <= nSelectionIntervalStop; i++) {
+            if (!vSelected[i] && vCandidates[i].hashSelection < vCandidates[nBest].hashSelection) nBest = i;
         }
-        if (fSelected) mapSelected [pindex->nHeight] = true;
-        LogPrint(BCLog::SELECTCOINS, "GetStakeModifier: selection hash=%s\n", hashBest.ToString());
-        if (!fSelected) return error("GetStakeModifier: unable to select block at round %d", nRound);
+        vSelected[nBest] = true;
+        const CBlockIndex* pindex = vCandidates[nBest].pindex;
+        LogPrint(BCLog::SELECTCOINS, "GetStakeModifier: selection hash=%s\n", vCandidates[nBest].hashSelection.ToString());
         // write the entropy bit of the selected block
         nStakeModifierNew |= (((uint64_t)pindex->GetStakeEntropyBit()) << nRound);
         // add the selected block from candidates to selected list
@@ -1857,7 +1889,8 @@ static int64_t nBlocksTotal = 0;
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
  *  can fail if those validity checks fail (among other reasons). */
 bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck,
+                  std::vector<std::pair<CAddressIndexKey, CAddressValue>>* pAddressDeltas)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -1881,7 +1914,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         if (!pcoinsTip->GetCoin(prevout, coin)) 
             return state.DoS(1, error("CheckProofOfStake(): Coin not found"));
         correctCoin (prevout, coin, "ConnectBlock");
-        if (!CheckProofOfStake (block.GetBlockHeader(), pindex->nHeight, consensus, prevout, coin.out.nValue, 
+        if (!CheckProofOfStake (block.GetBlockHeader(), pindex->pprev, consensus, prevout, coin.out.nValue, 
                     coin.nTime, coin.nOffset, &hashProofOfStake)) {
             LogPrintf("WARNING: %s: check proof-of-stake failed for block %s\n", __func__, block.GetHash().ToString());
             return state.DoS(1, error("CheckProofOfStake(): check kernel failed on block %s", block.GetHash().ToString()));
@@ -2007,7 +2040,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     int64_t nSigOpsCost = 0;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     std::vector<PrecomputedTransactionData> txdata;
-    std::vector<std::pair<CAddressKey, CAddressValue>> addressKeyValue;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
     CAmount posReward = 0;
     uint32_t tx_index_in_block = GetSizeOfCompactSize(block.vtx.size()) + CBlockHeader::NORMAL_SERIALIZE_SIZE;
@@ -2060,14 +2092,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             }
         }
 
-        for (size_t j = 0; j < tx.vin.size(); j++) {
-            const Coin& coin = view.AccessCoin(tx.vin[j].prevout);
-            CAddressValue addrval(coin.out.nValue, coin.nHeight);
-            addrval.addSpend (tx.GetHash(), j, pindex->nHeight);
-            if (!fTxIndex) addrval.height = 0;
-            addressKeyValue.push_back(std::make_pair(CAddressKey(coin.out.scriptPubKey, tx.vin[j].prevout), addrval));
-        }
-
         // GetTransactionSigOpCost counts 3 types of sigops:
         // * legacy (always)
         // * p2sh (when P2SH enabled in flags and excludes coinbase)
@@ -2088,13 +2112,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             control.Add(vChecks);
         }
 
-        for (unsigned int k = 0; k < tx.vout.size(); k++) {
-            const CTxOut &out = tx.vout[k];
-            if (out.scriptPubKey.IsUnspendable()) continue;
-            addressKeyValue.push_back(std::make_pair(CAddressKey(out.scriptPubKey, COutPoint(tx.GetHash(), k)),
-                        CAddressValue(out.nValue, pindex->nHeight)));
-        }
-
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2142,10 +2159,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!WriteTxIndexDataForBlock(block, state, pindex))
         return false;
 
-    if (!pblocktree->WriteAddress(addressKeyValue)) {
-        AbortNode("Failed to write address");
-        return DISCONNECT_FAILED;
-    }
+    if (pAddressDeltas && !GetAddressDeltas(block, blockundo, pindex->nHeight, true, *pAddressDeltas))
+        return error("ConnectBlock(): transaction and undo data inconsistent");
 
     assert(pindex->phashBlock);
     // add this block to the view's block chain
@@ -2179,6 +2194,94 @@ void correctCoin (const COutPoint &prevout, Coin& coin, std::string caller) {
     }
 }
 
+/** Fill nTime/nOffset of the legacy coins of one batch, reading each block once. Returns the number of coins updated. */
+static size_t BackfillCoinsBatch(const std::map<int, std::vector<COutPoint>>& mapPending, const CChainParams& chainparams)
+{
+    size_t nUpdated = 0;
+    for (const auto& entry : mapPending) {
+        CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = chainActive[entry.first];
+        }
+        if (!pindex) continue;
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus())) continue;
+        std::map<uint256, uint32_t> mapOffsets;
+        uint32_t tx_index_in_block = GetSizeOfCompactSize(block.vtx.size()) + CBlockHeader::NORMAL_SERIALIZE_SIZE;
+        for (const auto& tx : block.vtx) {
+            mapOffsets[tx->GetHash()] = tx_index_in_block;
+            tx_index_in_block += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        }
+
+        // Go through the tip cache so coins spent meanwhile are not brought back.
+        LOCK(cs_main);
+        if (chainActive[entry.first] != pindex) continue;
+        for (const COutPoint& outpoint : entry.second) {
+            Coin coin;
+            if (!pcoinsTip->GetCoin(outpoint, coin) || coin.nHeight != (uint32_t)entry.first) continue;
+            if ((coin.nTime != 0) && (coin.nOffset != 0)) continue;
+            std::map<uint256, uint32_t>::const_iterator it = mapOffsets.find(outpoint.hash);
+            if (it == mapOffsets.end()) continue;
+            coin.nTime = pindex->GetBlockTime();
+            coin.nOffset = it->second;
+            pcoinsTip->AddCoin(outpoint, std::move(coin), true);
+            nUpdated++;
+        }
+    }
+    LOCK(cs_main);
+    CValidationState state;
+    FlushStateToDisk(chainparams, state, FlushStateMode::IF_NEEDED);
+    return nUpdated;
+}
+
+bool BackfillCoinsKernelData(const CChainParams& chainparams)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    {
+        LOCK(cs_main);
+        bool fDone = false;
+        if (pblocktree->ReadFlag("coinskerneldata", fDone) && fDone) return true;
+        // Coins created since the upgrade already carry their kernel data; only the database needs a scan.
+        CValidationState state;
+        if (!FlushStateToDisk(chainparams, state, FlushStateMode::ALWAYS)) return false;
+        pcursor.reset(pcoinsdbview->Cursor());
+    }
+    LogPrintf("Backfilling time and offset of legacy coins...\n");
+
+    std::map<int, std::vector<COutPoint>> mapPending;
+    size_t nPending = 0, nUpdated = 0;
+    while (true) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) return false;
+        bool fValid = pcursor->Valid();
+        if (fValid) {
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+                return error("%s: unable to read coins database", __func__);
+            if ((coin.nTime == 0) || (coin.nOffset == 0)) {
+                mapPending[coin.nHeight].push_back(key);
+                nPending++;
+            }
+            pcursor->Next();
+        }
+        if (nPending >= COINS_BACKFILL_BATCH || (!fValid && nPending > 0)) {
+            nUpdated += BackfillCoinsBatch(mapPending, chainparams);
+            mapPending.clear();
+            nPending = 0;
+        }
+        if (!fValid) break;
+    }
+
+    LOCK(cs_main);
+    CValidationState state;
+    if (!FlushStateToDisk(chainparams, state, FlushStateMode::ALWAYS)) return false;
+    pblocktree->WriteFlag("coinskerneldata", true);
+    LogPrintf("Backfilled time and offset of %u legacy coins\n", nUpdated);
+    return true;
+}
+
 bool GetCoinAge(const CTransaction& tx, const CCoinsViewCache& view, uint64_t& nCoinAge, uint32_t nTime, const Consensus::Params& params)
 {
     arith_uint256 bnCentSecond = 0;  // coin age in the unit of cent-seconds
@@ -2204,11 +2307,106 @@ bool GetCoinAge(const CTransaction& tx, const CCoinsViewCache& view, uint64_t& n
     return true;
 }
 
-bool CheckProofOfStake (const CBlockHeader& block, int height, const Consensus::Params& params, const COutPoint &out, 
-            CAmount value, uint32_t time, uint32_t offset, uint256* hashProofOfStake) {
+void CStakeModifierIndex::BlockConnected(const CBlockIndex* pindex) {
+    if (pindex->pprev != pindexBest) return;
+    if (pindex->GeneratedStakeModifier()) {
+        Entry entry{pindex->GetBlockTime(), pindex->nStakeModifier, pindex->nHeight};
+        std::map<int64_t, Entry>::iterator it = mapByTime.lower_bound(entry.nTime);
+        if (it != mapByTime.end()) {
+            std::vector<Entry>& vDisplaced = mapDisplaced[entry.nHeight];
+            for (std::map<int64_t, Entry>::iterator jt = it; jt != mapByTime.end(); ++jt)
+                vDisplaced.push_back(jt->second);
+            mapByTime.erase(it, mapByTime.end());
+        }
+        mapByTime.emplace(entry.nTime, entry);
+    }
+    pindexBest = pindex;
+}
+
+void CStakeModifierIndex::BlockDisconnected(const CBlockIndex* pindex) {
+    if (pindex != pindexBest) return;
+    if (!mapByTime.empty() && mapByTime.rbegin()->second.nHeight == pindex->nHeight) {
+        mapByTime.erase(std::prev(mapByTime.end()));
+        std::map<int, std::vector<Entry>>::iterator it = mapDisplaced.find(pindex->nHeight);
+        if (it != mapDisplaced.end()) {
+            for (const Entry& entry : it->second)
+                mapByTime.emplace(entry.nTime, entry);
+            mapDisplaced.erase(it);
+        }
+    }
+    pindexBest = pindex->pprev;
+}
+
+void CStakeModifierIndex::Sync(const CChain& chain) {
+    while (pindexBest && chain[pindexBest->nHeight] != pindexBest)
+        BlockDisconnected(pindexBest);
+    int nHeight = pindexBest ? pindexBest->nHeight : -1;
+    while (nHeight < chain.Height())
+        BlockConnected(chain[++nHeight]);
+}
+
+bool CStakeModifierIndex::Lookup(int64_t nBound, Entry& entry) const {
+    if (!pindexBest) return false;
+    // The tip's own modifier is never used by a block built on it: look at the index as it was before the tip.
+    std::map<int64_t, Entry>::const_iterator itEnd = mapByTime.end();
+    if (!mapByTime.empty() && mapByTime.rbegin()->second.nHeight == pindexBest->nHeight) {
+        --itEnd;
+        std::map<int, std::vector<Entry>>::const_iterator it = mapDisplaced.find(pindexBest->nHeight);
+        if (it != mapDisplaced.end()) {
+            for (std::vector<Entry>::const_reverse_iterator rit = it->second.rbegin(); rit != it->second.rend(); ++rit) {
+                if (rit->nTime <= nBound) {
+                    entry = *rit;
+                    return true;
+                }
+            }
+        }
+    }
+    std::map<int64_t, Entry>::const_iterator it = mapByTime.upper_bound(nBound);
+    if (it == mapByTime.end()) it = itEnd;
+    if (it == mapByTime.begin()) return false;
+    entry = (--it)->second;
+    return true;
+}
+
+void CStakeModifierIndex::Clear() {
+    mapByTime.clear();
+    mapDisplaced.clear();
+    pindexBest = nullptr;
+}
+
+static CStakeModifierIndex stakemodifierindex GUARDED_BY(cs_main);
+
+bool GetKernelStakeModifier (const CBlockIndex* pindexPrev, uint32_t time, const Consensus::Params& params, uint64_t& nStakeModifier) {
+    AssertLockHeld(cs_main);
+    if (!pindexPrev) return false;
+    int64_t nStakeModifierBound = GetStakeModifierSelectionInterval() + time - params.nStakeMinAge; // time + 589120 sec
+    if (pindexPrev->GetBlockTime() <= nStakeModifierBound) return false;
+    stakemodifierindex.Sync(chainActive);
+    if (pindexPrev == stakemodifierindex.Tip()) {
+        CStakeModifierIndex::Entry entry;
+        if (!stakemodifierindex.Lookup(nStakeModifierBound, entry)) return false;
+        nStakeModifier = entry.nStakeModifier;
+        LogPrint(BCLog::SELECTCOINS, "CheckProofOfStake(): using modifier 0x%016" PRIx64 " at height=%d\n", nStakeModifier, entry.nHeight);
+        return true;
+    }
+    // Block off the active chain: walk back from its parent.
+    const CBlockIndex* pindex = pindexPrev;
+    int64_t nStakeModifierTime = pindex->GetBlockTime();
+    while (nStakeModifierTime > nStakeModifierBound) {
+        if (!pindex->pprev) return false;
+        pindex = pindex->pprev;
+        if (pindex->GeneratedStakeModifier()) nStakeModifierTime = pindex->GetBlockTime();
+    }
+    nStakeModifier = pindex->nStakeModifier;
+    LogPrint(BCLog::SELECTCOINS, "CheckProofOfStake(): using modifier 0x%016" PRIx64 " at height=%d\n", nStakeModifier, pindex->nHeight);
+    return true;
+}
+
+bool CheckStakeKernelHash (const CBlockHeader& block, int height, const Consensus::Params& params, const COutPoint &out,
+            CAmount value, uint32_t time, uint32_t offset, uint64_t nStakeModifier, uint256* hashProofOfStake) {
     arith_uint256 bnTarget;
     bnTarget.SetCompact(block.nBits);
-    CDataStream ss(SER_GETHASH, 0);
+    CHashWriter ss(SER_GETHASH, 0);
     if (params.forkNumber(height) >= 3) {
         if ((block.nTime < time) || (block.nTime - time < params.nCoinAgeTick)) return false;
         arith_uint256 bnTargetHi = (~arith_uint256 (0)) >> 8;
@@ -2221,24 +2419,9 @@ bool CheckProofOfStake (const CBlockHeader& block, int height, const Consensus::
     } else {
         int64_t nTimeWeight = std::min((int64_t)block.nTime - time, params.nStakeMaxAge) - params.nStakeMinAge;
         bnTarget *= arith_uint256(value) * nTimeWeight / COIN / params.nCoinAgeTick;
-        const CBlockIndex* pindex = chainActive.Tip();
-        int nStakeModifierHeight = pindex->nHeight;
-        int64_t nStakeModifierTime = pindex->GetBlockTime();
-        int64_t nStakeModifierBound = GetStakeModifierSelectionInterval() + time - params.nStakeMinAge; // time + 589120 sec
-        if (nStakeModifierTime <= nStakeModifierBound) return false;
-        while (nStakeModifierTime > nStakeModifierBound) {
-            if (!pindex->pprev) return false;
-            pindex = pindex->pprev;
-            if (pindex->GeneratedStakeModifier()) {
-                nStakeModifierHeight = pindex->nHeight;
-                nStakeModifierTime = pindex->GetBlockTime();
-            }
-        }
-        uint64_t nStakeModifier = pindex->nStakeModifier;
         ss << nStakeModifier << time << offset << time << out.n << block.nTime;
-        LogPrint(BCLog::SELECTCOINS, "CheckProofOfStake(): using modifier 0x%016" PRIx64 " at height=%d\n", nStakeModifier, nStakeModifierHeight);
     }
-    uint256 hash = Hash(ss.begin(), ss.end());
+    uint256 hash = ss.GetHash();
     LogPrint(BCLog::SELECTCOINS, "CheckProofOfStake(): TimeDiff=%d, hash=%s, target=%s\n",
         (block.nTime-time)/60, hash.ToString().substr(0,7), bnTarget.ToString().substr(0,7));
     if (UintToArith256(hash) > bnTarget) return false;
@@ -2246,24 +2429,55 @@ bool CheckProofOfStake (const CBlockHeader& block, int height, const Consensus::
     return true;
 }
 
-bool CheckProofOfWork (const CBlockHeader& block, int height, const Consensus::Params& params) {
+bool CheckProofOfStake (const CBlockHeader& block, const CBlockIndex* pindexPrev, const Consensus::Params& params, const COutPoint &out, 
+            CAmount value, uint32_t time, uint32_t offset, uint256* hashProofOfStake) {
+    uint64_t nStakeModifier = 0;
+    int height = pindexPrev->nHeight + 1;
+    if (params.forkNumber(height) < 3 && !GetKernelStakeModifier(pindexPrev, time, params, nStakeModifier)) return false;
+    return CheckStakeKernelHash(block, height, params, out, value, time, offset, nStakeModifier, hashProofOfStake);
+}
+
+bool CheckProofOfWorkHash (const uint256& hash, uint32_t nBits, int height, const Consensus::Params& params) {
     bool fNegative;
     bool fOverflow;
     arith_uint256 bnTarget;
     arith_uint256 powLimit = height < params.nLyra2ZHeight ? params.powLimitLegacy : params.powLimit;
     if (params.forkNumber(height) >= 3) powLimit = params.powLimitLegacy;
-    bnTarget.SetCompact (block.nBits, &fNegative, &fOverflow);
+    bnTarget.SetCompact (nBits, &fNegative, &fOverflow);
 
     // Check range
     if (fNegative || bnTarget == 0 || fOverflow || bnTarget > powLimit)
         return false;
-    
-    uint256 hash = block.GetPoWHash (height, params);
 
     // Check proof of work matches claimed amount
     return !(UintToArith256(hash) > bnTarget);
 }
 
+static CPoWHashCache powhashcache(POW_HASH_CACHE_SIZE);
+
+uint256 GetBlockPoWHash (const CBlockHeader& block, int height, const Consensus::Params& params) {
+    uint256 hashBlock = block.GetHash();
+    bool fLyra2Z = height >= params.nLyra2ZHeight;
+    CPoWHash entry;
+    // A caller that could not resolve the height may ask for the other algorithm; never serve that from the cache.
+    if (powhashcache.Get(hashBlock, entry) && entry.fLyra2Z == fLyra2Z)
+        return entry.hash;
+    if (pblocktree && pblocktree->ReadPoWHash(hashBlock, entry) && entry.fLyra2Z == fLyra2Z) {
+        powhashcache.Insert(hashBlock, entry);
+        return entry.hash;
+    }
+    entry = CPoWHash(block.GetPoWHash (height, params), fLyra2Z);
+    // Only a hash that meets its target is kept: anyone can send headers that fail, and those
+    // would evict the entries header sync and ContextualCheckBlockHeader come back for.
+    if (CheckProofOfWorkHash(entry.hash, block.nBits, height, params))
+        powhashcache.Insert(hashBlock, entry);
+    return entry.hash;
+}
+
+bool CheckProofOfWork (const CBlockHeader& block, int height, const Consensus::Params& params) {
+    return CheckProofOfWorkHash(GetBlockPoWHash(block, height, params), block.nBits, height, params);
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -2309,7 +2523,7 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             nLastFlush = nNow;
         }
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage() + pblocktree->AddressCacheUsage();
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FlushStateMode::PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
@@ -2343,7 +2557,15 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                     vBlocks.push_back(*it);
                     setDirtyBlockIndex.erase(it++);
                 }
-                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+                // Persist the PoW hashes of the written entries, so they survive restarts and verifychain.
+                std::vector<std::pair<uint256, CPoWHash> > vPoWHashes;
+                for (const CBlockIndex* pindex : vBlocks) {
+                    CPoWHash entry;
+                    if (pindex->IsProofOfWork() && powhashcache.Get(pindex->GetBlockHash(), entry) &&
+                        entry.fLyra2Z == (pindex->nHeight >= chainparams.GetConsensus().nLyra2ZHeight))
+                        vPoWHashes.emplace_back(pindex->GetBlockHash(), entry);
+                }
+                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks, vPoWHashes)) {
                     return AbortNode(state, "Failed to write to block index database");
                 }
             }
@@ -2364,6 +2586,9 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // Flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            // The address index follows; after a crash in between it catches up again in the background.
+            if (g_addressindex && g_addressindex->IsSynced() && !pblocktree->FlushAddress(pcoinsTip->GetBestBlock()))
+                return AbortNode(state, "Failed to write to address index");
             nLastFlush = nNow;
             full_flush_completed = true;
         }
@@ -2456,10 +2681,16 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     {
         CCoinsViewCache view(pcoinsTip.get());
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        std::vector<std::pair<CAddressIndexKey, CAddressValue>> vAddressDeltas;
+        bool fAddressIndex = g_addressindex && g_addressindex->IsSynced();
+        if (DisconnectBlock(block, pindexDelete, view, fAddressIndex ? &vAddressDeltas : nullptr) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = view.Flush();
         assert(flushed);
+        if (fAddressIndex) {
+            pblocktree->CacheAddress(vAddressDeltas);
+            g_addressindex->SetBestBlock(pindexDelete->pprev);
+        }
     }
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * MILLI);
     // Write the chain state to disk, if necessary.
@@ -2480,6 +2711,7 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     }
 
     chainActive.SetTip(pindexDelete->pprev);
+    stakemodifierindex.BlockDisconnected(pindexDelete);
 
     UpdateTip(pindexDelete->pprev, chainparams);
     // Let wallets know transactions went from 1-confirmed to
@@ -2586,7 +2818,9 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
     {
         CCoinsViewCache view(pcoinsTip.get());
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        std::vector<std::pair<CAddressIndexKey, CAddressValue>> vAddressDeltas;
+        bool fAddressIndex = g_addressindex && g_addressindex->IsSynced();
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams, false, fAddressIndex ? &vAddressDeltas : nullptr);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2597,6 +2831,10 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
         LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime3 - nTime2) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
         bool flushed = view.Flush();
         assert(flushed);
+        if (fAddressIndex) {
+            pblocktree->CacheAddress(vAddressDeltas);
+            g_addressindex->SetBestBlock(pindexNew);
+        }
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint(BCLog::BENCH, "  - Flush: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime4 - nTime3) * MILLI, nTimeFlush * MICRO, nTimeFlush * MILLI / nBlocksTotal);
@@ -2610,6 +2848,7 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     disconnectpool.removeForBlock(blockConnecting.vtx);
     // Update chainActive & related variables.
     chainActive.SetTip(pindexNew);
+    stakemodifierindex.BlockConnected(pindexNew);
     UpdateTip(pindexNew, chainparams);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
@@ -3550,7 +3789,7 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3573,7 +3812,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
         if (pindexPrev->nStatus & BLOCK_FAILED_MASK)
             return state.DoS(100, error("%s: prev block invalid", __func__), REJECT_INVALID, "bad-prevblk");
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), pindexPrev))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), pindexPrev, fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         if (!ContextualCheckBlockHeader(block, state, chainparams, pindexPrev, GetAdjustedTime()))
@@ -3606,15 +3845,120 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
     return true;
 }
 
+/** Closure checking the PoW of a short run of headers on the PoW check queue. Each header gets
+ *  its own result slot, so a failing header neither fails the check nor cuts the others short.
+ */
+class CPoWCheck
+{
+private:
+    const CBlockHeader* headers;
+    const int* heights;
+    size_t count;
+    const Consensus::Params* params;
+    char* results;
+
+public:
+    static const size_t MAX_HEADERS = 8;
+
+    CPoWCheck(): headers(nullptr), heights(nullptr), count(0), params(nullptr), results(nullptr) {}
+    CPoWCheck(const CBlockHeader* headersIn, const int* heightsIn, size_t countIn, const Consensus::Params& paramsIn, char* resultsIn) :
+        headers(headersIn), heights(heightsIn), count(countIn), params(&paramsIn), results(resultsIn) {}
+
+    bool operator()() {
+        uint256 hashes[MAX_HEADERS];
+        GetPoWHashes(headers, heights, count, *params, hashes);
+        for (size_t i = 0; i < count; i++) {
+            results[i] = CheckProofOfWorkHash(hashes[i], headers[i].nBits, heights[i], *params);
+            // As in GetBlockPoWHash, failing headers are not cached.
+            if (results[i])
+                powhashcache.Insert(headers[i].GetHash(), CPoWHash(hashes[i], heights[i] >= params->nLyra2ZHeight));
+        }
+        return true;
+    }
+
+    void swap(CPoWCheck& check) {
+        std::swap(headers, check.headers);
+        std::swap(heights, check.heights);
+        std::swap(count, check.count);
+        std::swap(params, check.params);
+        std::swap(results, check.results);
+    }
+};
+
+static CCheckQueue<CPoWCheck> powcheckqueue(1);
+
+void ThreadPoWCheck() {
+    RenameThread("coin-powcheck");
+    powcheckqueue.Thread();
+}
+
+/** Check the PoW of the new headers of a connected run without holding cs_main, spread over the
+ *  -par verification threads. Sets fPoWValid[i] for every header whose PoW passed; the others are
+ *  left to the regular per-header check in AcceptBlockHeader, so rejection still happens at the
+ *  same header with the same state.
+ */
+static void CheckHeadersPoW(const std::vector<CBlockHeader>& headers, const Consensus::Params& params, std::vector<char>& fPoWValid) LOCKS_EXCLUDED(cs_main)
+{
+    fPoWValid.assign(headers.size(), false);
+    if (headers.empty()) return;
+
+    std::vector<CBlockHeader> batch;
+    std::vector<int> heights;
+    std::vector<size_t> index;
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexPrev = LookupBlockIndex(headers[0].hashPrevBlock);
+        if (!pindexPrev) return;
+        uint256 hashPrev = headers[0].hashPrevBlock;
+        int nHeight = pindexPrev->nHeight;
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
+            if (header.hashPrevBlock != hashPrev) break;
+            hashPrev = header.GetHash();
+            nHeight++;
+            if (header.IsProofOfStake() || LookupBlockIndex(hashPrev)) continue;
+            CPoWHash entry;
+            if (powhashcache.Get(hashPrev, entry) && entry.fLyra2Z == (nHeight >= params.nLyra2ZHeight)) {
+                fPoWValid[i] = CheckProofOfWorkHash(entry.hash, header.nBits, nHeight, params);
+                continue;
+            }
+            batch.push_back(header);
+            heights.push_back(nHeight);
+            index.push_back(i);
+        }
+    }
+    if (batch.empty()) return;
+
+    std::vector<char> results(batch.size(), false);
+    std::vector<CPoWCheck> vChecks;
+    for (size_t k = 0; k < batch.size(); k += CPoWCheck::MAX_HEADERS) {
+        size_t count = std::min(CPoWCheck::MAX_HEADERS, batch.size() - k);
+        vChecks.emplace_back(&batch[k], &heights[k], count, params, &results[k]);
+    }
+    if (nScriptCheckThreads) {
+        CCheckQueueControl<CPoWCheck> control(&powcheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (CPoWCheck& check : vChecks) check();
+    }
+    for (size_t k = 0; k < batch.size(); k++)
+        fPoWValid[index[k]] = results[k];
+}
+
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
+    // Memory-hard PoW hashing is done up front and in parallel; only the contextual checks need cs_main.
+    std::vector<char> fPoWValid;
+    CheckHeadersPoW(headers, chainparams.GetConsensus(), fPoWValid);
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex, !fPoWValid[i])) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
@@ -4415,6 +4759,21 @@ bool ReplayBlocks(const CChainParams& params, CCoinsView* view) {
     return g_chainstate.ReplayBlocks(params, view);
 }
 
+bool CacheAddressDeltas(const CBlockIndex* pindex, bool fConnect, const CChainParams& chainparams)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+        return error("%s: ReadBlockFromDisk() failed at %d, hash=%s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+    CBlockUndo blockundo;
+    if (!UndoReadFromDisk(blockundo, pindex))
+        return error("%s: UndoReadFromDisk() failed at %d, hash=%s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+    std::vector<std::pair<CAddressIndexKey, CAddressValue>> vDeltas;
+    if (!GetAddressDeltas(block, blockundo, pindex->nHeight, fConnect, vDeltas))
+        return error("%s: block and undo data inconsistent at %d, hash=%s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+    pblocktree->CacheAddress(vDeltas);
+    return true;
+}
+
 bool RewindBlockIndex(const CChainParams& params) {
     return true;
 }
@@ -4431,6 +4790,7 @@ void UnloadBlockIndex()
 {
     LOCK(cs_main);
     chainActive.SetTip(nullptr);
+    stakemodifierindex.Clear();
     pindexBestInvalid = nullptr;
     pindexBestHeader = nullptr;
     mempool.clear();
@@ -35,6 +35,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CChainParams;
 class CCoinsViewDB;
 class CInv;
@@ -265,6 +266,8 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header PoW checking thread */
+void ThreadPoWCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -384,6 +387,7 @@ void InitScriptExecutionCache();
 
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -422,6 +426,8 @@ public:
 
 /** Replay blocks that aren't fully applied to the database. */
 bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
+/** Add the address index rows of connecting (or disconnecting) a block to the cache, from its block and undo files. */
+bool CacheAddressDeltas(const CBlockIndex* pindex, bool fConnect, const CChainParams& chainparams);
 
 inline CBlockIndex* LookupBlockIndex(const uint256& hash)
 {
@@ -488,11 +494,65 @@ inline bool IsBlockPruned(const CBlockIndex* pblockindex)
 CScript MakeCheckStakeScript (const CBlock& block);
 
 void correctCoin (const COutPoint &prevout, Coin& coin, std::string caller);
+/** Number of legacy coins collected from the coins database before their blocks are read. */
+static const size_t COINS_BACKFILL_BATCH = 10000;
+/** One-time scan of the coins database filling nTime/nOffset of coins written before they were stored,
+ *  so correctCoin no longer has to read their blocks. Completion is recorded in the block tree database.
+ */
+bool BackfillCoinsKernelData(const CChainParams& chainparams);
 bool GetCoinAge (const CTransaction& tx, const CCoinsViewCache& view, uint64_t& nCoinAge, uint32_t nTime,
     const Consensus::Params& params);
 
+/** Number of PoW hashes kept in memory; older ones are looked up in the block tree database. */
+static const unsigned int POW_HASH_CACHE_SIZE = 50000;
+/** PoW hash of a block header at height, computed at most once and then served from the PoW hash cache. */
+uint256 GetBlockPoWHash (const CBlockHeader& block, int height, const Consensus::Params& params);
 bool CheckProofOfWork (const CBlockHeader& block, int height, const Consensus::Params& params); 
-bool CheckProofOfStake (const CBlockHeader& block, int height, const Consensus::Params& params, const COutPoint &out, 
-    CAmount value, uint32_t time, uint32_t offset, uint256* hashProofOfStake = nullptr);
+/** Check a precomputed PoW hash against nBits and the PoW limit in effect at height. */
+bool CheckProofOfWorkHash (const uint256& hash, uint32_t nBits, int height, const Consensus::Params& params);
+bool CheckProofOfStake (const CBlockHeader& block, const CBlockIndex* pindexPrev, const Consensus::Params& params, const COutPoint &out, 
+    CAmount value, uint32_t time, uint32_t offset, uint256* hashProofOfStake = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+/** Length of the window (in seconds) the blocks of a new stake modifier are selected from. */
+int64_t GetStakeModifierSelectionInterval();
+/** Stake modifier of a pre-fork-3 block: the previous one, or a new one selected from the blocks of the last selection interval. */
+bool GetStakeModifier (const CBlockIndex* pindexCurrent, uint64_t& nStakeModifier, bool& isNewStakeModifier);
+/** Stake modifier used by pre-fork-3 kernels of a coin confirmed at time, for a block built on pindexPrev. */
+bool GetKernelStakeModifier (const CBlockIndex* pindexPrev, uint32_t time, const Consensus::Params& params, uint64_t& nStakeModifier) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/** Blocks of a chain that generated a stake modifier, ordered by block time.
+ *  Only the entries that can still answer a lookup are kept: connecting a generator drops every
+ *  entry with a time at or after its own, so time and height both increase along the map.
+ *  The dropped entries are remembered per height and restored when that block is disconnected.
+ */
+class CStakeModifierIndex
+{
+public:
+    struct Entry {
+        int64_t nTime;
+        uint64_t nStakeModifier;
+        int nHeight;
+    };
+
+private:
+    std::map<int64_t, Entry> mapByTime;
+    std::map<int, std::vector<Entry>> mapDisplaced;
+    const CBlockIndex* pindexBest = nullptr;
+
+public:
+    /** Block the index is synced to. */
+    const CBlockIndex* Tip() const { return pindexBest; }
+    /** Apply pindex on top of the index; ignored unless pindex extends Tip(). */
+    void BlockConnected(const CBlockIndex* pindex);
+    /** Remove pindex from the index; ignored unless pindex is Tip(). */
+    void BlockDisconnected(const CBlockIndex* pindex);
+    /** Bring the index in line with chain. */
+    void Sync(const CChain& chain);
+    /** Latest modifier generated below Tip() by a block with a time at or before nBound. */
+    bool Lookup(int64_t nBound, Entry& entry) const;
+    void Clear();
+};
+/** Kernel hash check with the stake modifier supplied by the caller; touches no chain state, so it needs no locks. */
+bool CheckStakeKernelHash (const CBlockHeader& block, int height, const Consensus::Params& params, const COutPoint &out,
+    CAmount value, uint32_t time, uint32_t offset, uint64_t nStakeModifier, uint256* hashProofOfStake = nullptr);
     
 #endif // BITCOIN_VALIDATION_H
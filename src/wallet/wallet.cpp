@@ -7,6 +7,7 @@
 #include <wallet/wallet.h>
 
 #include <checkpoints.h>
+#include <checkqueue.h>
 #include <chain.h>
 #include <wallet/coincontrol.h>
 #include <consensus/consensus.h>
@@ -29,6 +30,7 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <future>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -1168,6 +1170,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
         return false;
     }
 
+    fStakeCandidatesDirty = true;
     todo.insert(hashTx);
 
     while (!todo.empty()) {
@@ -1222,6 +1225,9 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
     if (conflictconfirms >= 0)
         return;
 
+    // The conflicted transactions no longer spend their inputs
+    fStakeCandidatesDirty = true;
+
     // Do not flush the wallet here for performance reasons
     WalletBatch batch(*database, "r+", false);
 
@@ -1264,6 +1270,7 @@ void CWallet::SyncTransaction(const CTransactionRef& ptx, const CBlockIndex *pin
     if ((pindex == nullptr) && (posInBlock == 0)) {
         auto it = mapWallet.find(ptx->GetHash());
         if (it != mapWallet.end()) {
+            fStakeCandidatesDirty = true;
             it->second.setAbandoned();
             NotifyTransactionChanged(this, ptx->GetHash(), CT_UPDATED);
         }
@@ -1272,6 +1279,8 @@ void CWallet::SyncTransaction(const CTransactionRef& ptx, const CBlockIndex *pin
     if (!AddToWalletIfInvolvingMe(ptx, pindex, posInBlock, update_tx))
         return; // Not one of ours
 
+    UpdateStakeCandidates(*ptx, pindex);
+
     // If a transaction changes 'conflicted' state, that changes the balance
     // available of the outputs it spends. So force those to be
     // recomputed, also:
@@ -1327,6 +1336,7 @@ void CWallet::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const
             if ((wtx.GetDepthInMainChain() <= 0) && (!wtx.isAbandoned()) &&
                     (!wtx.fInMempool) && (GetAdjustedTime() - wtx.nTimeReceived > 15*60)) {
                 wtx.setAbandoned();
+                fStakeCandidatesDirty = true;
                 NotifyTransactionChanged(this, wtx.GetHash(), CT_UPDATED);
                 WalletLogPrintf("clean orphan hash=%s\n", hash.ToString());
             }
@@ -1336,6 +1346,8 @@ void CWallet::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const
 
 void CWallet::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock) {
     LOCK2(cs_main, cs_wallet);
+    // Outputs spent in the disconnected block may be spendable again
+    fStakeCandidatesDirty = true;
 
     for (const CTransactionRef& ptx : pblock->vtx) {
         SyncTransaction(ptx);
@@ -3133,85 +3145,248 @@ bool getCoinInfo (std::map<uint256, uint64_t>& cache, const COutPoint& out, uint
     return true;
 };
 
+int nStakeThreads = 0;
+
+/** Closure searching a slice of the staking candidates for a kernel over the whole search window.
+ *  All slices of one search share pFirstHit, the lowest candidate with a hit so far: a worker stops at it,
+ *  so slices past a hit give up early while those before it still finish and may lower it.
+ */
+class CStakeKernelCheck
+{
+private:
+    const CBlockHeader* header;
+    int nHeight;
+    const CStakeCandidate* begin;
+    const CStakeCandidate* end;
+    uint32_t nSearchInterval;
+    std::atomic<const CStakeCandidate*>* pFirstHit;
+    std::pair<const CStakeCandidate*, uint32_t>* pResult;
+
+public:
+    CStakeKernelCheck(): header(nullptr), nHeight(0), begin(nullptr), end(nullptr), nSearchInterval(0), pFirstHit(nullptr), pResult(nullptr) {}
+    CStakeKernelCheck(const CBlockHeader& headerIn, int nHeightIn, const CStakeCandidate* beginIn, const CStakeCandidate* endIn,
+            uint32_t nSearchIntervalIn, std::atomic<const CStakeCandidate*>& firstHit, std::pair<const CStakeCandidate*, uint32_t>& result) :
+        header(&headerIn), nHeight(nHeightIn), begin(beginIn), end(endIn), nSearchInterval(nSearchIntervalIn), pFirstHit(&firstHit), pResult(&result) {}
+
+    bool operator()() {
+        const Consensus::Params& consensus = Params().GetConsensus();
+        CBlockHeader search = *header;
+        for (const CStakeCandidate* candidate = begin; candidate != end && candidate < pFirstHit->load(); ++candidate) {
+            for (uint32_t n = 0; n < nSearchInterval; n++) {
+                search.nTime = header->nTime - n;
+                if (CheckStakeKernelHash (search, nHeight, consensus, candidate->outpoint, candidate->nValue,
+                        candidate->nTime, candidate->nOffset, candidate->nStakeModifier)) {
+                    *pResult = std::make_pair(candidate, search.nTime);
+                    const CStakeCandidate* first = pFirstHit->load();
+                    while (candidate < first && !pFirstHit->compare_exchange_weak(first, candidate)) {}
+                    return true;
+                }
+            }
+        }
+        return true;
+    }
+
+    void swap(CStakeKernelCheck& check) {
+        std::swap(header, check.header);
+        std::swap(nHeight, check.nHeight);
+        std::swap(begin, check.begin);
+        std::swap(end, check.end);
+        std::swap(nSearchInterval, check.nSearchInterval);
+        std::swap(pFirstHit, check.pFirstHit);
+        std::swap(pResult, check.pResult);
+    }
+};
+
+static CCheckQueue<CStakeKernelCheck> stakecheckqueue(1);
+
+void ThreadStakeKernelSearch() {
+    RenameThread("coin-pos-kernel");
+    stakecheckqueue.Thread();
+}
+
+/** Find a kernel among vCandidates for a block with header's parent and bits, trying header.nTime and the
+ *  nSearchInterval - 1 seconds before it. On success sets header.nTime and returns the kernel candidate:
+ *  the first one in vCandidates with a hit, whatever the number of threads or the order slices finish in.
+ */
+static const CStakeCandidate* FindStakeKernel(CBlockHeader& header, int nHeight, const std::vector<CStakeCandidate>& vCandidates, uint32_t nSearchInterval)
+{
+    if (vCandidates.empty()) return nullptr;
+    std::atomic<const CStakeCandidate*> firstHit(vCandidates.data() + vCandidates.size());
+    // A few slices per thread, so a thread that drew cheap coins can help with the rest
+    size_t nSlices = (nStakeThreads > 1) ? std::min(vCandidates.size(), (size_t)nStakeThreads * 4) : 1;
+    std::vector<std::pair<const CStakeCandidate*, uint32_t> > vResults(nSlices, std::make_pair(nullptr, 0));
+    std::vector<CStakeKernelCheck> vChecks;
+    for (size_t i = 0; i < nSlices; i++) {
+        const CStakeCandidate* begin = vCandidates.data() + vCandidates.size() * i / nSlices;
+        const CStakeCandidate* end = vCandidates.data() + vCandidates.size() * (i + 1) / nSlices;
+        vChecks.emplace_back(header, nHeight, begin, end, nSearchInterval, firstHit, vResults[i]);
+    }
+    if (nSlices > 1) {
+        CCheckQueueControl<CStakeKernelCheck> control(&stakecheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        vChecks[0]();
+    }
+    // Each slice keeps its own first hit, so the first slice with one holds the lowest overall
+    for (const auto& result : vResults) {
+        if (result.first) {
+            header.nTime = result.second;
+            return result.first;
+        }
+    }
+    return nullptr;
+}
+
 // pos: create coin stake transaction
 //
 // taler: in this implementation we send PoS outputs ONLY to bech32 segwit addresses to increase segwit usage
 // and reduce blocks size.
 //
-bool CWallet::CreateCoinStake (CBlockHeader& header, int64_t nSearchInterval, CMutableTransaction &txNew, CAmount& nPosReward)
+bool CWallet::AddStakeCandidate(const COutPoint& outpoint, CAmount nValue)
+{
+    Coin coin;
+    if (!pcoinsTip->GetCoin(outpoint, coin) || (chainActive[coin.nHeight] == nullptr)) return false;
+    correctCoin (outpoint, coin, "AddStakeCandidate");
+    CStakeCandidate& candidate = mapStakeCandidates[outpoint];
+    candidate.outpoint = outpoint;
+    candidate.nValue = nValue;
+    candidate.nTime = coin.nTime;
+    candidate.nOffset = coin.nOffset;
+    candidate.nHeight = coin.nHeight;
+    candidate.fCoinBase = coin.IsCoinBase();
+    candidate.nStakeModifier = 0;
+    return true;
+}
+
+void CWallet::UpdateStakeCandidates(const CTransaction& tx, const CBlockIndex* pindex)
 {
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    if (fStakeCandidatesDirty) return; // rebuilt from scratch before the next search
+    if (!tx.IsCoinBase()) {
+        for (const CTxIn& txin : tx.vin)
+            mapStakeCandidates.erase(txin.prevout);
+    }
+    if (pindex == nullptr) return;
+    const uint256& hash = tx.GetHash();
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        const CTxOut& txout = tx.vout[i];
+        if (txout.nValue < MIN_STAKE_AMOUNT) continue;
+        if ((IsMine(txout) & ISMINE_SPENDABLE) == ISMINE_NO) continue;
+        if (IsSpent(hash, i)) continue;
+        AddStakeCandidate(COutPoint(hash, i), txout.nValue);
+    }
+}
+
+void CWallet::GetStakeCandidates(std::vector<CStakeCandidate>& vCandidates, uint32_t nMaxTime)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
     const Consensus::Params& consensus = Params().GetConsensus();
 
-    CBlockIndex* pPrev = chainActive.Tip();
-    assert(pPrev != nullptr);
+    if (fStakeCandidatesDirty) {
+        mapStakeCandidates.clear();
+        for (const auto& entry : mapWallet) {
+            const CWalletTx& wtx = entry.second;
+            if (wtx.GetDepthInMainChain() <= 0) continue;
+            for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+                const CTxOut& txout = wtx.tx->vout[i];
+                if (txout.nValue < MIN_STAKE_AMOUNT) continue;
+                if ((IsMine(txout) & ISMINE_SPENDABLE) == ISMINE_NO) continue;
+                if (IsSpent(entry.first, i)) continue;
+                AddStakeCandidate(COutPoint(entry.first, i), txout.nValue);
+            }
+        }
+        fStakeCandidatesDirty = false;
+        LogPrint(BCLog::SELECTCOINS, "Rebuilt staking candidates: %u\n", mapStakeCandidates.size());
+    }
 
-    LOCK2(cs_main, cs_wallet);
+    int nTipHeight = chainActive.Height();
+    int nMaturity = (consensus.forkNumber(nTipHeight) >= 3) ? 50 : COINBASE_MATURITY;
+    bool fOldKernel = consensus.forkNumber(nTipHeight + 1) < 3;
+    vCandidates.clear();
+    vCandidates.reserve(mapStakeCandidates.size());
+    for (const auto& entry : mapStakeCandidates) {
+        CStakeCandidate candidate = entry.second;
+        if (candidate.nTime + consensus.nStakeMinAge > nMaxTime) continue;
+        if (candidate.fCoinBase && (nTipHeight - candidate.nHeight + 1 < nMaturity + 1)) continue;
+        if ((consensus.forkNumber(nTipHeight) == 2) && (consensus.forkNumber(candidate.nHeight) < 2)) continue;
+        if (IsLockedCoin(candidate.outpoint.hash, candidate.outpoint.n)) continue;
+        if (fOldKernel && !GetKernelStakeModifier(chainActive.Tip(), candidate.nTime, consensus, candidate.nStakeModifier)) continue;
+        vCandidates.push_back(candidate);
+    }
+}
+
+// pos: create coin stake transaction
+//
+// taler: in this implementation we send PoS outputs ONLY to bech32 segwit addresses to increase segwit usage
+// and reduce blocks size.
+//
+bool CWallet::CreateCoinStake (CBlockHeader& header, int64_t nSearchInterval, CMutableTransaction &txNew, CAmount& nPosReward)
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
 
     txNew.vin.clear();
     txNew.vout.clear();
 
     int nMaxSearchInterval = 60;
     if (nSearchInterval > nMaxSearchInterval) nSearchInterval = nMaxSearchInterval;
-    
-    int32_t nCoinStakeTime = header.nTime;
-    // Choose coins to use
-    std::vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, nullptr, 0);
-    LogPrint(BCLog::SELECTCOINS, "        Total select coin = %d\n", vCoins.size());
-    CAmount nCredit = 0;
-    static std::map<uint256, uint64_t> cachedCoins; 
-    CReserveKey key0(this);
-    for (const COutput& inpcoin : vCoins) {
-        if (!inpcoin.fSpendable) continue;
-        CInputCoin pcoin = inpcoin.GetInputCoin(); 
-        if (pcoin.txout.nValue < 10 * COIN) continue;
 
-        uint32_t offset, time;
-        if (!getCoinInfo (cachedCoins, pcoin.outpoint, time, offset)) continue;
+    int32_t nCoinStakeTime = header.nTime;
+    // Snapshot the staking candidates, then search for a kernel without holding cs_main or cs_wallet
+    const CBlockIndex* pPrev;
+    std::vector<CStakeCandidate> vCandidates;
+    {
+        LOCK2(cs_main, cs_wallet);
+        pPrev = chainActive.Tip();
+        assert(pPrev != nullptr);
+        if (pPrev->GetBlockHash() != header.hashPrevBlock) return false;
+        GetStakeCandidates(vCandidates, nCoinStakeTime - nSearchInterval);
+    }
+    LogPrint(BCLog::SELECTCOINS, "        Total select coin = %d\n", vCandidates.size());
 
-        if (time + consensus.nStakeMinAge > nCoinStakeTime - nSearchInterval) continue;
+    const CStakeCandidate* pKernel = FindStakeKernel(header, pPrev->nHeight + 1, vCandidates, nSearchInterval);
+    if (!pKernel) return false;
+    LogPrint(BCLog::SELECTCOINS, "CreateCoinStake : kernel found\n");
 
-        bool fKernelFound = false;
-        for (uint32_t n = 0; n < nSearchInterval && !fKernelFound; n++) {
-            header.nTime = nCoinStakeTime - n;
-            if (CheckProofOfStake (header, pPrev->nHeight + 1, consensus, pcoin.outpoint, pcoin.txout.nValue, time, offset)) {
-                LogPrint(BCLog::SELECTCOINS, "CreateCoinStake : kernel found\n");
-                fKernelFound = true;
-                nCredit += pcoin.txout.nValue;
-                txNew.vin.push_back(CTxIn(pcoin.outpoint.hash, pcoin.outpoint.n));
-                cachedCoins.erase (pcoin.outpoint.hash);      // erase from cache
+    LOCK2(cs_main, cs_wallet);
+    // The tip or the kernel coin may have changed while the locks were released
+    if ((chainActive.Tip() != pPrev) || !mapStakeCandidates.count(pKernel->outpoint)) return false;
 
-                CPubKey vchPubKey;
-                bool ret = key0.GetReservedKey(vchPubKey, true);
-                if (!ret) {
-                    return error("CreateCoinStake: Keypool ran out, please call keypoolrefill first");
-                }
+    CAmount nCredit = pKernel->nValue;
+    CReserveKey key0(this);
+    txNew.vin.push_back(CTxIn(pKernel->outpoint.hash, pKernel->outpoint.n));
+    {
+        CPubKey vchPubKey;
+        bool ret = key0.GetReservedKey(vchPubKey, true);
+        if (!ret) {
+            return error("CreateCoinStake: Keypool ran out, please call keypoolrefill first");
+        }
 
-                LearnRelatedScripts(vchPubKey, DEFAULT_ADDRESS_TYPE);
-                CScript scriptPubKeyOut = GetScriptForDestination(
-                    GetDestinationForKey(vchPubKey, DEFAULT_ADDRESS_TYPE));
+        LearnRelatedScripts(vchPubKey, DEFAULT_ADDRESS_TYPE);
+        CScript scriptPubKeyOut = GetScriptForDestination(
+            GetDestinationForKey(vchPubKey, DEFAULT_ADDRESS_TYPE));
 
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
-                if (pcoin.txout.nValue > 1000 * COIN) txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
-                break;
-            }
-        }
-        if (fKernelFound) break; // if kernel is found stop searching
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+        if (pKernel->nValue > 1000 * COIN) txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
     }
-    if (nCredit == 0) return false;
 
+    // Merge small coins into the stake
+    std::vector<COutput> vCoins;
+    AvailableCoins(vCoins, true, nullptr, 0);
+    std::map<uint256, uint64_t> cachedCoins;
     for (const COutput& inpcoin : vCoins) {
         if (!inpcoin.fSpendable) continue;
         CInputCoin pcoin = inpcoin.GetInputCoin();
         if (txNew.vin.size() > 31) break;
-        if (pcoin.txout.nValue > 10 * COIN) continue;
+        if (pcoin.txout.nValue > MIN_STAKE_AMOUNT) continue;
         if (txNew.vin[0].prevout == pcoin.outpoint) continue;
         uint32_t offset, time; 
         if (!getCoinInfo (cachedCoins, pcoin.outpoint, time, offset)) continue;
         if (time + consensus.nStakeMinAge > header.nTime) continue;
         txNew.vin.push_back(CTxIn(pcoin.outpoint.hash, pcoin.outpoint.n));
         nCredit += pcoin.txout.nValue;
-        cachedCoins.erase (pcoin.outpoint.hash);      // erase from cache
     }
 
     // Calculate coin age reward
@@ -48,6 +48,11 @@ bool HasWallets();
 std::vector<std::shared_ptr<CWallet>> GetWallets();
 std::shared_ptr<CWallet> GetWallet(const std::string& name);
 
+//! Number of threads searching for PoS kernels (-stakethreads); 0 searches on the calling thread
+extern int nStakeThreads;
+/** Run an instance of the PoS kernel search thread */
+void ThreadStakeKernelSearch();
+
 //! Default for -keypool
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 250;
 //! -paytxfee default
@@ -60,6 +65,8 @@ static const CAmount DEFAULT_DISCARD_FEE = 10000;
 static const CAmount DEFAULT_TRANSACTION_MINFEE = 1000;
 //! minimum recommended increment for BIP 125 replacement txs
 static const CAmount WALLET_INCREMENTAL_RELAY_FEE = 5000;
+//! Smallest output that may be used as a staking kernel; smaller ones are only merged into a stake
+static const CAmount MIN_STAKE_AMOUNT = 10 * COIN;
 //! Default for -spendzeroconfchange
 static const bool DEFAULT_SPEND_ZEROCONF_CHANGE = true;
 //! Default for -walletrejectlongchains
@@ -546,6 +553,18 @@ public:
     }
 };
 
+/** A confirmed wallet output large enough to stake, with the coin data its kernel hash needs. */
+struct CStakeCandidate
+{
+    COutPoint outpoint;
+    CAmount nValue;
+    uint32_t nTime;
+    uint32_t nOffset;
+    int nHeight;
+    bool fCoinBase;
+    uint64_t nStakeModifier; //!< only set in a search snapshot, for pre-fork-3 kernels
+};
+
 /** Private key that includes an expiration date in case it never gets used. */
 class CWalletKey
 {
@@ -730,6 +749,20 @@ private:
      * Should be called with pindexBlock and posInBlock if this is for a transaction that is included in a block. */
     void SyncTransaction(const CTransactionRef& tx, const CBlockIndex *pindex = nullptr, int posInBlock = 0, bool update_tx = true) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
 
+    /**
+     * Staking candidates: unspent outputs of at least 10 coins confirmed in the active chain, kept
+     * up to date from SyncTransaction so CreateCoinStake does not have to scan the whole wallet.
+     * A reorg or abandoned transaction can bring spent outputs back, so those mark the set dirty
+     * and it is rebuilt by a scan of mapWallet before the next search. That scan applies none of
+     * AvailableCoins' filters: locked coins, coinbase maturity and stake age are checked per
+     * search in GetStakeCandidates instead.
+     */
+    std::map<COutPoint, CStakeCandidate> mapStakeCandidates GUARDED_BY(cs_wallet);
+    bool fStakeCandidatesDirty GUARDED_BY(cs_wallet) = true;
+    void UpdateStakeCandidates(const CTransaction& tx, const CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main, cs_wallet);
+    bool AddStakeCandidate(const COutPoint& outpoint, CAmount nValue) EXCLUSIVE_LOCKS_REQUIRED(cs_main, cs_wallet);
+    void GetStakeCandidates(std::vector<CStakeCandidate>& vCandidates, uint32_t nMaxTime) EXCLUSIVE_LOCKS_REQUIRED(cs_main, cs_wallet);
+
     /* the HD chain data model (external chain counters) */
     CHDChain hdChain;
 